@@ -0,0 +1,136 @@
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "Database.h"
+
+using namespace KeyTagger;
+
+/**
+ * MediaQueryBenchmark - Column projection and ordinal row decoding
+ *
+ * Every iteration reads RowCount rows, so rows/sec is RowCount divided
+ * by the reported time. queryMedia is measured loading every field and
+ * loading only what the grid shows. The raw pair compares the former
+ * SELECT * with a lookup by column name against a projected SELECT
+ * decoded by ordinal.
+ */
+class MediaQueryBenchmark : public QObject {
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void queryAllFields();
+    void queryGridFields();
+    void decodeByName();
+    void decodeByOrdinal();
+
+private:
+    static constexpr int RowCount = 20000;
+
+    std::unique_ptr<QTemporaryDir> m_dir;
+    std::unique_ptr<Database> m_db;
+    QString m_connection = "MediaQueryBenchmark";
+};
+
+void MediaQueryBenchmark::initTestCase() {
+    m_dir = std::make_unique<QTemporaryDir>();
+    QVERIFY(m_dir->isValid());
+    m_db = std::make_unique<Database>(m_dir->filePath("data"));
+
+    const QString root = m_dir->filePath("photos");
+    for (int i = 0; i < RowCount; ++i) {
+        MediaRecord record;
+        record.filePath = QString("%1/%2/IMG_%3.jpg").arg(root).arg(i % 50).arg(i, 5, 10, QChar('0'));
+        record.rootDir = root;
+        record.fileName = QFileInfo(record.filePath).fileName();
+        record.sha256 = QString::number(i, 16).rightJustified(64, '0');
+        record.width = 4000;
+        record.height = 3000;
+        record.sizeBytes = 2000000 + i;
+        record.capturedTimeUtc = 1600000000 + i;
+        record.modifiedTimeUtc = 1700000000 + i;
+        record.mediaType = MediaType::Image;
+        record.thumbnailPath = root + "/thumbnails/" + record.sha256 + ".jpg";
+        record.quickHash = i;
+        m_db->upsertMedia(record);
+    }
+    m_db->flush().waitForFinished();
+
+    QSqlDatabase raw = QSqlDatabase::addDatabase("QSQLITE", m_connection);
+    raw.setDatabaseName(m_dir->filePath("data/keytag.sqlite"));
+    QVERIFY(raw.open());
+}
+
+void MediaQueryBenchmark::cleanupTestCase() {
+    QSqlDatabase::database(m_connection).close();
+    QSqlDatabase::removeDatabase(m_connection);
+    m_db.reset();
+    m_dir.reset();
+}
+
+void MediaQueryBenchmark::queryAllFields() {
+    QBENCHMARK {
+        auto result = m_db->queryMedia({}, QString(), RowCount, 0, Database::DefaultMediaOrder,
+                                       QString(), true, QString(), AllMediaFields);
+        QCOMPARE(result.records.size(), RowCount);
+    }
+}
+
+void MediaQueryBenchmark::queryGridFields() {
+    QBENCHMARK {
+        auto result = m_db->queryMedia({}, QString(), RowCount, 0, Database::DefaultMediaOrder,
+                                       QString(), true, QString(), GridMediaFields);
+        QCOMPARE(result.records.size(), RowCount);
+    }
+}
+
+void MediaQueryBenchmark::decodeByName() {
+    QSqlQuery query(QSqlDatabase::database(m_connection));
+    query.setForwardOnly(true);
+    QBENCHMARK {
+        QVERIFY(query.exec("SELECT * FROM media"));
+        int rows = 0;
+        while (query.next()) {
+            MediaRecord record;
+            record.id = query.value("id").toLongLong();
+            record.fileName = query.value("file_name").toString();
+            record.mediaType = MediaType(query.value("media_type").toInt());
+            record.thumbnailPath = query.value("thumbnail_path").toString();
+            record.width = query.value("width").toInt();
+            record.height = query.value("height").toInt();
+            record.sizeBytes = query.value("size_bytes").toLongLong();
+            record.modifiedTimeUtc = query.value("modified_time_utc").toLongLong();
+            ++rows;
+        }
+        QCOMPARE(rows, RowCount);
+    }
+}
+
+void MediaQueryBenchmark::decodeByOrdinal() {
+    QSqlQuery query(QSqlDatabase::database(m_connection));
+    QVERIFY(query.prepare("SELECT id, file_name, media_type, thumbnail_path, width, height, "
+                          "size_bytes, modified_time_utc FROM media"));
+    query.setForwardOnly(true);
+    QBENCHMARK {
+        QVERIFY(query.exec());
+        int rows = 0;
+        MediaRecord record;
+        while (query.next()) {
+            record.id = query.value(0).toLongLong();
+            record.fileName = query.value(1).toString();
+            record.mediaType = MediaType(query.value(2).toInt());
+            record.thumbnailPath = query.value(3).toString();
+            record.width = query.value(4).toInt();
+            record.height = query.value(5).toInt();
+            record.sizeBytes = query.value(6).toLongLong();
+            record.modifiedTimeUtc = query.value(7).toLongLong();
+            ++rows;
+        }
+        QCOMPARE(rows, RowCount);
+    }
+}
+
+QTEST_GUILESS_MAIN(MediaQueryBenchmark)
+#include "MediaQueryBenchmark.moc"
@@ -0,0 +1,88 @@
+#include <QFileInfo>
+#include <QSet>
+#include <QStringList>
+#include <QtTest>
+#include "MediaTypes.h"
+
+using namespace KeyTagger;
+
+namespace {
+
+// The lookup MediaTypes::classify replaced: a QFileInfo, a lowercase
+// ".suffix" string and up to three set probes per file
+const QSet<QString> ImageExtensions = {".jpg", ".jpeg", ".png", ".webp", ".bmp", ".tif", ".tiff", ".gif"};
+const QSet<QString> VideoExtensions = {".mp4", ".mov", ".avi", ".mkv", ".webm", ".m4v", ".wmv", ".3gp"};
+const QSet<QString> AudioExtensions = {".m4a", ".mp3", ".wav", ".flac", ".ogg", ".aac"};
+
+MediaType classifyWithSets(const QString& path) {
+    QString ext = "." + QFileInfo(path).suffix().toLower();
+    if (ImageExtensions.contains(ext)) return MediaType::Image;
+    if (VideoExtensions.contains(ext)) return MediaType::Video;
+    if (AudioExtensions.contains(ext)) return MediaType::Audio;
+    return MediaType::Unknown;
+}
+
+} // namespace
+
+/**
+ * MediaTypesBenchmark - Extension classification on the enumeration path
+ *
+ * Both lookups classify the same paths, a mix of media in assorted case
+ * and the sidecar and document files a photo library also holds. Every
+ * iteration classifies PathCount paths.
+ */
+class MediaTypesBenchmark : public QObject {
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void sameResults();
+    void classifyWithQSet();
+    void classifyWithPerfectHash();
+
+private:
+    static constexpr int PathCount = 10000;
+
+    QStringList m_paths;
+};
+
+void MediaTypesBenchmark::initTestCase() {
+    const QStringList extensions = {"jpg", "JPG", "jpeg", "png", "HEIC", "webp", "mp4", "MOV",
+                                    "mkv", "mp3", "xmp", "txt", "json", "tiff", "3gp", "aae"};
+    m_paths.reserve(PathCount);
+    for (int i = 0; i < PathCount; ++i) {
+        m_paths << QString("/home/user/Pictures/%1/IMG_%2.%3")
+                       .arg(2000 + i % 25).arg(i, 5, 10, QChar('0')).arg(extensions[i % extensions.size()]);
+    }
+}
+
+void MediaTypesBenchmark::sameResults() {
+    for (const QString& path : std::as_const(m_paths)) {
+        QCOMPARE(MediaTypes::classify(path), classifyWithSets(path));
+    }
+}
+
+void MediaTypesBenchmark::classifyWithQSet() {
+    int media = 0;
+    QBENCHMARK {
+        media = 0;
+        for (const QString& path : std::as_const(m_paths)) {
+            if (classifyWithSets(path) != MediaType::Unknown) ++media;
+        }
+    }
+    QVERIFY(media > 0);
+}
+
+void MediaTypesBenchmark::classifyWithPerfectHash() {
+    int media = 0;
+    QBENCHMARK {
+        media = 0;
+        for (const QString& path : std::as_const(m_paths)) {
+            if (MediaTypes::classify(path) != MediaType::Unknown) ++media;
+        }
+    }
+    QVERIFY(media > 0);
+}
+
+QTEST_GUILESS_MAIN(MediaTypesBenchmark)
+#include "MediaTypesBenchmark.moc"
@@ -0,0 +1,21 @@
+#include <QBuffer>
+#include <QByteArray>
+#include <cstddef>
+#include <cstdint>
+#include "ImageMetadata.h"
+
+/**
+ * ImageMetadataFuzzer - libFuzzer entry point for ImageMetadata::read
+ *
+ * Feeds arbitrary bytes to the JPEG, TIFF, PNG, WebP and GIF header
+ * parsers. Any result is accepted; a crash, hang or sanitizer report is
+ * the failure.
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(data), qsizetype(size));
+    QBuffer buffer(&bytes);
+    if (!buffer.open(QIODevice::ReadOnly)) return 0;
+
+    KeyTagger::ImageMetadata::read(buffer);
+    return 0;
+}
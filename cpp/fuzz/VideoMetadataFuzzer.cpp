@@ -0,0 +1,21 @@
+#include <QBuffer>
+#include <QByteArray>
+#include <cstddef>
+#include <cstdint>
+#include "VideoMetadata.h"
+
+/**
+ * VideoMetadataFuzzer - libFuzzer entry point for VideoMetadata::read
+ *
+ * Feeds arbitrary bytes to the ISO base media, Matroska and AVI header
+ * walkers. Any result is accepted; a crash, hang or sanitizer report is
+ * the failure.
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(data), qsizetype(size));
+    QBuffer buffer(&bytes);
+    if (!buffer.open(QIODevice::ReadOnly)) return 0;
+
+    KeyTagger::VideoMetadata::read(buffer);
+    return 0;
+}
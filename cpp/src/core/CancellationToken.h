@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+#include <memory>
+
+namespace KeyTagger {
+
+/**
+ * CancellationToken - Shared flag for cooperative cancellation
+ *
+ * Copies share one flag, so the thread that owns a job can hand its token
+ * to every stage that works for it: hashing loops check it per chunk,
+ * decode admission while waiting, and DirectoryWalker through flag().
+ * Polling is a relaxed atomic load, cheap enough for inner loops.
+ *
+ * A thread that must block can sleep in waitUntil() instead of polling;
+ * cancel() wakes it, and so does notify() from whoever changes what it
+ * waits for.
+ */
+class CancellationToken {
+public:
+    CancellationToken() : m_state(std::make_shared<State>()) {}
+
+    void cancel() const {
+        m_state->cancelled.store(true, std::memory_order_relaxed);
+        notify();
+    }
+    bool isCancelled() const { return m_state->cancelled.load(std::memory_order_relaxed); }
+
+    // For code that polls a plain flag
+    const std::atomic<bool>* flag() const { return &m_state->cancelled; }
+
+    // Wakes threads in waitUntil() so they re-check their condition
+    void notify() const {
+        QMutexLocker locker(&m_state->mutex);
+        m_state->changed.wakeAll();
+    }
+
+    // Blocks until done() holds, returning false if cancelled first. done
+    // is checked under the token's lock, so a notify() made after the
+    // condition changed is never missed.
+    template <typename Done>
+    bool waitUntil(Done done) const {
+        QMutexLocker locker(&m_state->mutex);
+        while (!done()) {
+            if (isCancelled()) return false;
+            m_state->changed.wait(&m_state->mutex);
+        }
+        return true;
+    }
+
+private:
+    struct State {
+        std::atomic<bool> cancelled{false};
+        QMutex mutex;
+        QWaitCondition changed;
+    };
+
+    std::shared_ptr<State> m_state;
+};
+
+} // namespace KeyTagger
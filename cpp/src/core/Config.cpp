@@ -158,6 +158,33 @@ void Config::setThumbnailSize(int size) {
     m_data["thumb_size"] = qBound(120, size, 512);
 }
 
+bool Config::tagIndexEnabled() const {
+    // Default to true; costs memory proportional to library size
+    return m_data.value("tag_index").toBool(true);
+}
+
+void Config::setTagIndexEnabled(bool enabled) {
+    m_data["tag_index"] = enabled;
+}
+
+int Config::decodeBudgetMb() const {
+    // Pixel memory all concurrent image decodes may hold together
+    return m_data.value("decode_budget_mb").toInt(1024);
+}
+
+void Config::setDecodeBudgetMb(int megabytes) {
+    m_data["decode_budget_mb"] = megabytes;
+}
+
+bool Config::metadataFirstScan() const {
+    // Scans skip thumbnails; they are generated when shown or when idle
+    return m_data.value("metadata_first_scan").toBool(false);
+}
+
+void Config::setMetadataFirstScan(bool enabled) {
+    m_data["metadata_first_scan"] = enabled;
+}
+
 QString Config::lastRootDir() const {
     return m_data.value("last_root_dir").toString();
 }
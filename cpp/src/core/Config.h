@@ -45,6 +45,16 @@ public:
     int thumbnailSize() const;
     void setThumbnailSize(int size);
     
+    // Performance
+    bool tagIndexEnabled() const;
+    void setTagIndexEnabled(bool enabled);
+    
+    int decodeBudgetMb() const;
+    void setDecodeBudgetMb(int megabytes);
+    
+    bool metadataFirstScan() const;
+    void setMetadataFirstScan(bool enabled);
+    
     // Navigation
     QString lastRootDir() const;
     void setLastRootDir(const QString& path);
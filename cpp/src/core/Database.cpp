@@ -1,13 +1,491 @@
 #include "Database.h"
+#include "DatabaseWriter.h"
+#include "StatementCache.h"
+#include "TagIndex.h"
+#include "SchemaMigrations.h"
+#include "DirectoryCache.h"
 #include <QSqlQuery>
 #include <QSqlError>
 #include <QDir>
 #include <QFileInfo>
+#include <QThread>
 #include <QDebug>
 #include <QUuid>
+#include <QPair>
+#include <utility>
+#include <algorithm>
 
 namespace KeyTagger {
 
+namespace {
+
+MediaType mediaTypeFromCode(int code) {
+    return code >= 0 && code <= int(MediaType::Unknown) ? MediaType(code) : MediaType::Unknown;
+}
+
+MediaError mediaErrorFromCode(int code) {
+    return code >= 0 && code <= int(MediaError::Undecodable) ? MediaError(code) : MediaError::None;
+}
+
+// Column expression for each MediaField, in select-list order. RootDir
+// has no column of its own; it is resolved from the directory id.
+struct MediaColumn {
+    MediaField field;
+    const char* sql;
+};
+
+constexpr MediaColumn MediaColumns[] = {
+    {MediaField::Id, "media.id"},
+    {MediaField::FilePath, "media.dir_id"},
+    {MediaField::RootDir, nullptr},
+    {MediaField::FileName, "media.file_name"},
+    {MediaField::Sha256, "media.sha256"},
+    {MediaField::PHash, "media.p_hash"},
+    {MediaField::Width, "media.width"},
+    {MediaField::Height, "media.height"},
+    {MediaField::SizeBytes, "media.size_bytes"},
+    {MediaField::CapturedTime, "media.captured_time_utc"},
+    {MediaField::ModifiedTime, "media.modified_time_utc"},
+    {MediaField::MediaType, "media.media_type"},
+    {MediaField::ThumbnailPath, "media.thumbnail_path"},
+    {MediaField::Status, "media.status"},
+    {MediaField::Error, "media.error"},
+    {MediaField::QuickHash, "media.quick_hash"},
+    {MediaField::ErrorClass, "media.error_class"},
+    {MediaField::FailureCount, "media.failure_count"},
+    {MediaField::RetryAfter, "media.retry_after_utc"},
+    {MediaField::Duration, "media.duration_ms"},
+};
+
+// Builds the select list for a projection and decodes rows by ordinal,
+// so no column is looked up by name per row. The id is always selected;
+// paths are rebuilt from dir_id and file_name through the DirectoryCache.
+class MediaRowDecoder {
+public:
+    MediaRowDecoder(MediaFields fields, DirectoryCache& directories, StatementCache& statements)
+        : m_wantPath(fields.testFlag(MediaField::FilePath))
+        , m_wantRoot(fields.testFlag(MediaField::RootDir))
+        , m_wantThumbnail(fields.testFlag(MediaField::ThumbnailPath))
+        , m_directories(directories)
+        , m_statements(statements) {
+        MediaFields selected = fields | MediaField::Id;
+        if (m_wantPath || m_wantRoot || m_wantThumbnail) selected |= MediaField::FilePath;
+        if (m_wantPath) selected |= MediaField::FileName;
+        
+        QStringList names;
+        for (const MediaColumn& column : MediaColumns) {
+            if (column.sql && selected.testFlag(column.field)) {
+                m_fields.append(column.field);
+                names << column.sql;
+            }
+        }
+        m_columns = names.join(", ");
+    }
+    
+    const QString& columns() const { return m_columns; }
+    
+    void decode(const QSqlQuery& query, MediaRecord& record) const {
+        qint64 dirId = 0;
+        for (int i = 0; i < m_fields.size(); ++i) {
+            const QVariant value = query.value(i);
+            switch (m_fields[i]) {
+                case MediaField::Id: record.id = value.toLongLong(); break;
+                case MediaField::FilePath: dirId = value.toLongLong(); break;
+                case MediaField::RootDir: break;
+                case MediaField::FileName: record.fileName = value.toString(); break;
+                case MediaField::Sha256: record.sha256 = value.toString(); break;
+                case MediaField::PHash:
+                    record.pHash = value.isNull() ? QString() : MediaRecord::pHashFromInt(value.toLongLong());
+                    break;
+                case MediaField::Width:
+                    record.width = value.isNull() ? std::nullopt : std::optional<int>(value.toInt());
+                    break;
+                case MediaField::Height:
+                    record.height = value.isNull() ? std::nullopt : std::optional<int>(value.toInt());
+                    break;
+                case MediaField::SizeBytes:
+                    record.sizeBytes = value.isNull() ? std::nullopt : std::optional<qint64>(value.toLongLong());
+                    break;
+                case MediaField::CapturedTime:
+                    record.capturedTimeUtc = value.isNull() ? std::nullopt : std::optional<qint64>(value.toLongLong());
+                    break;
+                case MediaField::ModifiedTime:
+                    record.modifiedTimeUtc = value.isNull() ? std::nullopt : std::optional<qint64>(value.toLongLong());
+                    break;
+                case MediaField::MediaType: record.mediaType = mediaTypeFromCode(value.toInt()); break;
+                case MediaField::ThumbnailPath: record.thumbnailPath = value.toString(); break;
+                case MediaField::Status:
+                    record.status = value.toInt() == int(MediaStatus::Active) ? MediaStatus::Active : MediaStatus::Deleted;
+                    break;
+                case MediaField::Error: record.error = value.toString(); break;
+                case MediaField::QuickHash:
+                    record.quickHash = value.isNull() ? std::nullopt : std::optional<qint64>(value.toLongLong());
+                    break;
+                case MediaField::ErrorClass: record.errorClass = mediaErrorFromCode(value.toInt()); break;
+                case MediaField::FailureCount: record.failureCount = value.toInt(); break;
+                case MediaField::RetryAfter:
+                    record.retryAfterUtc = value.isNull() ? std::nullopt : std::optional<qint64>(value.toLongLong());
+                    break;
+                case MediaField::Duration:
+                    record.durationMs = value.isNull() ? std::nullopt : std::optional<qint64>(value.toLongLong());
+                    break;
+            }
+        }
+        
+        if (dirId == 0) return;
+        std::optional<DirectoryCache::Entry> entry = m_directories.lookup(dirId, m_statements);
+        if (!entry) return;
+        if (m_wantPath) record.filePath = DirectoryCache::joinPath(entry->rootPath, entry->relativePath, record.fileName);
+        if (m_wantRoot) record.rootDir = entry->rootPath;
+        if (m_wantThumbnail) record.thumbnailPath = resolvedThumbnailPath(record.thumbnailPath, entry->rootPath);
+    }
+    
+private:
+    QVector<MediaField> m_fields;   // Select-list order
+    QString m_columns;
+    bool m_wantPath;
+    bool m_wantRoot;
+    bool m_wantThumbnail;
+    DirectoryCache& m_directories;
+    StatementCache& m_statements;
+};
+
+// Shared by every tag mutation; runs on the writer connection
+QVector<qint64> upsertTagsOn(WriteContext& ctx, const QStringList& tagNames) {
+    QVector<qint64> tagIds;
+    if (tagNames.isEmpty()) return tagIds;
+    
+    auto insert = ctx.statements.prepare("INSERT INTO tags(name) VALUES (?) ON CONFLICT(name) DO NOTHING");
+    auto select = ctx.statements.prepare("SELECT id FROM tags WHERE name = ?");
+    
+    for (const QString& name : tagNames) {
+        QString normalized = name.trimmed().toLower();
+        if (normalized.isEmpty()) continue;
+        
+        insert->addBindValue(normalized);
+        if (!insert->exec()) {
+            qWarning() << "Failed to create tag" << normalized << ":" << insert->lastError().text();
+            ctx.fail();
+            return tagIds;
+        }
+        bool created = insert->numRowsAffected() > 0;
+        
+        select->addBindValue(normalized);
+        if (select->exec() && select->next()) {
+            qint64 tagId = select->value(0).toLongLong();
+            tagIds.append(tagId);
+            if (created) {
+                ctx.record({IndexChange::Kind::CreateTag, 0, tagId, MediaType::Unknown, 0, normalized});
+            }
+        } else {
+            ctx.fail();
+        }
+        select->finish();
+    }
+    
+    return tagIds;
+}
+
+// Row id of a scan root, created on first use
+qint64 rootIdOn(WriteContext& ctx, const QString& rootDir) {
+    auto insert = ctx.statements.prepare("INSERT INTO roots(path) VALUES (?) ON CONFLICT(path) DO NOTHING");
+    insert->addBindValue(rootDir);
+    insert->exec();
+    
+    auto select = ctx.statements.prepare("SELECT id FROM roots WHERE path = ?");
+    select->addBindValue(rootDir);
+    if (select->exec() && select->next()) {
+        qint64 id = select->value(0).toLongLong();
+        select->finish();
+        return id;
+    }
+    
+    qWarning() << "Failed to register root" << rootDir << ":" << select->lastError().text();
+    ctx.fail();
+    return 0;
+}
+
+// Row id of a directory below a scan root, created on first use
+qint64 directoryIdOn(WriteContext& ctx, qint64 rootId, const QString& directory) {
+    auto insert = ctx.statements.prepare(
+        "INSERT INTO directories(root_id, path) VALUES (?, ?) ON CONFLICT(root_id, path) DO NOTHING");
+    insert->addBindValue(rootId);
+    insert->addBindValue(directory);
+    insert->exec();
+    
+    auto select = ctx.statements.prepare("SELECT id FROM directories WHERE root_id = ? AND path = ?");
+    select->addBindValue(rootId);
+    select->addBindValue(directory);
+    if (select->exec() && select->next()) {
+        qint64 id = select->value(0).toLongLong();
+        select->finish();
+        return id;
+    }
+    
+    qWarning() << "Failed to register directory" << directory << ":" << select->lastError().text();
+    ctx.fail();
+    return 0;
+}
+
+// A folder located below a stored root
+struct StoredFolder {
+    qint64 rootId = 0;
+    QString rootPath;
+    QString relativePath;   // Empty for the root itself
+};
+
+// Stored root containing an absolute folder. Nested roots resolve to
+// the innermost one.
+std::optional<StoredFolder> findRootOf(StatementCache& statements, const QString& folder) {
+    const QString path = QDir::cleanPath(folder);
+    auto query = statements.prepare("SELECT id, path FROM roots");
+    if (!query->exec()) return std::nullopt;
+    
+    std::optional<StoredFolder> best;
+    while (query->next()) {
+        const QString root = query->value(1).toString();
+        const QString prefix = root.endsWith('/') ? root : root + '/';
+        if (path != root && !path.startsWith(prefix)) continue;
+        if (best && best->rootPath.size() >= root.size()) continue;
+        
+        best = StoredFolder{query->value(0).toLongLong(), root,
+                            path == root ? QString() : path.mid(prefix.size())};
+    }
+    return best;
+}
+
+// Directory id holding an absolute file path, or 0 if it is not stored
+qint64 findDirectoryIdOf(StatementCache& statements, const QString& filePath, QString* rootPath = nullptr) {
+    auto folder = findRootOf(statements, QFileInfo(filePath).absolutePath());
+    if (!folder) return 0;
+    
+    auto select = statements.prepare("SELECT id FROM directories WHERE root_id = ? AND path = ?");
+    select->addBindValue(folder->rootId);
+    select->addBindValue(folder->relativePath);
+    if (select->exec() && select->next()) {
+        qint64 id = select->value(0).toLongLong();
+        select->finish();
+        if (rootPath) *rootPath = folder->rootPath;
+        return id;
+    }
+    return 0;
+}
+
+// Directory row for a file about to be stored, created on first use. A
+// folder inside a stored root stays in the innermost such root, and a new
+// root is only registered where none encloses the folder yet, so an
+// absolute path always maps to one (dir_id, file_name) however scan roots
+// nest. rootPath receives the root the row is stored under.
+qint64 directoryIdForWrite(WriteContext& ctx, const DirectoryCache::Location& location, QString* rootPath) {
+    const QString folder = DirectoryCache::joinPath(location.rootPath, location.directory);
+    if (auto stored = findRootOf(ctx.statements, folder)) {
+        *rootPath = stored->rootPath;
+        return directoryIdOn(ctx, stored->rootId, stored->relativePath);
+    }
+    
+    *rootPath = location.rootPath;
+    qint64 rootId = rootIdOn(ctx, location.rootPath);
+    return rootId ? directoryIdOn(ctx, rootId, location.directory) : 0;
+}
+
+// Directories making up the subtree at an absolute folder, as a condition
+// on directories aliased d: the folder's part of the innermost root holding
+// it, plus any root registered below it before an enclosing one existed
+struct FolderScope {
+    QString condition;
+    QVariantList params;
+};
+
+FolderScope folderScope(StatementCache& statements, const QString& folder) {
+    const QString path = QDir::cleanPath(folder);
+    const QString below = path.endsWith('/') ? path : path + '/';
+    
+    FolderScope scope;
+    QStringList clauses;
+    if (auto stored = findRootOf(statements, path)) {
+        if (stored->relativePath.isEmpty()) {
+            clauses << "d.root_id = ?";
+            scope.params << stored->rootId;
+        } else {
+            // The subtree is a range on directories(root_id, path), since '0' follows '/'
+            const QString& prefix = stored->relativePath;
+            clauses << "(d.root_id = ? AND (d.path = ? OR (d.path >= ? AND d.path < ?)))";
+            scope.params << stored->rootId << prefix << prefix + '/' << prefix + '0';
+        }
+    }
+    
+    auto roots = statements.prepare("SELECT id, path FROM roots");
+    if (roots->exec()) {
+        while (roots->next()) {
+            if (roots->value(1).toString().startsWith(below)) {
+                clauses << "d.root_id = ?";
+                scope.params << roots->value(0).toLongLong();
+            }
+        }
+    }
+    
+    scope.condition = clauses.isEmpty() ? QString("0") : "(" + clauses.join(" OR ") + ")";
+    return scope;
+}
+
+// Thumbnails inside the root are stored relative to it so they follow a relink
+QString storedThumbnailPath(const QString& thumbnailPath, const QString& rootPath) {
+    if (thumbnailPath.isEmpty()) return thumbnailPath;
+    const QString path = QDir::cleanPath(thumbnailPath);
+    const QString prefix = rootPath.endsWith('/') ? rootPath : rootPath + '/';
+    return path.startsWith(prefix) ? path.mid(prefix.size()) : path;
+}
+
+QString resolvedThumbnailPath(const QString& storedPath, const QString& rootPath) {
+    if (storedPath.isEmpty() || !QDir::isRelativePath(storedPath)) return storedPath;
+    return DirectoryCache::joinPath(rootPath, storedPath);
+}
+
+// Recompute tag_counts and media_stats from scratch
+void rebuildTagSummaries(QSqlDatabase& db) {
+    QSqlQuery query(db);
+    
+    // Links left behind by media deleted before the triggers existed
+    query.exec("DELETE FROM media_tags WHERE media_id NOT IN (SELECT id FROM media)");
+    
+    query.exec("DELETE FROM tag_counts");
+    query.exec(R"(
+        INSERT INTO tag_counts(tag_id, active_count)
+        SELECT t.id, COUNT(m.id)
+        FROM tags t
+        LEFT JOIN media_tags mt ON mt.tag_id = t.id
+        LEFT JOIN media m ON m.id = mt.media_id AND m.status = 0
+        GROUP BY t.id
+    )");
+    
+    query.exec(R"(
+        INSERT OR REPLACE INTO media_stats(id, untagged_count)
+        SELECT 1, COUNT(*) FROM media
+        WHERE status = 0
+        AND NOT EXISTS (SELECT 1 FROM media_tags WHERE media_id = media.id)
+    )");
+}
+
+// Path below the scan root, so searching a folder name matches its contents
+QString ftsRelativePathSql(const QString& row) {
+    return QString(
+        "(SELECT CASE path WHEN '' THEN %1.file_name ELSE path || '/' || %1.file_name END "
+        "FROM directories WHERE id = %1.dir_id)"
+    ).arg(row);
+}
+
+// Space-separated tag names of one media item
+QString ftsTagListSql(const QString& mediaId) {
+    return QString(
+        "(SELECT COALESCE(group_concat(t.name, ' '), '') FROM media_tags mt "
+        "JOIN tags t ON t.id = mt.tag_id WHERE mt.media_id = %1)"
+    ).arg(mediaId);
+}
+
+// Create the media_fts index and its triggers. Returns false when the
+// SQLite build lacks FTS5, in which case search falls back to LIKE.
+bool initializeFullTextSearch(QSqlDatabase& db) {
+    QSqlQuery query(db);
+    
+    query.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'media_fts'");
+    bool existed = query.next();
+    query.finish();
+    
+    if (!query.exec(R"(
+        CREATE VIRTUAL TABLE IF NOT EXISTS media_fts USING fts5(
+            name, path, tags,
+            tokenize = 'unicode61 remove_diacritics 2'
+        )
+    )")) {
+        qWarning() << "FTS5 unavailable, search will use LIKE:" << query.lastError().text();
+        return false;
+    }
+    
+    // rowid mirrors media.id
+    query.exec(QString(R"(
+        CREATE TRIGGER IF NOT EXISTS trg_media_fts_insert AFTER INSERT ON media
+        BEGIN
+            INSERT INTO media_fts(rowid, name, path, tags)
+            VALUES (NEW.id, NEW.file_name, %1, %2);
+        END
+    )").arg(ftsRelativePathSql("NEW"), ftsTagListSql("NEW.id")));
+    query.exec(QString(R"(
+        CREATE TRIGGER IF NOT EXISTS trg_media_fts_update
+        AFTER UPDATE OF dir_id, file_name ON media
+        BEGIN
+            UPDATE media_fts SET name = NEW.file_name, path = %1 WHERE rowid = NEW.id;
+        END
+    )").arg(ftsRelativePathSql("NEW")));
+    query.exec(R"(
+        CREATE TRIGGER IF NOT EXISTS trg_media_fts_delete AFTER DELETE ON media
+        BEGIN
+            DELETE FROM media_fts WHERE rowid = OLD.id;
+        END
+    )");
+    query.exec(QString(R"(
+        CREATE TRIGGER IF NOT EXISTS trg_media_tags_fts_insert AFTER INSERT ON media_tags
+        BEGIN
+            UPDATE media_fts SET tags = %1 WHERE rowid = NEW.media_id;
+        END
+    )").arg(ftsTagListSql("NEW.media_id")));
+    query.exec(QString(R"(
+        CREATE TRIGGER IF NOT EXISTS trg_media_tags_fts_delete AFTER DELETE ON media_tags
+        BEGIN
+            UPDATE media_fts SET tags = %1 WHERE rowid = OLD.media_id;
+        END
+    )").arg(ftsTagListSql("OLD.media_id")));
+    
+    if (!existed) {
+        query.exec(QString(R"(
+            INSERT INTO media_fts(rowid, name, path, tags)
+            SELECT m.id, m.file_name, %1, %2 FROM media m
+        )").arg(ftsRelativePathSql("m"), ftsTagListSql("m.id")));
+    }
+    
+    return true;
+}
+
+// Checked sidebar tags and the typed expression must both match
+TagQuery combinedTagQuery(const QStringList& requiredTags, bool tagsMatchAll, const QString& tagExpression) {
+    return TagQuery::intersection(
+        tagsMatchAll ? TagQuery::allOf(requiredTags) : TagQuery::anyOf(requiredTags),
+        TagQuery::parse(tagExpression));
+}
+
+// Turn search box text into an FTS5 query: bare words become prefix
+// terms, "quoted text" becomes a phrase, and all terms must match
+QString ftsMatchExpression(const QString& searchText) {
+    QStringList terms;
+    QString current;
+    bool inQuotes = false;
+    
+    auto quote = [](const QString& text) {
+        return '"' + QString(text).replace('"', "\"\"") + '"';
+    };
+    auto flush = [&]() {
+        QString term = current.trimmed();
+        current.clear();
+        if (term.isEmpty()) return;
+        terms << (inQuotes ? quote(term) : quote(term) + '*');
+    };
+    
+    for (QChar c : searchText) {
+        if (c == '"') {
+            flush();
+            inQuotes = !inQuotes;
+        } else if (c.isSpace() && !inQuotes) {
+            flush();
+        } else {
+            current += c;
+        }
+    }
+    flush();
+    
+    return terms.join(' ');
+}
+
+} // namespace
+
 Database::Database(const QString& baseDir, QObject* parent)
     : QObject(parent)
     , m_baseDir(QDir(baseDir).absolutePath())
@@ -18,232 +496,628 @@ Database::Database(const QString& baseDir, QObject* parent)
         dir.mkpath(".");
     }
     m_dbPath = dir.filePath("keytag.sqlite");
+    m_directories = std::make_unique<DirectoryCache>();
+    
+    m_writer = std::make_unique<DatabaseWriter>(m_dbPath);
+    // Direct, so the index is current before the batch's futures resolve
+    // and a flush().then() continuation never reads it stale
+    connect(m_writer.get(), &DatabaseWriter::batchCommitted,
+            this, &Database::onBatchCommitted, Qt::DirectConnection);
+    m_writer->start();
+    
     initializeSchema();
 }
 
 Database::~Database() {
-    {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-        if (db.isOpen()) {
-            db.close();
+    m_writer->shutdown();
+    
+    StatementStats stats = statementStats();
+    if (stats.hits + stats.misses > 0) {
+        qDebug() << "Statement cache:" << stats.hits << "hits," << stats.misses << "misses,"
+                 << QString::number(100.0 * stats.hits / (stats.hits + stats.misses), 'f', 1) + "% reuse";
+    }
+    
+    QMutexLocker locker(&m_connectionsMutex);
+    for (auto it = m_readerConnections.begin(); it != m_readerConnections.end(); ++it) {
+        const QString& name = it.key();
+        it.value()->clear();
+        {
+            QSqlDatabase db = QSqlDatabase::database(name, false);
+            if (db.isOpen()) {
+                db.close();
+            }
         }
+        QSqlDatabase::removeDatabase(name);
     }
-    QSqlDatabase::removeDatabase(m_connectionName);
+    m_readerConnections.clear();
+}
+
+QString Database::threadConnectionName() const {
+    // QSqlDatabase connections may only be used by the thread that opened them
+    return QString("%1_%2").arg(m_connectionName)
+        .arg(reinterpret_cast<quintptr>(QThread::currentThread()));
 }
 
 QSqlDatabase Database::getConnection() {
-    if (QSqlDatabase::contains(m_connectionName)) {
-        return QSqlDatabase::database(m_connectionName);
+    QThread* thread = QThread::currentThread();
+    QString name = threadConnectionName();
+    
+    if (QSqlDatabase::contains(name)) {
+        return QSqlDatabase::database(name);
     }
     
-    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
     db.setDatabaseName(m_dbPath);
     
     if (!db.open()) {
         qWarning() << "Failed to open database:" << db.lastError().text();
+    } else {
+        // Readers never write; every mutation goes through m_writer
+        QSqlQuery query(db);
+        query.exec("PRAGMA query_only=1");
+    }
+    
+    {
+        QMutexLocker locker(&m_connectionsMutex);
+        m_readerConnections.insert(name, std::make_shared<StatementCache>(db));
+    }
+    
+    // Drop worker-thread connections when their thread exits
+    if (thread != this->thread()) {
+        connect(thread, &QThread::finished, this, [this, name]() {
+            releaseConnection(name);
+        }, Qt::DirectConnection);
     }
     
     return db;
 }
 
-void Database::initializeSchema() {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    // Enable WAL mode for better concurrency
-    query.exec("PRAGMA journal_mode=WAL");
-    query.exec("PRAGMA synchronous=NORMAL");
-    
-    // Media table
-    query.exec(R"(
-        CREATE TABLE IF NOT EXISTS media (
-            id INTEGER PRIMARY KEY,
-            file_path TEXT NOT NULL UNIQUE,
-            root_dir TEXT NOT NULL,
-            file_name TEXT NOT NULL,
-            sha256 TEXT,
-            p_hash TEXT,
-            width INTEGER,
-            height INTEGER,
-            size_bytes INTEGER,
-            captured_time_utc INTEGER,
-            modified_time_utc INTEGER,
-            media_type TEXT NOT NULL,
-            thumbnail_path TEXT,
-            status TEXT NOT NULL DEFAULT 'active',
-            error TEXT
-        )
-    )");
-    
-    // Indexes
-    query.exec("CREATE INDEX IF NOT EXISTS idx_media_sha256 ON media(sha256)");
-    query.exec("CREATE INDEX IF NOT EXISTS idx_media_phash ON media(p_hash)");
-    query.exec("CREATE INDEX IF NOT EXISTS idx_media_file_path ON media(file_path)");
-    query.exec("CREATE INDEX IF NOT EXISTS idx_media_modified ON media(modified_time_utc)");
-    query.exec("CREATE INDEX IF NOT EXISTS idx_media_root_dir ON media(root_dir)");
-    
-    // Tags table
-    query.exec(R"(
-        CREATE TABLE IF NOT EXISTS tags (
-            id INTEGER PRIMARY KEY,
-            name TEXT NOT NULL UNIQUE
-        )
-    )");
-    
-    // Media-Tags junction table
-    query.exec(R"(
-        CREATE TABLE IF NOT EXISTS media_tags (
-            media_id INTEGER NOT NULL,
-            tag_id INTEGER NOT NULL,
-            PRIMARY KEY (media_id, tag_id),
-            FOREIGN KEY (media_id) REFERENCES media(id) ON DELETE CASCADE,
-            FOREIGN KEY (tag_id) REFERENCES tags(id) ON DELETE CASCADE
-        )
-    )");
+StatementCache& Database::statements() {
+    getConnection();
     
-    query.exec("CREATE INDEX IF NOT EXISTS idx_media_tags_media_id ON media_tags(media_id)");
-    query.exec("CREATE INDEX IF NOT EXISTS idx_media_tags_tag_id ON media_tags(tag_id)");
+    QMutexLocker locker(&m_connectionsMutex);
+    return *m_readerConnections.value(threadConnectionName());
 }
 
-qint64 Database::upsertMedia(const MediaRecord& record) {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    query.prepare(R"(
-        INSERT INTO media (
-            file_path, root_dir, file_name, sha256, p_hash, width, height,
-            size_bytes, captured_time_utc, modified_time_utc, media_type, 
-            thumbnail_path, status, error
-        ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 'active', ?)
-        ON CONFLICT(file_path) DO UPDATE SET
-            sha256=excluded.sha256,
-            p_hash=excluded.p_hash,
-            width=excluded.width,
-            height=excluded.height,
-            size_bytes=excluded.size_bytes,
-            captured_time_utc=excluded.captured_time_utc,
-            modified_time_utc=excluded.modified_time_utc,
-            media_type=excluded.media_type,
-            thumbnail_path=excluded.thumbnail_path,
-            status='active',
-            error=excluded.error
-    )");
-    
-    query.addBindValue(record.filePath);
-    query.addBindValue(record.rootDir);
-    query.addBindValue(record.fileName);
-    query.addBindValue(record.sha256.isEmpty() ? QVariant() : record.sha256);
-    query.addBindValue(record.pHash.isEmpty() ? QVariant() : record.pHash);
-    query.addBindValue(record.width.has_value() ? QVariant(record.width.value()) : QVariant());
-    query.addBindValue(record.height.has_value() ? QVariant(record.height.value()) : QVariant());
-    query.addBindValue(record.sizeBytes.has_value() ? QVariant(record.sizeBytes.value()) : QVariant());
-    query.addBindValue(record.capturedTimeUtc.has_value() ? QVariant(record.capturedTimeUtc.value()) : QVariant());
-    query.addBindValue(record.modifiedTimeUtc.has_value() ? QVariant(record.modifiedTimeUtc.value()) : QVariant());
-    query.addBindValue(MediaRecord::mediaTypeToString(record.mediaType));
-    query.addBindValue(record.thumbnailPath.isEmpty() ? QVariant() : record.thumbnailPath);
-    query.addBindValue(record.error.isEmpty() ? QVariant() : record.error);
-    
-    if (!query.exec()) {
-        qWarning() << "Failed to upsert media:" << query.lastError().text();
-        return 0;
+Database::StatementStats Database::statementStats() const {
+    StatementStats stats;
+    stats.hits = m_writer->statementHits();
+    stats.misses = m_writer->statementMisses();
+    
+    QMutexLocker locker(&m_connectionsMutex);
+    stats.hits += m_retiredStatementHits;
+    stats.misses += m_retiredStatementMisses;
+    for (const auto& cache : m_readerConnections) {
+        stats.hits += cache->hits();
+        stats.misses += cache->misses();
     }
-    
-    // Get the ID
-    query.prepare("SELECT id FROM media WHERE file_path = ?");
-    query.addBindValue(record.filePath);
-    if (query.exec() && query.next()) {
+    return stats;
+}
+
+void Database::releaseConnection(const QString& connectionName) {
+    {
+        QMutexLocker locker(&m_connectionsMutex);
+        auto cache = m_readerConnections.take(connectionName);
+        if (!cache) return;
+        
+        // Keep the counters of threads that have already finished
+        m_retiredStatementHits += cache->hits();
+        m_retiredStatementMisses += cache->misses();
+        cache->clear();
+    }
+    {
+        QSqlDatabase db = QSqlDatabase::database(connectionName, false);
+        if (db.isOpen()) {
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+void Database::onBatchCommitted(bool mediaChanged, bool tagsChanged, const IndexChangeset& changes) {
+    // Runs on the writer thread; the notifications below are queued to
+    // receivers living on other threads
+    {
+        QMutexLocker locker(&m_tagIndexMutex);
+        if (m_tagIndex) {
+            m_tagIndex->apply(changes);
+        } else if (m_tagIndexBuilding) {
+            m_pendingIndexChanges += changes;
+        }
+    }
+    if (mediaChanged) {
         emit databaseChanged();
-        return query.value(0).toLongLong();
     }
-    
-    return 0;
+    if (tagsChanged) {
+        emit tagsChanged();
+    }
+}
+
+QFuture<void> Database::flush() {
+    return m_writer->flush();
 }
 
-std::optional<MediaRecord> Database::getMedia(qint64 id) {
+void Database::setTagIndexEnabled(bool enabled) {
+    {
+        QMutexLocker locker(&m_tagIndexMutex);
+        if (m_tagIndexBuilding || enabled == (m_tagIndex != nullptr)) return;
+        if (enabled) {
+            // Buffer every change from here on; replaying one the snapshot
+            // already holds is harmless, as each change sets final state
+            m_tagIndexBuilding = true;
+            m_pendingIndexChanges.clear();
+        }
+    }
+    
+    if (!enabled) {
+        m_writer->setChangeTracking(false);
+        QMutexLocker locker(&m_tagIndexMutex);
+        m_tagIndex.reset();
+        return;
+    }
+    
+    // Track first, then let any untracked batch commit before the snapshot,
+    // so every change after the snapshot reaches the index
+    m_writer->setChangeTracking(true);
+    m_writer->flush().waitForFinished();
+    
+    // Read the snapshot without the lock so commits are not held up; they
+    // land in m_pendingIndexChanges and are replayed before the swap
+    auto index = std::make_shared<TagIndex>();
     QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
+    const bool built = index->build(db);
+    
+    QMutexLocker locker(&m_tagIndexMutex);
+    m_tagIndexBuilding = false;
+    IndexChangeset pending;
+    pending.swap(m_pendingIndexChanges);
+    if (!built) {
+        m_writer->setChangeTracking(false);
+        return;
+    }
+    index->apply(pending);
+    m_tagIndex = std::move(index);
+}
+
+const TagIndex* Database::tagIndex() const {
+    return currentTagIndex().get();
+}
+
+std::shared_ptr<TagIndex> Database::currentTagIndex() const {
+    QMutexLocker locker(&m_tagIndexMutex);
+    return m_tagIndex;
+}
+
+void Database::initializeSchema() {
+    QFuture<bool> done = m_writer->submit([](WriteContext& ctx) {
+        QSqlQuery query(ctx.db);
+        
+        bool migrated = false;
+        if (!SchemaMigrations::migrate(ctx.db, &migrated)) {
+            qWarning() << "Database schema could not be brought to version" << SchemaMigrations::CurrentVersion;
+            ctx.fail();
+            return false;
+        }
+        // Rebuilt tables leave their old pages on the freelist
+        ctx.vacuumRequested = migrated;
+        
+        // Summary tables for the sidebar, kept current by the triggers below
+        query.exec(R"(
+            CREATE TABLE IF NOT EXISTS tag_counts (
+                tag_id INTEGER PRIMARY KEY,
+                active_count INTEGER NOT NULL DEFAULT 0
+            )
+        )");
+        query.exec(R"(
+            CREATE TABLE IF NOT EXISTS media_stats (
+                id INTEGER PRIMARY KEY CHECK (id = 1),
+                untagged_count INTEGER NOT NULL DEFAULT 0
+            )
+        )");
+        
+        // Tag links: only active media count towards tags or untagged
+        query.exec(R"(
+            CREATE TRIGGER IF NOT EXISTS trg_media_tags_insert AFTER INSERT ON media_tags
+            WHEN (SELECT status FROM media WHERE id = NEW.media_id) = 0
+            BEGIN
+                UPDATE tag_counts SET active_count = active_count + 1 WHERE tag_id = NEW.tag_id;
+                UPDATE media_stats SET untagged_count = untagged_count - 1
+                WHERE id = 1 AND (SELECT COUNT(*) FROM media_tags WHERE media_id = NEW.media_id) = 1;
+            END
+        )");
+        query.exec(R"(
+            CREATE TRIGGER IF NOT EXISTS trg_media_tags_delete AFTER DELETE ON media_tags
+            WHEN (SELECT status FROM media WHERE id = OLD.media_id) = 0
+            BEGIN
+                UPDATE tag_counts SET active_count = active_count - 1 WHERE tag_id = OLD.tag_id;
+                UPDATE media_stats SET untagged_count = untagged_count + 1
+                WHERE id = 1 AND NOT EXISTS (SELECT 1 FROM media_tags WHERE media_id = OLD.media_id);
+            END
+        )");
+        
+        // Tags
+        query.exec(R"(
+            CREATE TRIGGER IF NOT EXISTS trg_tags_insert AFTER INSERT ON tags
+            BEGIN
+                INSERT OR IGNORE INTO tag_counts(tag_id, active_count) VALUES (NEW.id, 0);
+            END
+        )");
+        query.exec(R"(
+            CREATE TRIGGER IF NOT EXISTS trg_tags_delete AFTER DELETE ON tags
+            BEGIN
+                DELETE FROM tag_counts WHERE tag_id = OLD.id;
+            END
+        )");
+        
+        // Media rows. Foreign keys are not enforced, so unlink tags here;
+        // that runs the media_tags trigger while the row still exists.
+        query.exec(R"(
+            CREATE TRIGGER IF NOT EXISTS trg_media_insert AFTER INSERT ON media
+            WHEN NEW.status = 0
+                AND NOT EXISTS (SELECT 1 FROM media_tags WHERE media_id = NEW.id)
+            BEGIN
+                UPDATE media_stats SET untagged_count = untagged_count + 1 WHERE id = 1;
+            END
+        )");
+        query.exec(R"(
+            CREATE TRIGGER IF NOT EXISTS trg_media_before_delete BEFORE DELETE ON media
+            BEGIN
+                DELETE FROM media_tags WHERE media_id = OLD.id;
+            END
+        )");
+        query.exec(R"(
+            CREATE TRIGGER IF NOT EXISTS trg_media_delete AFTER DELETE ON media
+            WHEN OLD.status = 0
+            BEGIN
+                UPDATE media_stats SET untagged_count = untagged_count - 1 WHERE id = 1;
+            END
+        )");
+        query.exec(R"(
+            CREATE TRIGGER IF NOT EXISTS trg_media_deactivate AFTER UPDATE OF status ON media
+            WHEN OLD.status = 0 AND NEW.status <> 0
+            BEGIN
+                UPDATE tag_counts SET active_count = active_count - 1
+                WHERE tag_id IN (SELECT tag_id FROM media_tags WHERE media_id = NEW.id);
+                UPDATE media_stats SET untagged_count = untagged_count - 1
+                WHERE id = 1 AND NOT EXISTS (SELECT 1 FROM media_tags WHERE media_id = NEW.id);
+            END
+        )");
+        query.exec(R"(
+            CREATE TRIGGER IF NOT EXISTS trg_media_activate AFTER UPDATE OF status ON media
+            WHEN OLD.status <> 0 AND NEW.status = 0
+            BEGIN
+                UPDATE tag_counts SET active_count = active_count + 1
+                WHERE tag_id IN (SELECT tag_id FROM media_tags WHERE media_id = NEW.id);
+                UPDATE media_stats SET untagged_count = untagged_count + 1
+                WHERE id = 1 AND NOT EXISTS (SELECT 1 FROM media_tags WHERE media_id = NEW.id);
+            END
+        )");
+        
+        // First run on an existing library: build the summaries once
+        query.exec("SELECT 1 FROM media_stats WHERE id = 1");
+        if (!query.next()) {
+            rebuildTagSummaries(ctx.db);
+        }
+        
+        return initializeFullTextSearch(ctx.db);
+    });
     
-    query.prepare("SELECT * FROM media WHERE id = ?");
-    query.addBindValue(id);
+    // Readers must not run before the schema exists
+    m_fullTextSearch = writeResult(done).value_or(false);
+}
+
+bool Database::hasFullTextSearch() const {
+    return m_fullTextSearch;
+}
+
+QFuture<qint64> Database::upsertMedia(const MediaRecord& record) {
+    return m_writer->submit([record](WriteContext& ctx) -> qint64 {
+        DirectoryCache::Location location = DirectoryCache::splitPath(record.filePath, record.rootDir);
+        QString rootPath;
+        qint64 dirId = directoryIdForWrite(ctx, location, &rootPath);
+        if (dirId == 0) {
+            return 0;
+        }
+        
+        auto query = ctx.statements.prepare(R"(
+            INSERT INTO media (
+                dir_id, file_name, sha256, p_hash, width, height,
+                size_bytes, captured_time_utc, modified_time_utc, media_type, 
+                thumbnail_path, status, error, quick_hash,
+                error_class, failure_count, retry_after_utc, duration_ms
+            ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 0, ?, ?, ?, ?, ?, ?)
+            ON CONFLICT(dir_id, file_name) DO UPDATE SET
+                sha256=excluded.sha256,
+                p_hash=excluded.p_hash,
+                width=excluded.width,
+                height=excluded.height,
+                size_bytes=excluded.size_bytes,
+                captured_time_utc=excluded.captured_time_utc,
+                modified_time_utc=excluded.modified_time_utc,
+                media_type=excluded.media_type,
+                thumbnail_path=excluded.thumbnail_path,
+                status=0,
+                error=excluded.error,
+                quick_hash=excluded.quick_hash,
+                error_class=excluded.error_class,
+                failure_count=excluded.failure_count,
+                retry_after_utc=excluded.retry_after_utc,
+                duration_ms=excluded.duration_ms
+        )");
+        
+        std::optional<qint64> pHash = MediaRecord::pHashToInt(record.pHash);
+        
+        query->addBindValue(dirId);
+        query->addBindValue(location.fileName);
+        query->addBindValue(record.sha256.isEmpty() ? QVariant() : record.sha256);
+        query->addBindValue(pHash ? QVariant(*pHash) : QVariant());
+        query->addBindValue(record.width.has_value() ? QVariant(record.width.value()) : QVariant());
+        query->addBindValue(record.height.has_value() ? QVariant(record.height.value()) : QVariant());
+        query->addBindValue(record.sizeBytes.has_value() ? QVariant(record.sizeBytes.value()) : QVariant());
+        query->addBindValue(record.capturedTimeUtc.has_value() ? QVariant(record.capturedTimeUtc.value()) : QVariant());
+        query->addBindValue(record.modifiedTimeUtc.has_value() ? QVariant(record.modifiedTimeUtc.value()) : QVariant());
+        query->addBindValue(int(record.mediaType));
+        query->addBindValue(record.thumbnailPath.isEmpty()
+                            ? QVariant() : storedThumbnailPath(record.thumbnailPath, rootPath));
+        query->addBindValue(record.error.isEmpty() ? QVariant() : record.error);
+        query->addBindValue(record.quickHash.has_value() ? QVariant(record.quickHash.value()) : QVariant());
+        query->addBindValue(int(record.errorClass));
+        query->addBindValue(record.failureCount);
+        query->addBindValue(record.retryAfterUtc.has_value() ? QVariant(record.retryAfterUtc.value()) : QVariant());
+        query->addBindValue(record.durationMs.has_value() ? QVariant(record.durationMs.value()) : QVariant());
+        
+        if (!query->exec()) {
+            qWarning() << "Failed to upsert media:" << query->lastError().text();
+            ctx.fail();
+            return 0;
+        }
+        
+        // Get the ID
+        auto select = ctx.statements.prepare("SELECT id FROM media WHERE dir_id = ? AND file_name = ?");
+        select->addBindValue(dirId);
+        select->addBindValue(location.fileName);
+        if (select->exec() && select->next()) {
+            qint64 id = select->value(0).toLongLong();
+            ctx.mediaChanged = true;
+            ctx.record({IndexChange::Kind::UpsertMedia, id, 0, record.mediaType,
+                        record.modifiedTimeUtc.value_or(0), rootPath});
+            return id;
+        }
+        
+        return 0;
+    });
+}
+
+std::optional<MediaRecord> Database::getMedia(qint64 id, MediaFields fields) {
+    MediaRowDecoder decoder(fields, *m_directories, statements());
+    auto query = statements().prepare(QString("SELECT %1 FROM media WHERE id = ?").arg(decoder.columns()));
+    query->addBindValue(id);
     
-    if (!query.exec() || !query.next()) {
+    if (!query->exec() || !query->next()) {
         return std::nullopt;
     }
     
     MediaRecord record;
-    record.id = query.value("id").toLongLong();
-    record.filePath = query.value("file_path").toString();
-    record.rootDir = query.value("root_dir").toString();
-    record.fileName = query.value("file_name").toString();
-    record.sha256 = query.value("sha256").toString();
-    record.pHash = query.value("p_hash").toString();
-    if (!query.value("width").isNull()) record.width = query.value("width").toInt();
-    if (!query.value("height").isNull()) record.height = query.value("height").toInt();
-    if (!query.value("size_bytes").isNull()) record.sizeBytes = query.value("size_bytes").toLongLong();
-    if (!query.value("captured_time_utc").isNull()) record.capturedTimeUtc = query.value("captured_time_utc").toLongLong();
-    if (!query.value("modified_time_utc").isNull()) record.modifiedTimeUtc = query.value("modified_time_utc").toLongLong();
-    record.mediaType = MediaRecord::stringToMediaType(query.value("media_type").toString());
-    record.thumbnailPath = query.value("thumbnail_path").toString();
-    record.status = query.value("status").toString();
-    record.error = query.value("error").toString();
+    decoder.decode(*query, record);
     
     return record;
 }
 
-std::optional<MediaRecord> Database::getMediaByPath(const QString& filePath) {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
+std::optional<MediaRecord> Database::getMediaByPath(const QString& filePath, MediaFields fields) {
+    MediaRowDecoder decoder(fields, *m_directories, statements());
+    qint64 dirId = findDirectoryIdOf(statements(), filePath);
+    if (dirId == 0) {
+        return std::nullopt;
+    }
     
-    query.prepare("SELECT * FROM media WHERE file_path = ?");
-    query.addBindValue(filePath);
+    auto query = statements().prepare(
+        QString("SELECT %1 FROM media WHERE dir_id = ? AND file_name = ?").arg(decoder.columns()));
+    query->addBindValue(dirId);
+    query->addBindValue(QFileInfo(filePath).fileName());
     
-    if (!query.exec() || !query.next()) {
+    if (!query->exec() || !query->next()) {
         return std::nullopt;
     }
     
     MediaRecord record;
-    record.id = query.value("id").toLongLong();
-    record.filePath = query.value("file_path").toString();
-    record.rootDir = query.value("root_dir").toString();
-    record.fileName = query.value("file_name").toString();
-    record.sha256 = query.value("sha256").toString();
-    record.pHash = query.value("p_hash").toString();
-    if (!query.value("width").isNull()) record.width = query.value("width").toInt();
-    if (!query.value("height").isNull()) record.height = query.value("height").toInt();
-    if (!query.value("size_bytes").isNull()) record.sizeBytes = query.value("size_bytes").toLongLong();
-    if (!query.value("captured_time_utc").isNull()) record.capturedTimeUtc = query.value("captured_time_utc").toLongLong();
-    if (!query.value("modified_time_utc").isNull()) record.modifiedTimeUtc = query.value("modified_time_utc").toLongLong();
-    record.mediaType = MediaRecord::stringToMediaType(query.value("media_type").toString());
-    record.thumbnailPath = query.value("thumbnail_path").toString();
-    record.status = query.value("status").toString();
-    record.error = query.value("error").toString();
+    decoder.decode(*query, record);
     
     return record;
 }
 
-bool Database::deleteMedia(const QString& filePath) {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    query.prepare("DELETE FROM media WHERE file_path = ?");
-    query.addBindValue(filePath);
+QVector<MediaRecord> Database::getMediaByIds(const QVector<qint64>& ids, MediaFields fields) {
+    // Fixed-size chunks padded with id 0 (never used) share one statement
+    constexpr int ChunkSize = 256;
+    static const QString placeholders = [] {
+        QString list = QString("?,").repeated(ChunkSize);
+        list.chop(1);
+        return list;
+    }();
+    
+    MediaRowDecoder decoder(fields, *m_directories, statements());
+    const QString sql = QString("SELECT %1 FROM media WHERE id IN (%2)").arg(decoder.columns(), placeholders);
+    
+    QHash<qint64, MediaRecord> found;
+    found.reserve(ids.size());
+    
+    for (int start = 0; start < ids.size(); start += ChunkSize) {
+        auto query = statements().prepare(sql);
+        for (int i = start; i < start + ChunkSize; ++i) {
+            query->addBindValue(i < ids.size() ? ids[i] : qint64(0));
+        }
+        
+        if (!query->exec()) {
+            qWarning() << "Failed to load media by id:" << query->lastError().text();
+            continue;
+        }
+        while (query->next()) {
+            MediaRecord record;
+            decoder.decode(*query, record);
+            found.insert(record.id, record);
+        }
+    }
     
-    bool success = query.exec() && query.numRowsAffected() > 0;
-    if (success) {
-        emit databaseChanged();
+    QVector<MediaRecord> records;
+    records.reserve(found.size());
+    for (qint64 id : ids) {
+        auto it = found.constFind(id);
+        if (it != found.constEnd()) {
+            records.append(*it);
+        }
     }
-    return success;
+    return records;
 }
 
-bool Database::updateThumbnailPath(const QString& filePath, const QString& thumbnailPath) {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
+QFuture<bool> Database::deleteMedia(const QString& filePath) {
+    return m_writer->submit([filePath](WriteContext& ctx) {
+        qint64 dirId = findDirectoryIdOf(ctx.statements, filePath);
+        if (dirId == 0) {
+            return false;
+        }
+        const QString fileName = QFileInfo(filePath).fileName();
+        
+        qint64 mediaId = 0;
+        if (ctx.trackChanges) {
+            auto select = ctx.statements.prepare("SELECT id FROM media WHERE dir_id = ? AND file_name = ?");
+            select->addBindValue(dirId);
+            select->addBindValue(fileName);
+            if (select->exec() && select->next()) {
+                mediaId = select->value(0).toLongLong();
+            }
+        }
+        
+        auto query = ctx.statements.prepare("DELETE FROM media WHERE dir_id = ? AND file_name = ?");
+        query->addBindValue(dirId);
+        query->addBindValue(fileName);
+        
+        if (!query->exec()) {
+            qWarning() << "Failed to delete media" << filePath << ":" << query->lastError().text();
+            ctx.fail();
+            return false;
+        }
+        bool success = query->numRowsAffected() > 0;
+        if (success) {
+            ctx.mediaChanged = true;
+            ctx.record({IndexChange::Kind::DeleteMedia, mediaId});
+        }
+        return success;
+    });
+}
+
+QFuture<bool> Database::updateThumbnailPath(const QString& filePath, const QString& thumbnailPath) {
+    return m_writer->submit([filePath, thumbnailPath](WriteContext& ctx) {
+        QString rootPath;
+        qint64 dirId = findDirectoryIdOf(ctx.statements, filePath, &rootPath);
+        if (dirId == 0) {
+            return false;
+        }
+        
+        auto query = ctx.statements.prepare("UPDATE media SET thumbnail_path = ? WHERE dir_id = ? AND file_name = ?");
+        query->addBindValue(thumbnailPath.isEmpty() ? QVariant() : storedThumbnailPath(thumbnailPath, rootPath));
+        query->addBindValue(dirId);
+        query->addBindValue(QFileInfo(filePath).fileName());
+        
+        if (!query->exec()) {
+            ctx.fail();
+            return false;
+        }
+        return true;
+    });
+}
+
+QFuture<bool> Database::updateVideoMetadata(const QString& filePath, qint64 durationMs,
+                                            std::optional<qint64> capturedTimeUtc) {
+    return m_writer->submit([filePath, durationMs, capturedTimeUtc](WriteContext& ctx) {
+        qint64 dirId = findDirectoryIdOf(ctx.statements, filePath);
+        if (dirId == 0) {
+            return false;
+        }
+        
+        auto query = ctx.statements.prepare(R"(
+            UPDATE media SET duration_ms = ?, captured_time_utc = COALESCE(?, captured_time_utc)
+            WHERE dir_id = ? AND file_name = ?
+        )");
+        query->addBindValue(durationMs);
+        query->addBindValue(capturedTimeUtc ? QVariant(*capturedTimeUtc) : QVariant());
+        query->addBindValue(dirId);
+        query->addBindValue(QFileInfo(filePath).fileName());
+        if (!query->exec()) {
+            ctx.fail();
+            return false;
+        }
+        
+        // Orderings by duration or capture time change
+        ctx.mediaChanged = true;
+        return true;
+    });
+}
+
+QFuture<bool> Database::updateModifiedTime(const QString& filePath, qint64 modifiedTimeUtc) {
+    return m_writer->submit([filePath, modifiedTimeUtc](WriteContext& ctx) {
+        QString rootPath;
+        qint64 dirId = findDirectoryIdOf(ctx.statements, filePath, &rootPath);
+        if (dirId == 0) {
+            return false;
+        }
+        const QString fileName = QFileInfo(filePath).fileName();
+        
+        auto select = ctx.statements.prepare("SELECT id, media_type FROM media WHERE dir_id = ? AND file_name = ?");
+        select->addBindValue(dirId);
+        select->addBindValue(fileName);
+        if (!select->exec() || !select->next()) {
+            return false;
+        }
+        qint64 mediaId = select->value(0).toLongLong();
+        MediaType mediaType = mediaTypeFromCode(select->value(1).toInt());
+        select->finish();
+        
+        auto query = ctx.statements.prepare("UPDATE media SET modified_time_utc = ? WHERE id = ?");
+        query->addBindValue(modifiedTimeUtc);
+        query->addBindValue(mediaId);
+        if (!query->exec()) {
+            ctx.fail();
+            return false;
+        }
+        
+        // The gallery orders by modification time
+        ctx.mediaChanged = true;
+        ctx.record({IndexChange::Kind::UpsertMedia, mediaId, 0, mediaType, modifiedTimeUtc, rootPath});
+        return true;
+    });
+}
+
+Database::SqlFilter Database::buildSqlFilter(const TagQuery& tagQuery, const QString& searchText,
+                                             const QString& rootDir) {
+    SqlFilter filter;
+    filter.fromSQL = "media";
+    filter.where << "media.status = 0";
+    
+    QString match = m_fullTextSearch ? ftsMatchExpression(searchText) : QString();
+    if (!match.isEmpty()) {
+        // File name hits outrank tag hits, which outrank folder hits
+        filter.fromSQL = "media JOIN media_fts ON media_fts.rowid = media.id";
+        filter.where << "media_fts MATCH ?";
+        filter.params << match;
+        filter.rankSQL = "bm25(media_fts, 10.0, 1.0, 5.0), ";
+    } else if (!searchText.trimmed().isEmpty()) {
+        filter.where << "file_name LIKE ?";
+        filter.params << QString("%%1%").arg(searchText.trimmed());
+    }
     
-    query.prepare("UPDATE media SET thumbnail_path = ? WHERE file_path = ?");
-    query.addBindValue(thumbnailPath.isEmpty() ? QVariant() : thumbnailPath);
-    query.addBindValue(filePath);
+    if (!tagQuery.isEmpty()) {
+        TagQueryPlanner::Plan plan = planTagQuery(tagQuery, false);
+        filter.where << plan.whereSql;
+        filter.params += plan.params;
+    }
+    
+    if (!rootDir.isEmpty()) {
+        // Any folder works, below a root or enclosing nested ones
+        FolderScope scope = folderScope(statements(), QDir(rootDir).absolutePath());
+        filter.where << "media.dir_id IN (SELECT d.id FROM directories d WHERE " + scope.condition + ")";
+        filter.params += scope.params;
+    }
     
-    return query.exec();
+    return filter;
 }
 
 Database::QueryResult Database::queryMedia(
@@ -253,312 +1127,546 @@ Database::QueryResult Database::queryMedia(
     int offset,
     const QString& orderBy,
     const QString& rootDir,
-    bool tagsMatchAll
+    bool tagsMatchAll,
+    const QString& tagExpression,
+    MediaFields fields
 ) {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
+    TagQuery tagQuery = combinedTagQuery(requiredTags, tagsMatchAll, tagExpression);
+    if (!tagQuery.isValid()) {
+        qWarning() << "Invalid tag query:" << tagQuery.errorString();
+        return {{}, 0};
+    }
     
-    QStringList whereClauses;
-    QVariantList params;
+    // Tag and type filters in the default order never need to reach SQLite
+    std::shared_ptr<TagIndex> index = currentTagIndex();
+    if (index && searchText.trimmed().isEmpty() && orderBy == DefaultMediaOrder) {
+        if (auto matched = index->evaluate(tagQuery, rootDir)) {
+            QVector<qint64> ids = index->orderedIds(*matched);
+            return {getMediaByIds(ids.mid(offset, limit), fields), int(ids.size())};
+        }
+    }
     
-    whereClauses << "status='active'";
+    SqlFilter filter = buildSqlFilter(tagQuery, searchText, rootDir);
+    QString whereSQL = filter.where.join(" AND ");
     
-    if (!searchText.isEmpty()) {
-        whereClauses << "file_name LIKE ?";
-        params << QString("%%1%").arg(searchText);
+    // The predicate runs once per filter; later pages and the total come
+    // from the materialized id list until the next committed write
+    QStringList signatureParts{filter.fromSQL, whereSQL, filter.rankSQL, orderBy};
+    for (const QVariant& param : std::as_const(filter.params)) {
+        signatureParts << param.toString();
     }
+    const QString signature = signatureParts.join(QChar(0x1f));
+    const quint64 generation = m_writer->generation();
     
-    if (!requiredTags.isEmpty()) {
-        QStringList normalizedTags;
-        for (const QString& tag : requiredTags) {
-            normalizedTags << tag.trimmed().toLower();
+    QVector<qint64> ids;
+    bool cached = false;
+    {
+        QMutexLocker locker(&m_resultCacheMutex);
+        if (m_resultCache.generation == generation && m_resultCache.signature == signature) {
+            ids = m_resultCache.ids;
+            cached = true;
         }
-        
-        QString placeholders = QString("?,").repeated(normalizedTags.size());
-        placeholders.chop(1);
-        
-        if (tagsMatchAll) {
-            whereClauses << QString(
-                "id IN (SELECT media_id FROM media_tags WHERE tag_id IN "
-                "(SELECT id FROM tags WHERE name IN (%1)) "
-                "GROUP BY media_id HAVING COUNT(DISTINCT tag_id) = %2)"
-            ).arg(placeholders).arg(normalizedTags.size());
-        } else {
-            whereClauses << QString(
-                "id IN (SELECT DISTINCT media_id FROM media_tags WHERE tag_id IN "
-                "(SELECT id FROM tags WHERE name IN (%1)))"
-            ).arg(placeholders);
+    }
+    
+    if (!cached) {
+        auto query = statements().prepare(QString("SELECT media.id FROM %1 WHERE %2 ORDER BY %3%4")
+            .arg(filter.fromSQL, whereSQL, filter.rankSQL, orderBy));
+        for (const QVariant& param : std::as_const(filter.params)) {
+            query->addBindValue(param);
         }
         
-        for (const QString& tag : normalizedTags) {
-            params << tag;
+        if (!query->exec()) {
+            qWarning() << "Failed to query media:" << query->lastError().text();
+            return {{}, 0};
+        }
+        while (query->next()) {
+            ids.append(query->value(0).toLongLong());
         }
+        query->finish();
+        
+        QMutexLocker locker(&m_resultCacheMutex);
+        m_resultCache = {signature, generation, ids};
     }
     
-    if (!rootDir.isEmpty()) {
-        whereClauses << "root_dir = ?";
-        params << QDir(rootDir).absolutePath();
-    }
+    return {getMediaByIds(ids.mid(offset, limit), fields), int(ids.size())};
+}
+
+TagQueryPlanner::Plan Database::planTagQuery(const TagQuery& query, bool exactTotal) {
+    TagQueryPlanner::Statistics stats;
     
-    QString whereSQL = whereClauses.join(" AND ");
+    auto lookup = statements().prepare(R"(
+        SELECT t.id, COALESCE(c.active_count, 0)
+        FROM tags t
+        LEFT JOIN tag_counts c ON c.tag_id = t.id
+        WHERE t.name = ?
+    )");
+    qint64 tagTotal = 0;
+    for (const QString& name : query.tagNames()) {
+        lookup->addBindValue(name);
+        if (lookup->exec() && lookup->next()) {
+            stats.tagIds.insert(name, lookup->value(0).toLongLong());
+            stats.tagCounts.insert(name, lookup->value(1).toLongLong());
+            tagTotal += lookup->value(1).toLongLong();
+        }
+        lookup->finish();
+    }
     
-    // Count total
-    query.prepare(QString("SELECT COUNT(*) FROM media WHERE %1").arg(whereSQL));
-    for (const QVariant& param : params) {
-        query.addBindValue(param);
+    // Tag-only plans just need relative sizes, so skip the table count
+    if (exactTotal || query.hasAttributeTerms()) {
+        auto count = statements().prepare("SELECT COUNT(*) FROM media WHERE status = 0");
+        if (count->exec() && count->next()) {
+            stats.totalMedia = count->value(0).toLongLong();
+        }
+    } else {
+        stats.totalMedia = std::max<qint64>(tagTotal, 1);
     }
     
-    int totalCount = 0;
-    if (query.exec() && query.next()) {
-        totalCount = query.value(0).toInt();
+    return TagQueryPlanner(stats).compile(query);
+}
+
+QString Database::explainTagQuery(const QString& tagExpression) {
+    TagQuery query = TagQuery::parse(tagExpression);
+    if (!query.isValid()) {
+        return QString("Error at position %1: %2").arg(query.errorPosition() + 1).arg(query.errorString());
     }
     
-    // Get records
-    query.prepare(QString("SELECT * FROM media WHERE %1 ORDER BY %2 LIMIT ? OFFSET ?")
-        .arg(whereSQL).arg(orderBy));
-    for (const QVariant& param : params) {
-        query.addBindValue(param);
+    TagQueryPlanner::Plan plan = planTagQuery(query, true);
+    
+    auto explain = statements().prepare(
+        QString("EXPLAIN QUERY PLAN SELECT media.id FROM media WHERE status = 0 AND %1").arg(plan.whereSql));
+    for (const QVariant& param : std::as_const(plan.params)) {
+        explain->addBindValue(param);
     }
-    query.addBindValue(limit);
-    query.addBindValue(offset);
     
-    QVector<MediaRecord> records;
-    if (query.exec()) {
-        while (query.next()) {
-            MediaRecord record;
-            record.id = query.value("id").toLongLong();
-            record.filePath = query.value("file_path").toString();
-            record.rootDir = query.value("root_dir").toString();
-            record.fileName = query.value("file_name").toString();
-            record.sha256 = query.value("sha256").toString();
-            record.pHash = query.value("p_hash").toString();
-            if (!query.value("width").isNull()) record.width = query.value("width").toInt();
-            if (!query.value("height").isNull()) record.height = query.value("height").toInt();
-            if (!query.value("size_bytes").isNull()) record.sizeBytes = query.value("size_bytes").toLongLong();
-            if (!query.value("captured_time_utc").isNull()) record.capturedTimeUtc = query.value("captured_time_utc").toLongLong();
-            if (!query.value("modified_time_utc").isNull()) record.modifiedTimeUtc = query.value("modified_time_utc").toLongLong();
-            record.mediaType = MediaRecord::stringToMediaType(query.value("media_type").toString());
-            record.thumbnailPath = query.value("thumbnail_path").toString();
-            record.status = query.value("status").toString();
-            record.error = query.value("error").toString();
-            records.append(record);
+    QStringList steps;
+    if (explain->exec()) {
+        while (explain->next()) {
+            steps << explain->value("detail").toString();
         }
     }
     
-    return {records, totalCount};
+    return plan.explain + "\n\nSQLite plan:\n" + steps.join('\n');
 }
 
 QHash<QString, QHash<QString, QVariant>> Database::existingMediaMapForRoot(const QString& rootDir) {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    query.prepare(R"(
-        SELECT file_path, size_bytes, modified_time_utc, thumbnail_path, sha256, media_type
-        FROM media
-        WHERE root_dir = ? AND status = 'active'
-    )");
-    query.addBindValue(QDir(rootDir).absolutePath());
+    // Rows may sit under the scanned folder's own root, an enclosing one
+    // or roots nested inside it; each path is rebuilt from its own root
+    FolderScope scope = folderScope(statements(), QDir(rootDir).absolutePath());
+    auto statement = statements().prepare(QString(R"(
+        SELECT r.path AS root, d.path AS directory, m.file_name, m.size_bytes, m.modified_time_utc,
+               m.thumbnail_path, m.sha256, m.media_type, m.quick_hash,
+               m.error, m.error_class, m.failure_count, m.retry_after_utc, m.duration_ms
+        FROM media m JOIN directories d ON d.id = m.dir_id JOIN roots r ON r.id = d.root_id
+        WHERE %1 AND m.status = 0
+    )").arg(scope.condition));
+    for (const QVariant& param : std::as_const(scope.params)) {
+        statement->addBindValue(param);
+    }
     
     QHash<QString, QHash<QString, QVariant>> result;
-    if (query.exec()) {
+    if (statement->exec()) {
+        QSqlQuery& query = *statement;
         while (query.next()) {
+            const QString rowRoot = query.value("root").toString();
             QHash<QString, QVariant> entry;
             entry["size_bytes"] = query.value("size_bytes");
             entry["modified_time_utc"] = query.value("modified_time_utc");
-            entry["thumbnail_path"] = query.value("thumbnail_path");
+            entry["thumbnail_path"] = resolvedThumbnailPath(query.value("thumbnail_path").toString(), rowRoot);
             entry["sha256"] = query.value("sha256");
             entry["media_type"] = query.value("media_type");
-            result[query.value("file_path").toString()] = entry;
+            entry["quick_hash"] = query.value("quick_hash");
+            entry["error"] = query.value("error");
+            entry["error_class"] = query.value("error_class");
+            entry["failure_count"] = query.value("failure_count");
+            entry["retry_after_utc"] = query.value("retry_after_utc");
+            entry["duration_ms"] = query.value("duration_ms");
+            result[DirectoryCache::joinPath(rowRoot, query.value("directory").toString(),
+                                            query.value("file_name").toString())] = entry;
         }
     }
     
     return result;
 }
 
-int Database::markMissingFilesDeleted(const QStringList& existingPaths, const QString& rootDir) {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
+QFuture<int> Database::markMissingFilesDeleted(const QStringList& existingPaths, const QString& rootDir) {
     QString absRootDir = QDir(rootDir).absolutePath();
     
-    if (existingPaths.isEmpty()) {
-        query.prepare("UPDATE media SET status='deleted' WHERE root_dir = ? AND status='active'");
-        query.addBindValue(absRootDir);
-    } else {
-        QString placeholders = QString("?,").repeated(existingPaths.size());
-        placeholders.chop(1);
+    // An unmounted or renamed root lists no files; that is not a deletion
+    if (!QFileInfo(absRootDir).isDir()) {
+        qWarning() << "Root" << absRootDir << "is unreachable, not marking its media missing";
+        return m_writer->submit([](WriteContext&) { return 0; });
+    }
+    
+    return m_writer->submit([existingPaths, absRootDir](WriteContext& ctx) {
+        // Paths are no longer stored whole, so diff against the scan here
+        QSet<QString> existing(existingPaths.begin(), existingPaths.end());
         
-        query.prepare(QString(
-            "UPDATE media SET status='deleted' "
-            "WHERE root_dir = ? AND status='active' AND file_path NOT IN (%1)"
-        ).arg(placeholders));
+        FolderScope scope = folderScope(ctx.statements, absRootDir);
+        auto select = ctx.statements.prepare(QString(R"(
+            SELECT m.id, r.path, d.path, m.file_name
+            FROM media m JOIN directories d ON d.id = m.dir_id JOIN roots r ON r.id = d.root_id
+            WHERE %1 AND m.status = 0
+        )").arg(scope.condition));
+        for (const QVariant& param : std::as_const(scope.params)) {
+            select->addBindValue(param);
+        }
         
-        query.addBindValue(absRootDir);
-        for (const QString& path : existingPaths) {
-            query.addBindValue(path);
+        QVector<qint64> missing;
+        if (select->exec()) {
+            while (select->next()) {
+                QString path = DirectoryCache::joinPath(select->value(1).toString(), select->value(2).toString(),
+                                                        select->value(3).toString());
+                if (!existing.contains(path)) {
+                    missing.append(select->value(0).toLongLong());
+                }
+            }
         }
-    }
-    
-    if (query.exec()) {
-        int affected = query.numRowsAffected();
+        select->finish();
+        
+        auto update = ctx.statements.prepare("UPDATE media SET status = 1 WHERE id = ?");
+        int affected = 0;
+        for (qint64 id : std::as_const(missing)) {
+            update->addBindValue(id);
+            if (!update->exec()) {
+                ctx.fail();
+                return 0;
+            }
+            ++affected;
+            ctx.record({IndexChange::Kind::DeactivateMedia, id});
+        }
+        
         if (affected > 0) {
-            emit databaseChanged();
+            ctx.mediaChanged = true;
         }
         return affected;
+    });
+}
+
+QVector<MediaRecord> Database::missingMediaForRoot(const QString& rootDir) {
+    FolderScope scope = folderScope(statements(), QDir(rootDir).absolutePath());
+    auto query = statements().prepare(QString(R"(
+        SELECT m.id, m.size_bytes, m.sha256, m.quick_hash
+        FROM media m JOIN directories d ON d.id = m.dir_id
+        WHERE %1
+        AND m.status = 1 AND m.sha256 IS NOT NULL AND m.size_bytes IS NOT NULL
+    )").arg(scope.condition));
+    for (const QVariant& param : std::as_const(scope.params)) {
+        query->addBindValue(param);
     }
     
-    return 0;
+    QVector<MediaRecord> records;
+    if (query->exec()) {
+        while (query->next()) {
+            MediaRecord record;
+            record.id = query->value(0).toLongLong();
+            record.sizeBytes = query->value(1).toLongLong();
+            record.sha256 = query->value(2).toString();
+            if (!query->value(3).isNull()) record.quickHash = query->value(3).toLongLong();
+            record.status = MediaStatus::Deleted;
+            records.append(record);
+        }
+    }
+    return records;
 }
 
-QVector<qint64> Database::upsertTags(const QStringList& tagNames) {
-    QVector<qint64> tagIds;
-    if (tagNames.isEmpty()) return tagIds;
-    
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
+QVector<MediaRecord> Database::mediaWithoutThumbnails(const QString& rootDir, qint64 afterId, int limit) {
+    MediaRowDecoder decoder(MediaField::FilePath | MediaField::RootDir | MediaField::Sha256 |
+                            MediaField::MediaType | MediaField::ThumbnailPath,
+                            *m_directories, statements());
+    FolderScope scope = folderScope(statements(), QDir(rootDir).absolutePath());
+    auto query = statements().prepare(QString(R"(
+        SELECT %1 FROM media JOIN directories d ON d.id = media.dir_id
+        WHERE %2
+        AND media.status = 0 AND media.error_class = 0 AND media.media_type IN (0, 1)
+        AND media.sha256 IS NOT NULL AND (media.thumbnail_path IS NULL OR media.thumbnail_path = '')
+        AND media.id > ?
+        ORDER BY media.id LIMIT ?
+    )").arg(decoder.columns(), scope.condition));
+    for (const QVariant& param : std::as_const(scope.params)) {
+        query->addBindValue(param);
+    }
+    query->addBindValue(afterId);
+    query->addBindValue(limit);
     
-    for (const QString& name : tagNames) {
-        QString normalized = name.trimmed().toLower();
-        if (normalized.isEmpty()) continue;
+    QVector<MediaRecord> records;
+    if (query->exec()) {
+        while (query->next()) {
+            MediaRecord record;
+            decoder.decode(*query, record);
+            records.append(record);
+        }
+    }
+    return records;
+}
+
+QFuture<qint64> Database::relocateMedia(qint64 mediaId, const QString& filePath, const QString& rootDir,
+                                        qint64 modifiedTimeUtc) {
+    return m_writer->submit([mediaId, filePath, rootDir, modifiedTimeUtc](WriteContext& ctx) -> qint64 {
+        DirectoryCache::Location location = DirectoryCache::splitPath(filePath, rootDir);
+        QString rootPath;
+        qint64 dirId = directoryIdForWrite(ctx, location, &rootPath);
+        if (dirId == 0) {
+            return 0;
+        }
         
-        query.prepare("INSERT INTO tags(name) VALUES (?) ON CONFLICT(name) DO NOTHING");
-        query.addBindValue(normalized);
-        query.exec();
+        // A stale row left at the destination would block the move
+        auto stale = ctx.statements.prepare("SELECT id FROM media WHERE dir_id = ? AND file_name = ? AND id <> ?");
+        stale->addBindValue(dirId);
+        stale->addBindValue(location.fileName);
+        stale->addBindValue(mediaId);
+        if (stale->exec() && stale->next()) {
+            qint64 staleId = stale->value(0).toLongLong();
+            stale->finish();
+            auto remove = ctx.statements.prepare("DELETE FROM media WHERE id = ?");
+            remove->addBindValue(staleId);
+            if (!remove->exec()) {
+                qWarning() << "Failed to replace media at" << filePath << ":" << remove->lastError().text();
+                ctx.fail();
+                return 0;
+            }
+            ctx.record({IndexChange::Kind::DeleteMedia, staleId});
+        }
         
-        query.prepare("SELECT id FROM tags WHERE name = ?");
-        query.addBindValue(normalized);
-        if (query.exec() && query.next()) {
-            tagIds.append(query.value(0).toLongLong());
+        auto update = ctx.statements.prepare(R"(
+            UPDATE media SET dir_id = ?, file_name = ?, modified_time_utc = ?, status = 0
+            WHERE id = ?
+        )");
+        update->addBindValue(dirId);
+        update->addBindValue(location.fileName);
+        update->addBindValue(modifiedTimeUtc);
+        update->addBindValue(mediaId);
+        if (!update->exec() || update->numRowsAffected() == 0) {
+            qWarning() << "Failed to relocate media" << mediaId << ":" << update->lastError().text();
+            ctx.fail();
+            return 0;
         }
-    }
-    
-    return tagIds;
+        
+        auto type = ctx.statements.prepare("SELECT media_type FROM media WHERE id = ?");
+        type->addBindValue(mediaId);
+        MediaType mediaType = MediaType::Unknown;
+        if (type->exec() && type->next()) {
+            mediaType = mediaTypeFromCode(type->value(0).toInt());
+        }
+        type->finish();
+        
+        ctx.mediaChanged = true;
+        ctx.record({IndexChange::Kind::UpsertMedia, mediaId, 0, mediaType, modifiedTimeUtc, rootPath});
+        return mediaId;
+    });
 }
 
-void Database::setMediaTags(qint64 mediaId, const QStringList& tagNames) {
-    QVector<qint64> tagIds = upsertTags(tagNames);
-    
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    query.prepare("DELETE FROM media_tags WHERE media_id = ?");
-    query.addBindValue(mediaId);
-    query.exec();
-    
-    for (qint64 tagId : tagIds) {
-        query.prepare("INSERT OR IGNORE INTO media_tags(media_id, tag_id) VALUES (?, ?)");
-        query.addBindValue(mediaId);
-        query.addBindValue(tagId);
-        query.exec();
+QStringList Database::rootFolders() {
+    QStringList roots;
+    auto query = statements().prepare("SELECT path FROM roots ORDER BY path");
+    if (query->exec()) {
+        while (query->next()) {
+            roots << query->value(0).toString();
+        }
     }
-    
-    emit tagsChanged();
+    return roots;
 }
 
-void Database::addMediaTags(qint64 mediaId, const QStringList& tagNames) {
-    QVector<qint64> tagIds = upsertTags(tagNames);
-    
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    for (qint64 tagId : tagIds) {
-        query.prepare("INSERT OR IGNORE INTO media_tags(media_id, tag_id) VALUES (?, ?)");
-        query.addBindValue(mediaId);
-        query.addBindValue(tagId);
-        query.exec();
-    }
+QFuture<bool> Database::relinkRoot(const QString& oldPath, const QString& newPath) {
+    const QString from = QDir::cleanPath(QDir(oldPath).absolutePath());
+    const QString to = QDir::cleanPath(QDir(newPath).absolutePath());
+    DirectoryCache* directories = m_directories.get();
     
-    emit tagsChanged();
+    return m_writer->submit([from, to, directories](WriteContext& ctx) {
+        if (from == to) return true;
+        
+        // The target may neither be another root nor nest with one, or the
+        // same file would be reachable through two roots
+        const QString toPrefix = to.endsWith('/') ? to : to + '/';
+        auto existing = ctx.statements.prepare("SELECT path FROM roots WHERE path <> ?");
+        existing->addBindValue(from);
+        if (!existing->exec()) {
+            qWarning() << "Failed to read roots:" << existing->lastError().text();
+            ctx.fail();
+            return false;
+        }
+        while (existing->next()) {
+            const QString root = existing->value(0).toString();
+            const QString prefix = root.endsWith('/') ? root : root + '/';
+            if (root == to || to.startsWith(prefix) || root.startsWith(toPrefix)) {
+                existing->finish();
+                qWarning() << "Cannot relink" << from << "to" << to << "- it overlaps root" << root;
+                return false;
+            }
+        }
+        
+        auto query = ctx.statements.prepare("UPDATE roots SET path = ? WHERE path = ?");
+        query->addBindValue(to);
+        query->addBindValue(from);
+        if (!query->exec() || query->numRowsAffected() == 0) {
+            qWarning() << "Failed to relink root" << from << ":" << query->lastError().text();
+            ctx.fail();
+            return false;
+        }
+        
+        // Cached directory entries carry the old root path
+        ctx.afterCommit.append([directories]() { directories->clear(); });
+        ctx.mediaChanged = true;
+        IndexChange change{IndexChange::Kind::RelinkRoot};
+        change.text = to;
+        change.previousText = from;
+        ctx.record(change);
+        return true;
+    });
 }
 
-void Database::removeMediaTags(qint64 mediaId, const QStringList& tagNames) {
-    if (tagNames.isEmpty()) return;
-    
+QFuture<QVector<qint64>> Database::upsertTags(const QStringList& tagNames) {
+    return m_writer->submit([tagNames](WriteContext& ctx) {
+        return upsertTagsOn(ctx, tagNames);
+    });
+}
+
+QFuture<void> Database::setMediaTags(qint64 mediaId, const QStringList& tagNames) {
+    return m_writer->submit([mediaId, tagNames](WriteContext& ctx) {
+        QVector<qint64> tagIds = upsertTagsOn(ctx, tagNames);
+        
+        if (ctx.trackChanges) {
+            auto previous = ctx.statements.prepare("SELECT tag_id FROM media_tags WHERE media_id = ?");
+            previous->addBindValue(mediaId);
+            if (previous->exec()) {
+                while (previous->next()) {
+                    ctx.record({IndexChange::Kind::UnlinkTag, mediaId, previous->value(0).toLongLong()});
+                }
+            }
+        }
+        
+        auto clear = ctx.statements.prepare("DELETE FROM media_tags WHERE media_id = ?");
+        clear->addBindValue(mediaId);
+        if (!clear->exec()) {
+            ctx.fail();
+            return;
+        }
+        
+        // A failed insert rolls the DELETE back too, keeping the old tags
+        auto insert = ctx.statements.prepare("INSERT OR IGNORE INTO media_tags(media_id, tag_id) VALUES (?, ?)");
+        for (qint64 tagId : tagIds) {
+            insert->addBindValue(mediaId);
+            insert->addBindValue(tagId);
+            if (!insert->exec()) {
+                qWarning() << "Failed to tag media" << mediaId << ":" << insert->lastError().text();
+                ctx.fail();
+                return;
+            }
+            ctx.record({IndexChange::Kind::LinkTag, mediaId, tagId});
+        }
+        
+        ctx.tagsChanged = true;
+    });
+}
+
+QFuture<void> Database::addMediaTags(qint64 mediaId, const QStringList& tagNames) {
+    return m_writer->submit([mediaId, tagNames](WriteContext& ctx) {
+        QVector<qint64> tagIds = upsertTagsOn(ctx, tagNames);
+        
+        auto insert = ctx.statements.prepare("INSERT OR IGNORE INTO media_tags(media_id, tag_id) VALUES (?, ?)");
+        for (qint64 tagId : tagIds) {
+            insert->addBindValue(mediaId);
+            insert->addBindValue(tagId);
+            if (!insert->exec()) {
+                qWarning() << "Failed to tag media" << mediaId << ":" << insert->lastError().text();
+                ctx.fail();
+                return;
+            }
+            ctx.record({IndexChange::Kind::LinkTag, mediaId, tagId});
+        }
+        
+        ctx.tagsChanged = true;
+    });
+}
+
+QFuture<void> Database::removeMediaTags(qint64 mediaId, const QStringList& tagNames) {
     QStringList normalized;
     for (const QString& tag : tagNames) {
         QString n = tag.trimmed().toLower();
         if (!n.isEmpty()) normalized << n;
     }
-    if (normalized.isEmpty()) return;
-    
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    QString placeholders = QString("?,").repeated(normalized.size());
-    placeholders.chop(1);
-    
-    // Get tag IDs
-    query.prepare(QString("SELECT id FROM tags WHERE name IN (%1)").arg(placeholders));
-    for (const QString& tag : normalized) {
-        query.addBindValue(tag);
-    }
     
-    QVector<qint64> tagIds;
-    if (query.exec()) {
-        while (query.next()) {
-            tagIds.append(query.value(0).toLongLong());
+    return m_writer->submit([mediaId, normalized](WriteContext& ctx) {
+        if (normalized.isEmpty()) return;
+        
+        // Get tag IDs
+        auto select = ctx.statements.prepare("SELECT id FROM tags WHERE name = ?");
+        QVector<qint64> tagIds;
+        for (const QString& tag : normalized) {
+            select->addBindValue(tag);
+            if (select->exec() && select->next()) {
+                tagIds.append(select->value(0).toLongLong());
+            }
+            select->finish();
         }
-    }
-    
-    for (qint64 tagId : tagIds) {
-        query.prepare("DELETE FROM media_tags WHERE media_id = ? AND tag_id = ?");
-        query.addBindValue(mediaId);
-        query.addBindValue(tagId);
-        query.exec();
-    }
-    
-    emit tagsChanged();
+        
+        auto remove = ctx.statements.prepare("DELETE FROM media_tags WHERE media_id = ? AND tag_id = ?");
+        for (qint64 tagId : tagIds) {
+            remove->addBindValue(mediaId);
+            remove->addBindValue(tagId);
+            if (!remove->exec()) {
+                ctx.fail();
+                return;
+            }
+            ctx.record({IndexChange::Kind::UnlinkTag, mediaId, tagId});
+        }
+        
+        ctx.tagsChanged = true;
+    });
 }
 
-int Database::removeTagGlobally(const QString& tagName) {
+QFuture<int> Database::removeTagGlobally(const QString& tagName) {
     QString normalized = tagName.trimmed().toLower();
-    if (normalized.isEmpty()) return 0;
-    
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
     
-    query.prepare("SELECT id FROM tags WHERE name = ?");
-    query.addBindValue(normalized);
-    
-    if (!query.exec() || !query.next()) return 0;
-    
-    qint64 tagId = query.value(0).toLongLong();
-    
-    query.prepare("DELETE FROM media_tags WHERE tag_id = ?");
-    query.addBindValue(tagId);
-    query.exec();
-    int affected = query.numRowsAffected();
-    
-    // Remove tag if no references remain
-    query.prepare("DELETE FROM tags WHERE id = ? AND NOT EXISTS (SELECT 1 FROM media_tags WHERE tag_id = ?)");
-    query.addBindValue(tagId);
-    query.addBindValue(tagId);
-    query.exec();
-    
-    if (affected > 0) {
-        emit tagsChanged();
-    }
-    
-    return affected;
+    return m_writer->submit([normalized](WriteContext& ctx) {
+        if (normalized.isEmpty()) return 0;
+        
+        auto select = ctx.statements.prepare("SELECT id FROM tags WHERE name = ?");
+        select->addBindValue(normalized);
+        
+        if (!select->exec() || !select->next()) return 0;
+        
+        qint64 tagId = select->value(0).toLongLong();
+        select->finish();
+        
+        auto unlink = ctx.statements.prepare("DELETE FROM media_tags WHERE tag_id = ?");
+        unlink->addBindValue(tagId);
+        if (!unlink->exec()) {
+            ctx.fail();
+            return 0;
+        }
+        int affected = unlink->numRowsAffected();
+        
+        // Remove tag if no references remain
+        auto remove = ctx.statements.prepare(
+            "DELETE FROM tags WHERE id = ? AND NOT EXISTS (SELECT 1 FROM media_tags WHERE tag_id = ?)");
+        remove->addBindValue(tagId);
+        remove->addBindValue(tagId);
+        if (remove->exec() && remove->numRowsAffected() > 0) {
+            ctx.record({IndexChange::Kind::DeleteTag, 0, tagId});
+        }
+        
+        if (affected > 0) {
+            ctx.tagsChanged = true;
+        }
+        
+        return affected;
+    });
 }
 
 QStringList Database::getMediaTags(qint64 mediaId) {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    query.prepare(R"(
+    auto query = statements().prepare(R"(
         SELECT t.name
         FROM tags t
         JOIN media_tags mt ON mt.tag_id = t.id
         WHERE mt.media_id = ?
         ORDER BY t.name ASC
     )");
-    query.addBindValue(mediaId);
+    query->addBindValue(mediaId);
     
     QStringList tags;
-    if (query.exec()) {
-        while (query.next()) {
-            tags << query.value(0).toString();
+    if (query->exec()) {
+        while (query->next()) {
+            tags << query->value(0).toString();
         }
     }
     
@@ -566,56 +1674,89 @@ QStringList Database::getMediaTags(qint64 mediaId) {
 }
 
 QStringList Database::allTags() {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    query.exec("SELECT name FROM tags ORDER BY name ASC");
+    auto query = statements().prepare("SELECT name FROM tags ORDER BY name ASC");
     
     QStringList tags;
-    while (query.next()) {
-        tags << query.value(0).toString();
+    if (query->exec()) {
+        while (query->next()) {
+            tags << query->value(0).toString();
+        }
     }
     
     return tags;
 }
 
 QVector<QPair<QString, int>> Database::tagCounts() {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    
-    query.exec(R"(
-        SELECT t.name, COUNT(mt.media_id) as cnt
+    // Maintained by triggers; see initializeSchema()
+    auto query = statements().prepare(R"(
+        SELECT t.name, COALESCE(c.active_count, 0)
         FROM tags t
-        LEFT JOIN media_tags mt ON mt.tag_id = t.id
-        LEFT JOIN media m ON m.id = mt.media_id AND m.status = 'active'
-        GROUP BY t.id
+        LEFT JOIN tag_counts c ON c.tag_id = t.id
         ORDER BY t.name ASC
     )");
     
     QVector<QPair<QString, int>> result;
-    while (query.next()) {
-        result.append({query.value(0).toString(), query.value(1).toInt()});
+    if (query->exec()) {
+        while (query->next()) {
+            result.append({query->value(0).toString(), query->value(1).toInt()});
+        }
     }
     
     return result;
 }
 
 int Database::untaggedCount() {
-    QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
+    auto query = statements().prepare("SELECT untagged_count FROM media_stats WHERE id = 1");
     
-    query.exec(R"(
-        SELECT COUNT(*) FROM media 
-        WHERE status = 'active' 
-        AND id NOT IN (SELECT DISTINCT media_id FROM media_tags)
-    )");
-    
-    if (query.next()) {
-        return query.value(0).toInt();
+    if (query->exec() && query->next()) {
+        return query->value(0).toInt();
     }
     
     return 0;
 }
 
+QHash<QString, int> Database::facetCounts(
+    const QStringList& requiredTags,
+    const QString& searchText,
+    const QString& rootDir,
+    bool tagsMatchAll,
+    const QString& tagExpression
+) {
+    TagQuery tagQuery = combinedTagQuery(requiredTags, tagsMatchAll, tagExpression);
+    if (!tagQuery.isValid()) {
+        return {};
+    }
+    
+    std::shared_ptr<TagIndex> index = currentTagIndex();
+    if (index && searchText.trimmed().isEmpty()) {
+        if (auto matched = index->evaluate(tagQuery, rootDir)) {
+            return index->facetCounts(*matched);
+        }
+    }
+    
+    SqlFilter filter = buildSqlFilter(tagQuery, searchText, rootDir);
+    auto query = statements().prepare(QString(R"(
+        SELECT t.name, COUNT(*)
+        FROM media_tags mt
+        JOIN tags t ON t.id = mt.tag_id
+        WHERE mt.media_id IN (SELECT media.id FROM %1 WHERE %2)
+        GROUP BY mt.tag_id
+    )").arg(filter.fromSQL, filter.where.join(" AND ")));
+    for (const QVariant& param : filter.params) {
+        query->addBindValue(param);
+    }
+    
+    QHash<QString, int> counts;
+    if (!query->exec()) {
+        qWarning() << "Failed to count facets:" << query->lastError().text();
+        return counts;
+    }
+    while (query->next()) {
+        counts.insert(query->value(0).toString(), query->value(1).toInt());
+    }
+    
+    return counts;
+}
+
 } // namespace KeyTagger
 
@@ -5,12 +5,32 @@
 #include <QSqlDatabase>
 #include <QVector>
 #include <QHash>
+#include <QSet>
 #include <QPair>
+#include <QMutex>
+#include <QFuture>
 #include <memory>
 #include "MediaRecord.h"
+#include "TagQuery.h"
+#include "WriteResult.h"
 
 namespace KeyTagger {
 
+class DatabaseWriter;
+class StatementCache;
+class TagIndex;
+class DirectoryCache;
+struct IndexChange;
+using IndexChangeset = QVector<IndexChange>;
+
+/**
+ * Database - SQLite storage for media records and tags
+ *
+ * Reads run on a per-thread connection owned by the calling thread.
+ * All mutations are routed through a single DatabaseWriter thread and
+ * return futures that resolve once the write has been committed, or
+ * carry WriteFailed if it was rolled back.
+ */
 class Database : public QObject {
     Q_OBJECT
 
@@ -19,13 +39,23 @@ public:
     ~Database();
 
     // Media operations
-    qint64 upsertMedia(const MediaRecord& record);
-    std::optional<MediaRecord> getMedia(qint64 id);
-    std::optional<MediaRecord> getMediaByPath(const QString& filePath);
-    bool deleteMedia(const QString& filePath);
-    bool updateThumbnailPath(const QString& filePath, const QString& thumbnailPath);
+    QFuture<qint64> upsertMedia(const MediaRecord& record);
+    // Reads load only the requested fields; the rest keep their defaults
+    std::optional<MediaRecord> getMedia(qint64 id, MediaFields fields = AllMediaFields);
+    std::optional<MediaRecord> getMediaByPath(const QString& filePath, MediaFields fields = AllMediaFields);
+    // Records for ids, in the order given; missing ids are skipped
+    QVector<MediaRecord> getMediaByIds(const QVector<qint64>& ids, MediaFields fields = AllMediaFields);
+    QFuture<bool> deleteMedia(const QString& filePath);
+    QFuture<bool> updateThumbnailPath(const QString& filePath, const QString& thumbnailPath);
+    // For files whose mtime moved but whose quick hash shows the same content
+    QFuture<bool> updateModifiedTime(const QString& filePath, qint64 modifiedTimeUtc);
+    // Backfills videos stored before durations were recorded
+    QFuture<bool> updateVideoMetadata(const QString& filePath, qint64 durationMs,
+                                      std::optional<qint64> capturedTimeUtc);
     
     // Query operations
+    static constexpr const char* DefaultMediaOrder = "modified_time_utc DESC, id DESC";
+    
     struct QueryResult {
         QVector<MediaRecord> records;
         int totalCount;
@@ -36,27 +66,74 @@ public:
         const QString& searchText = QString(),
         int limit = 200,
         int offset = 0,
-        const QString& orderBy = "modified_time_utc DESC, id DESC",
+        const QString& orderBy = DefaultMediaOrder,
         const QString& rootDir = QString(),
-        bool tagsMatchAll = true
+        bool tagsMatchAll = true,
+        const QString& tagExpression = QString(),
+        MediaFields fields = AllMediaFields
     );
     
+    // Planner decisions and SQLite's query plan for a tag expression
+    QString explainTagQuery(const QString& tagExpression);
+    
     // Existing media map for incremental scanning
     QHash<QString, QHash<QString, QVariant>> existingMediaMapForRoot(const QString& rootDir);
-    int markMissingFilesDeleted(const QStringList& existingPaths, const QString& rootDir);
+    QFuture<int> markMissingFilesDeleted(const QStringList& existingPaths, const QString& rootDir);
+    
+    // Records under rootDir whose files went missing (id, size, quick hash
+    // and sha256 only), and moving one of them to the path its content turned up at.
+    // The id, tags and thumbnail are kept.
+    QVector<MediaRecord> missingMediaForRoot(const QString& rootDir);
+    QFuture<qint64> relocateMedia(qint64 mediaId, const QString& filePath, const QString& rootDir,
+                                  qint64 modifiedTimeUtc);
+    
+    // Healthy images and videos under rootDir that have no thumbnail, in id
+    // order after afterId (path, root, sha256, type and thumbnail only)
+    QVector<MediaRecord> mediaWithoutThumbnails(const QString& rootDir, qint64 afterId, int limit);
+    
+    // Scan roots, and moving one to a new location. Paths are stored
+    // relative to their root, so relinking rewrites a single row.
+    QStringList rootFolders();
+    QFuture<bool> relinkRoot(const QString& oldPath, const QString& newPath);
     
     // Tag operations
-    QVector<qint64> upsertTags(const QStringList& tagNames);
-    void setMediaTags(qint64 mediaId, const QStringList& tagNames);
-    void addMediaTags(qint64 mediaId, const QStringList& tagNames);
-    void removeMediaTags(qint64 mediaId, const QStringList& tagNames);
-    int removeTagGlobally(const QString& tagName);
+    QFuture<QVector<qint64>> upsertTags(const QStringList& tagNames);
+    QFuture<void> setMediaTags(qint64 mediaId, const QStringList& tagNames);
+    QFuture<void> addMediaTags(qint64 mediaId, const QStringList& tagNames);
+    QFuture<void> removeMediaTags(qint64 mediaId, const QStringList& tagNames);
+    QFuture<int> removeTagGlobally(const QString& tagName);
     QStringList getMediaTags(qint64 mediaId);
     QStringList allTags();
     
     // Tag counts for sidebar
     QVector<QPair<QString, int>> tagCounts();
     int untaggedCount();
+    
+    // Per-tag counts within the current result set (same filter as queryMedia)
+    QHash<QString, int> facetCounts(
+        const QStringList& requiredTags,
+        const QString& searchText,
+        const QString& rootDir,
+        bool tagsMatchAll,
+        const QString& tagExpression
+    );
+    
+    // Optional in-memory bitmap index answering tag filters without SQL
+    void setTagIndexEnabled(bool enabled);
+    const TagIndex* tagIndex() const;
+    
+    // False when SQLite lacks FTS5 and search falls back to LIKE
+    bool hasFullTextSearch() const;
+    
+    // Resolves once every previously submitted write has committed
+    QFuture<void> flush();
+    
+    // Prepared-statement reuse across the writer and all reader connections
+    struct StatementStats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+    };
+    StatementStats statementStats() const;
 
 signals:
     void databaseChanged();
@@ -64,11 +141,52 @@ signals:
 
 private:
     void initializeSchema();
+    // FROM/WHERE for a filter, shared by queries and facet counts
+    struct SqlFilter {
+        QString fromSQL;
+        QStringList where;
+        QVariantList params;
+        QString rankSQL;
+    };
+    SqlFilter buildSqlFilter(const TagQuery& tagQuery, const QString& searchText, const QString& rootDir);
+    TagQueryPlanner::Plan planTagQuery(const TagQuery& query, bool exactTotal);
+    QString threadConnectionName() const;
     QSqlDatabase getConnection();
+    StatementCache& statements();
+    void releaseConnection(const QString& connectionName);
+    void onBatchCommitted(bool mediaChanged, bool tagsChanged, const IndexChangeset& changes);
+    std::shared_ptr<TagIndex> currentTagIndex() const;
     
     QString m_baseDir;
     QString m_dbPath;
     QString m_connectionName;
+    
+    std::unique_ptr<DatabaseWriter> m_writer;
+    // Applied on the writer thread before a batch's futures resolve, so the
+    // pointer is swapped and read under m_tagIndexMutex. While a new index
+    // is built, committed changesets queue in m_pendingIndexChanges.
+    std::shared_ptr<TagIndex> m_tagIndex;
+    bool m_tagIndexBuilding = false;
+    IndexChangeset m_pendingIndexChanges;
+    mutable QMutex m_tagIndexMutex;
+    std::unique_ptr<DirectoryCache> m_directories;   // dir_id -> path, shared by readers
+    bool m_fullTextSearch = false;
+    
+    // Ordered ids for the last filter run through SQL, so paging and the
+    // total never re-evaluate the predicate; stale once a write commits
+    struct ResultCache {
+        QString signature;
+        quint64 generation = 0;
+        QVector<qint64> ids;
+    };
+    mutable QMutex m_resultCacheMutex;
+    ResultCache m_resultCache;
+    
+    // Reader connections, one per thread that has queried us, each with its own statement cache
+    mutable QMutex m_connectionsMutex;
+    QHash<QString, std::shared_ptr<StatementCache>> m_readerConnections;
+    quint64 m_retiredStatementHits = 0;
+    quint64 m_retiredStatementMisses = 0;
 };
 
 } // namespace KeyTagger
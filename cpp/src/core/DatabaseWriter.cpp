@@ -0,0 +1,239 @@
+#include "DatabaseWriter.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QElapsedTimer>
+#include <QDeadlineTimer>
+#include <QUuid>
+#include <QDebug>
+
+namespace KeyTagger {
+
+DatabaseWriter::DatabaseWriter(const QString& dbPath, QObject* parent)
+    : QThread(parent)
+    , m_dbPath(dbPath)
+    , m_connectionName("writer_" + QUuid::createUuid().toString())
+{
+    setObjectName("DatabaseWriter");
+}
+
+DatabaseWriter::~DatabaseWriter() {
+    shutdown();
+}
+
+QFuture<void> DatabaseWriter::flush() {
+    // A barrier, not a write: it resolves whatever became of the batch
+    auto promise = std::make_shared<QPromise<void>>();
+    promise->start();
+    QFuture<void> future = promise->future();
+    enqueue({[](WriteContext&) {}, [promise](bool) { promise->finish(); }});
+    return future;
+}
+
+void DatabaseWriter::shutdown() {
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_queueNotEmpty.wakeAll();
+    }
+    wait();
+}
+
+void DatabaseWriter::setChangeTracking(bool enabled) {
+    m_trackChanges = enabled;
+}
+
+quint64 DatabaseWriter::statementHits() const {
+    return m_statementHits.load();
+}
+
+quint64 DatabaseWriter::statementMisses() const {
+    return m_statementMisses.load();
+}
+
+quint64 DatabaseWriter::generation() const {
+    return m_generation.load();
+}
+
+void DatabaseWriter::enqueue(Command command) {
+    QMutexLocker locker(&m_mutex);
+
+    if (m_stopping) {
+        // Writer is gone; resolve the future so callers never hang
+        locker.unlock();
+        qWarning() << "Database write submitted after shutdown, dropping";
+        command.complete(false);
+        return;
+    }
+
+    m_queue.append(std::move(command));
+    m_queueNotEmpty.wakeOne();
+}
+
+void DatabaseWriter::configureConnection(QSqlDatabase& db) {
+    QSqlQuery query(db);
+
+    query.exec("PRAGMA journal_mode=WAL");
+    query.exec("PRAGMA synchronous=NORMAL");
+
+    // Checkpoints are driven from run() rather than on commit
+    query.exec("PRAGMA wal_autocheckpoint=0");
+}
+
+void DatabaseWriter::checkpoint(QSqlDatabase& db, const char* mode) {
+    QSqlQuery query(db);
+    if (!query.exec(QString("PRAGMA wal_checkpoint(%1)").arg(mode))) {
+        qWarning() << "WAL checkpoint failed:" << query.lastError().text();
+    }
+}
+
+void DatabaseWriter::execute(WriteContext& ctx, Command& command) {
+    // Each command's writes stand or fall together: a failed statement
+    // rolls back only the command that ran it, and whatever it flagged or
+    // recorded for this batch
+    const bool mediaChanged = ctx.mediaChanged;
+    const bool tagsChanged = ctx.tagsChanged;
+    const bool vacuumRequested = ctx.vacuumRequested;
+    const qsizetype changes = ctx.changes.size();
+    const qsizetype hooks = ctx.afterCommit.size();
+
+    if (!ctx.statements.prepare("SAVEPOINT command")->exec()) {
+        qWarning() << "Could not open a savepoint for a write";
+        command.failed = true;
+        return;
+    }
+
+    ctx.commandFailed = false;
+    command.execute(ctx);
+    command.failed = ctx.commandFailed;
+
+    if (command.failed) {
+        qWarning() << "Write failed, rolling back its changes";
+        ctx.statements.prepare("ROLLBACK TO command")->exec();
+        ctx.mediaChanged = mediaChanged;
+        ctx.tagsChanged = tagsChanged;
+        ctx.vacuumRequested = vacuumRequested;
+        ctx.changes.resize(changes);
+        ctx.afterCommit.erase(ctx.afterCommit.begin() + hooks, ctx.afterCommit.end());
+    }
+    ctx.statements.prepare("RELEASE command")->exec();
+}
+
+void DatabaseWriter::run() {
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+        db.setDatabaseName(m_dbPath);
+
+        if (!db.open()) {
+            qWarning() << "Failed to open writer connection:" << db.lastError().text();
+        } else {
+            configureConnection(db);
+        }
+
+        WriteContext ctx(db);
+
+        QElapsedTimer sinceCheckpoint;
+        sinceCheckpoint.start();
+        bool dirty = false;
+
+        forever {
+            QList<Command> batch;
+
+            {
+                QMutexLocker locker(&m_mutex);
+
+                // Sleep until work arrives, waking periodically for checkpoints
+                while (m_queue.isEmpty() && !m_stopping) {
+                    if (!m_queueNotEmpty.wait(&m_mutex, CheckpointIntervalMs) && dirty) {
+                        break;
+                    }
+                }
+
+                if (m_queue.isEmpty() && m_stopping) {
+                    break;
+                }
+
+                // Give concurrent callers a short window to join this batch
+                if (!m_queue.isEmpty() && !m_stopping) {
+                    QDeadlineTimer window(GroupCommitWindowMs, Qt::PreciseTimer);
+                    while (m_queue.size() < MaxBatchSize && !m_stopping) {
+                        if (!m_queueNotEmpty.wait(&m_mutex, window)) {
+                            break;
+                        }
+                    }
+                }
+
+                batch.swap(m_queue);
+            }
+
+            if (!batch.isEmpty()) {
+                ctx.mediaChanged = false;
+                ctx.tagsChanged = false;
+                ctx.trackChanges = m_trackChanges;
+                ctx.changes.clear();
+                ctx.vacuumRequested = false;
+                ctx.afterCommit.clear();
+
+                bool inTransaction = db.transaction();
+                for (Command& command : batch) {
+                    execute(ctx, command);
+                }
+
+                bool committed = true;
+                if (inTransaction && !db.commit()) {
+                    qWarning() << "Group commit failed:" << db.lastError().text();
+                    db.rollback();
+                    committed = false;
+                }
+
+                // A rolled-back batch changed nothing: no generation bump,
+                // no hooks and nothing to mirror into the index
+                if (committed) {
+                    if (ctx.mediaChanged || ctx.tagsChanged) {
+                        ++m_generation;
+                    }
+                    for (const auto& hook : std::as_const(ctx.afterCommit)) {
+                        hook();
+                    }
+                    if (ctx.mediaChanged || ctx.tagsChanged || !ctx.changes.isEmpty()) {
+                        emit batchCommitted(ctx.mediaChanged, ctx.tagsChanged, ctx.changes);
+                    }
+                }
+
+                // VACUUM cannot run inside a transaction or with live statements
+                if (committed && ctx.vacuumRequested) {
+                    ctx.statements.clear();
+                    QSqlQuery vacuum(db);
+                    if (!vacuum.exec("VACUUM")) {
+                        qWarning() << "VACUUM failed:" << vacuum.lastError().text();
+                    }
+                }
+
+                // Resolve futures only once the batch is durable
+                for (Command& command : batch) {
+                    command.complete(committed && !command.failed);
+                }
+
+                dirty = true;
+                m_statementHits = ctx.statements.hits();
+                m_statementMisses = ctx.statements.misses();
+            }
+
+            if (dirty && sinceCheckpoint.elapsed() >= CheckpointIntervalMs) {
+                checkpoint(db, "PASSIVE");
+                sinceCheckpoint.restart();
+                dirty = false;
+            }
+        }
+
+        // Finalize cached statements before the connection goes away
+        ctx.statements.clear();
+
+        if (db.isOpen()) {
+            checkpoint(db, "TRUNCATE");
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <QThread>
+#include <QString>
+#include <QSqlDatabase>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QFuture>
+#include <QPromise>
+#include <QList>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <atomic>
+#include "StatementCache.h"
+#include "TagIndex.h"
+#include "WriteResult.h"
+
+namespace KeyTagger {
+
+/**
+ * WriteContext - State handed to every write command
+ *
+ * Commands run inside the writer's open transaction, each under its own
+ * savepoint, and flag what they touched so the writer can emit one
+ * change notification per commit. When change tracking is on they also
+ * record row-level changes for the in-memory TagIndex.
+ */
+struct WriteContext {
+    explicit WriteContext(const QSqlDatabase& database)
+        : db(database), statements(database) {}
+
+    void record(IndexChange change) {
+        if (trackChanges) changes.append(std::move(change));
+    }
+
+    // Called by a command when one of its statements failed: everything
+    // it wrote is rolled back and its future reports WriteFailed
+    void fail() { commandFailed = true; }
+
+    QSqlDatabase db;
+    StatementCache statements;
+    bool mediaChanged = false;
+    bool tagsChanged = false;
+    bool trackChanges = false;
+    IndexChangeset changes;
+    bool vacuumRequested = false;   // VACUUM once this batch has committed
+    // Run once this batch has committed, before its futures resolve;
+    // skipped if the commit fails
+    QList<std::function<void()>> afterCommit;
+    bool commandFailed = false;     // Set by fail() for the running command
+};
+
+/**
+ * DatabaseWriter - Single-writer actor for all database mutations
+ *
+ * Key features:
+ * - One dedicated thread owns the only writing connection
+ * - Commands are queued and group-committed every few milliseconds
+ * - Callers get a QFuture that resolves once their batch is durable
+ * - WAL checkpoints run on the writer's own schedule instead of
+ *   stalling whichever statement happens to cross the autocheckpoint limit
+ */
+class DatabaseWriter : public QThread {
+    Q_OBJECT
+
+public:
+    explicit DatabaseWriter(const QString& dbPath, QObject* parent = nullptr);
+    ~DatabaseWriter();
+
+    // Queue a command; the future resolves after the batch commits, or
+    // carries WriteFailed if the command or the commit failed
+    template <typename Fn>
+    auto submit(Fn&& fn) -> QFuture<std::invoke_result_t<Fn, WriteContext&>>;
+
+    // Resolves once everything queued before it has been committed or
+    // rolled back; never fails
+    QFuture<void> flush();
+
+    // Drain the queue, checkpoint and stop the thread
+    void shutdown();
+
+    // Record IndexChanges for every following batch
+    void setChangeTracking(bool enabled);
+
+    // Prepared-statement reuse on the writer connection
+    quint64 statementHits() const;
+    quint64 statementMisses() const;
+
+    // Bumped after each commit that changed media or tags, before the
+    // batch's futures resolve, so readers can tell cached results are stale
+    quint64 generation() const;
+
+signals:
+    // Emitted on the writer thread after a successful commit, before the
+    // batch's futures resolve. Receivers that must observe the batch
+    // before any caller continuation runs connect with Qt::DirectConnection.
+    void batchCommitted(bool mediaChanged, bool tagsChanged, const KeyTagger::IndexChangeset& changes);
+
+protected:
+    void run() override;
+
+private:
+    struct Command {
+        std::function<void(WriteContext&)> execute;
+        std::function<void(bool succeeded)> complete;
+        bool failed = false;
+    };
+
+    void enqueue(Command command);
+    // Runs command under its own savepoint, undoing it if it fails
+    void execute(WriteContext& ctx, Command& command);
+    void configureConnection(QSqlDatabase& db);
+    void checkpoint(QSqlDatabase& db, const char* mode);
+
+    QString m_dbPath;
+    QString m_connectionName;
+
+    QMutex m_mutex;
+    QWaitCondition m_queueNotEmpty;
+    QList<Command> m_queue;
+    bool m_stopping = false;
+
+    std::atomic<bool> m_trackChanges{false};
+    std::atomic<quint64> m_statementHits{0};
+    std::atomic<quint64> m_statementMisses{0};
+    std::atomic<quint64> m_generation{1};
+
+    // Group commit tuning
+    static constexpr int GroupCommitWindowMs = 4;
+    static constexpr int MaxBatchSize = 1024;
+    static constexpr int CheckpointIntervalMs = 2000;
+};
+
+template <typename Fn>
+auto DatabaseWriter::submit(Fn&& fn) -> QFuture<std::invoke_result_t<Fn, WriteContext&>> {
+    using Result = std::invoke_result_t<Fn, WriteContext&>;
+
+    auto promise = std::make_shared<QPromise<Result>>();
+    promise->start();
+    QFuture<Result> future = promise->future();
+
+    if constexpr (std::is_void_v<Result>) {
+        enqueue({
+            [fn = std::forward<Fn>(fn)](WriteContext& ctx) mutable { fn(ctx); },
+            [promise](bool succeeded) {
+                if (!succeeded) promise->setException(WriteFailed());
+                promise->finish();
+            }
+        });
+    } else {
+        auto result = std::make_shared<Result>();
+        enqueue({
+            [fn = std::forward<Fn>(fn), result](WriteContext& ctx) mutable { *result = fn(ctx); },
+            [promise, result](bool succeeded) {
+                // Values computed inside a rolled-back write never happened
+                if (succeeded) {
+                    promise->addResult(*result);
+                } else {
+                    promise->setException(WriteFailed());
+                }
+                promise->finish();
+            }
+        });
+    }
+
+    return future;
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,230 @@
+#include "DecodeScheduler.h"
+#include "ImageMetadata.h"
+#include <QBuffer>
+#include <QDeadlineTimer>
+#include <QFile>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QTransform>
+
+namespace KeyTagger {
+
+namespace {
+
+// Embedded thumbnails larger than this are not worth reading whole
+constexpr qint64 MaxEmbeddedThumbnailBytes = 4 << 20;
+
+// QImageReader's allocation limit (256 MB by default) is process-wide and
+// also guards decodes outside the scheduler, such as the viewer's. It is
+// lifted only while an admitted decode needs more, and restored once the
+// last such decode ends.
+class AllocationLimitLift {
+public:
+    explicit AllocationLimitLift(qint64 bytes) {
+        QMutexLocker locker(&s_mutex);
+        const qint64 limit = qint64(s_lifted > 0 ? s_savedLimit : QImageReader::allocationLimit()) << 20;
+        if (limit == 0 || bytes <= limit) return;
+        if (s_lifted++ == 0) {
+            s_savedLimit = QImageReader::allocationLimit();
+            QImageReader::setAllocationLimit(0);
+        }
+        m_active = true;
+    }
+
+    ~AllocationLimitLift() {
+        if (!m_active) return;
+        QMutexLocker locker(&s_mutex);
+        if (--s_lifted == 0) QImageReader::setAllocationLimit(s_savedLimit);
+    }
+
+    AllocationLimitLift(const AllocationLimitLift&) = delete;
+    AllocationLimitLift& operator=(const AllocationLimitLift&) = delete;
+
+private:
+    static inline QMutex s_mutex;
+    static inline int s_lifted = 0;
+    static inline int s_savedLimit = 0;
+    bool m_active = false;
+};
+
+// True if reduced has frame's aspect ratio, within a percent, and is at
+// least target in both directions
+bool covers(const QSize& reduced, const QSize& frame, const QSize& target) {
+    if (reduced.width() < target.width() || reduced.height() < target.height()) return false;
+    const qint64 skew = qAbs(qint64(reduced.width()) * frame.height() - qint64(frame.width()) * reduced.height());
+    return skew * 100 <= qint64(frame.width()) * reduced.height();
+}
+
+// EXIF orientation applied to an image read without it
+QImage oriented(const QImage& image, int orientation) {
+    const QTransform quarter = QTransform().rotate(90);
+    switch (orientation) {
+        case 2: return image.mirrored(true, false);
+        case 3: return image.mirrored(true, true);
+        case 4: return image.mirrored(false, true);
+        case 5: return image.mirrored(false, true).transformed(quarter);
+        case 6: return image.transformed(quarter);
+        case 7: return image.mirrored(true, false).transformed(quarter);
+        case 8: return image.transformed(QTransform().rotate(270));
+        default: return image;
+    }
+}
+
+} // namespace
+
+DecodeScheduler& DecodeScheduler::instance() {
+    static DecodeScheduler scheduler;
+    return scheduler;
+}
+
+DecodeScheduler::DecodeScheduler() = default;
+
+qint64 DecodeScheduler::budget() const {
+    QMutexLocker locker(&m_mutex);
+    return m_budget;
+}
+
+void DecodeScheduler::setBudget(qint64 bytes) {
+    {
+        QMutexLocker locker(&m_mutex);
+        m_budget = qMax<qint64>(bytes, 64 << 20);
+    }
+    m_released.wakeAll();
+}
+
+qint64 DecodeScheduler::inUse() const {
+    QMutexLocker locker(&m_mutex);
+    return m_inUse;
+}
+
+DecodeScheduler::Permit DecodeScheduler::acquire(qint64 bytes, const CancellationToken* token) {
+    bytes = qMax<qint64>(bytes, 0);
+    QMutexLocker locker(&m_mutex);
+    while (m_inUse > 0 && m_inUse + bytes > m_budget) {
+        if (token && token->isCancelled()) return Permit();
+        // Wake now and then to notice cancellation
+        m_released.wait(&m_mutex, token ? QDeadlineTimer(20) : QDeadlineTimer(QDeadlineTimer::Forever));
+    }
+    m_inUse += bytes;
+    return Permit(this, bytes);
+}
+
+void DecodeScheduler::release(qint64 bytes) {
+    {
+        QMutexLocker locker(&m_mutex);
+        m_inUse -= bytes;
+    }
+    m_released.wakeAll();
+}
+
+QImage DecodeScheduler::decodeImage(const QString& path, int maxEdge, const CancellationToken* token) {
+    std::optional<ImageMetadata> metadata = ImageMetadata::read(path);
+    QImageReader reader(path);
+    reader.setAutoTransform(true);
+
+    QSize size = metadata ? QSize(metadata->width, metadata->height) : reader.size();
+    QSize target = size;
+    if (maxEdge > 0 && size.isValid() && (size.width() > maxEdge || size.height() > maxEdge)) {
+        target = size.scaled(maxEdge, maxEdge, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+    }
+
+    // The JPEG codec decodes at the nearest power-of-two scale above the
+    // target, at most twice its edge. Other formats decode the full frame,
+    // so oversized ones try a smaller stored copy first.
+    const bool reducesInCodec = metadata && metadata->format == MediaTypes::Format::Jpeg;
+    if (!reducesInCodec && target != size && imageCost(size) > ReducedDecodeCost) {
+        std::optional<QImage> reduced = decodeReduced(reader, metadata, size, target, token);
+        if (reduced) return *reduced;
+    }
+
+    qint64 cost = imageCost(size);
+    if (target != size) {
+        reader.setScaledSize(target);
+        cost = reducesInCodec ? qMin(imageCost(target) * 4, cost) : cost + imageCost(target);
+    }
+    if (!size.isValid()) {
+        // Nothing could read the header; charge the whole budget so the
+        // decode runs alone
+        cost = budget();
+    }
+
+    Permit permit = acquire(cost, token);
+    if (!permit.isValid()) return QImage();
+    AllocationLimitLift lift(cost);
+    return reader.read();
+}
+
+std::optional<QImage> DecodeScheduler::decodeReduced(QImageReader& reader, const std::optional<ImageMetadata>& metadata,
+                                                     const QSize& size, const QSize& target,
+                                                     const CancellationToken* token) {
+    // Multi-resolution files such as pyramidal TIFFs store reduced pages
+    // after the full one; take the smallest still covering the target
+    int bestPage = -1;
+    QSize bestSize = size;
+    for (int page = 1; page < reader.imageCount() && reader.jumpToImage(page); ++page) {
+        const QSize pageSize = reader.size();
+        if (covers(pageSize, size, target) && imageCost(pageSize) < imageCost(bestSize)) {
+            bestPage = page;
+            bestSize = pageSize;
+        }
+    }
+    if (bestPage > 0 && reader.jumpToImage(bestPage)) {
+        reader.setScaledSize(target);
+        Permit permit = acquire(imageCost(bestSize) + imageCost(target), token);
+        if (!permit.isValid()) return QImage();
+        QImage image = reader.read();
+        if (!image.isNull()) return image;
+    }
+    reader.jumpToImage(0);
+
+    // The EXIF thumbnail is stored without the orientation applied
+    if (!metadata || !metadata->hasThumbnail() || metadata->thumbnailSize > MaxEmbeddedThumbnailBytes) {
+        return std::nullopt;
+    }
+    QFile file(reader.fileName());
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(metadata->thumbnailOffset)) return std::nullopt;
+    QByteArray bytes = file.read(metadata->thumbnailSize);
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader thumbnail(&buffer, "jpeg");
+    const QSize thumbnailSize = thumbnail.size();
+    if (!covers(thumbnailSize, size, target)) return std::nullopt;
+
+    thumbnail.setScaledSize(target);
+    Permit permit = acquire(imageCost(thumbnailSize) + imageCost(target), token);
+    if (!permit.isValid()) return QImage();
+    QImage image = thumbnail.read();
+    if (image.isNull()) return std::nullopt;
+    return oriented(image, metadata->orientation);
+}
+
+DecodeScheduler::Permit::Permit(Permit&& other) noexcept
+    : m_scheduler(other.m_scheduler), m_bytes(other.m_bytes) {
+    other.m_scheduler = nullptr;
+    other.m_bytes = 0;
+}
+
+DecodeScheduler::Permit& DecodeScheduler::Permit::operator=(Permit&& other) noexcept {
+    if (this != &other) {
+        release();
+        m_scheduler = other.m_scheduler;
+        m_bytes = other.m_bytes;
+        other.m_scheduler = nullptr;
+        other.m_bytes = 0;
+    }
+    return *this;
+}
+
+DecodeScheduler::Permit::~Permit() {
+    release();
+}
+
+void DecodeScheduler::Permit::release() {
+    if (m_scheduler) {
+        m_scheduler->release(m_bytes);
+        m_scheduler = nullptr;
+        m_bytes = 0;
+    }
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QImage>
+#include <QImageReader>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <QWaitCondition>
+#include <optional>
+#include "CancellationToken.h"
+#include "ImageMetadata.h"
+
+namespace KeyTagger {
+
+/**
+ * DecodeScheduler - Memory admission for image decodes
+ *
+ * Every worker-side decode asks for a permit sized by the pixel memory it
+ * is about to allocate, estimated from the header dimensions. Permits are
+ * granted while their sum stays within a process-wide budget; further
+ * decodes wait for one to be released. A job larger than the whole budget
+ * is admitted only once nothing else is decoding, so peak decode memory
+ * is bounded by max(budget, largest single image) instead of growing with
+ * the number of threads.
+ *
+ * decodeImage() also shrinks the job itself when the caller only needs
+ * a bounded size. JPEGs are decoded at reduced scale by the codec. Other
+ * formats above ReducedDecodeCost first look for a smaller stored copy
+ * covering the target: a reduced page of a pyramidal TIFF, or the EXIF
+ * thumbnail. Only when neither exists do they pay for the full frame.
+ * Qt's per-image allocation limit stays in force for everything else.
+ */
+class DecodeScheduler {
+public:
+    static constexpr qint64 DefaultBudget = qint64(1) << 30;
+    // Frames above this (24 MP at 32 bits) try the reduced decode paths
+    static constexpr qint64 ReducedDecodeCost = qint64(96) * 1000 * 1000;
+
+    static DecodeScheduler& instance();
+
+    qint64 budget() const;
+    void setBudget(qint64 bytes);
+    qint64 inUse() const;
+
+    // Admission for bytes of decode memory, held until destroyed
+    class Permit {
+    public:
+        Permit() = default;
+        Permit(Permit&& other) noexcept;
+        Permit& operator=(Permit&& other) noexcept;
+        ~Permit();
+
+        // False if the wait for admission was cancelled
+        bool isValid() const { return m_scheduler != nullptr; }
+
+    private:
+        friend class DecodeScheduler;
+        Permit(DecodeScheduler* scheduler, qint64 bytes) : m_scheduler(scheduler), m_bytes(bytes) {}
+        void release();
+
+        DecodeScheduler* m_scheduler = nullptr;
+        qint64 m_bytes = 0;
+    };
+
+    // Blocks until bytes fit in the budget, or returns an invalid permit
+    // once token is cancelled
+    Permit acquire(qint64 bytes, const CancellationToken* token = nullptr);
+
+    // Decode path scaled to fit maxEdge x maxEdge (0 for full size),
+    // under a permit. Returns a null image if the file cannot be decoded
+    // or token was cancelled before the decode was admitted.
+    QImage decodeImage(const QString& path, int maxEdge = 0, const CancellationToken* token = nullptr);
+
+    // Bytes of a decoded 32-bit frame of size
+    static qint64 imageCost(const QSize& size) { return qint64(size.width()) * size.height() * 4; }
+
+private:
+    DecodeScheduler();
+    void release(qint64 bytes);
+    // A reduced page or the embedded thumbnail scaled to target, a null
+    // image if cancelled, or nullopt if the file has neither
+    std::optional<QImage> decodeReduced(QImageReader& reader, const std::optional<ImageMetadata>& metadata,
+                                        const QSize& size, const QSize& target, const CancellationToken* token);
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_released;
+    qint64 m_budget = DefaultBudget;
+    qint64 m_inUse = 0;
+};
+
+} // namespace KeyTagger
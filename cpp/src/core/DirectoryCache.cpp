@@ -0,0 +1,82 @@
+#include "DirectoryCache.h"
+#include "StatementCache.h"
+#include <QDir>
+#include <QFileInfo>
+
+namespace KeyTagger {
+
+std::optional<DirectoryCache::Entry> DirectoryCache::lookup(qint64 dirId, StatementCache& statements) {
+    quint64 generation = 0;
+    {
+        QReadLocker locker(&m_lock);
+        auto it = m_entries.constFind(dirId);
+        if (it != m_entries.constEnd()) {
+            return *it;
+        }
+        generation = m_generation;
+    }
+
+    auto query = statements.prepare(R"(
+        SELECT d.root_id, r.path, d.path
+        FROM directories d JOIN roots r ON r.id = d.root_id
+        WHERE d.id = ?
+    )");
+    query->addBindValue(dirId);
+    if (!query->exec() || !query->next()) {
+        return std::nullopt;
+    }
+
+    Entry entry;
+    entry.rootId = query->value(0).toLongLong();
+    entry.rootPath = query->value(1).toString();
+    entry.relativePath = query->value(2).toString();
+    query->finish();
+
+    // A clear() during the query may have made this row stale; return it
+    // to this caller but leave the cache to the next lookup
+    QWriteLocker locker(&m_lock);
+    if (m_generation == generation) {
+        m_entries.insert(dirId, entry);
+    }
+    return entry;
+}
+
+void DirectoryCache::clear() {
+    QWriteLocker locker(&m_lock);
+    m_entries.clear();
+    ++m_generation;
+}
+
+QString DirectoryCache::joinPath(const QString& rootPath, const QString& directory, const QString& fileName) {
+    QString path = rootPath;
+    auto append = [&path](const QString& part) {
+        if (part.isEmpty()) return;
+        if (!path.endsWith('/')) path += '/';
+        path += part;
+    };
+    append(directory);
+    append(fileName);
+    return path;
+}
+
+DirectoryCache::Location DirectoryCache::splitPath(const QString& filePath, const QString& rootDir) {
+    QFileInfo info(filePath);
+    QString folder = QDir::cleanPath(info.absolutePath());
+    QString root = QDir::cleanPath(QDir(rootDir).absolutePath());
+
+    Location location;
+    location.fileName = info.fileName();
+
+    QString relative = QDir(root).relativeFilePath(folder);
+    if (relative == ".") {
+        location.rootPath = root;
+    } else if (relative == ".." || relative.startsWith("../") || QDir::isAbsolutePath(relative)) {
+        location.rootPath = folder;
+    } else {
+        location.rootPath = root;
+        location.directory = relative;
+    }
+    return location;
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <QReadWriteLock>
+#include <optional>
+
+namespace KeyTagger {
+
+class StatementCache;
+
+/**
+ * DirectoryCache - Resolves media directory ids to paths
+ *
+ * media rows store (dir_id, file_name); a directory row holds its root
+ * and its path below that root. Full paths are rebuilt on demand here,
+ * loading each directory the first time a reader needs it. Entries are
+ * shared by all reader threads. Directory rows never change their path,
+ * so only relinking a root invalidates the cache.
+ */
+class DirectoryCache {
+public:
+    struct Entry {
+        qint64 rootId = 0;
+        QString rootPath;       // Absolute
+        QString relativePath;   // Below the root, '/'-separated, empty for the root itself
+    };
+
+    // A file path split the way it is stored
+    struct Location {
+        QString rootPath;
+        QString directory;      // Relative to rootPath
+        QString fileName;
+    };
+
+    // Entry for dirId, read through statements on a miss
+    std::optional<Entry> lookup(qint64 dirId, StatementCache& statements);
+    void clear();
+
+    // Absolute directory or file path from stored parts
+    static QString joinPath(const QString& rootPath, const QString& directory,
+                            const QString& fileName = QString());
+
+    // Split filePath below rootDir. Files outside rootDir get their own
+    // folder as root so they can still be stored.
+    static Location splitPath(const QString& filePath, const QString& rootDir);
+
+private:
+    mutable QReadWriteLock m_lock;
+    QHash<qint64, Entry> m_entries;
+    quint64 m_generation = 0;   // Bumped by clear(), so lookups racing it do not insert
+};
+
+} // namespace KeyTagger
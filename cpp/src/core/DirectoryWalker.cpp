@@ -0,0 +1,276 @@
+#include "DirectoryWalker.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+namespace KeyTagger {
+
+namespace {
+
+#ifdef Q_OS_LINUX
+// Record layout returned by getdents64
+struct LinuxDirent64 {
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+// Size, time and identity of name inside an open folder; symlinks are followed
+bool statEntry(int dirFd, const char* name, struct statx& info) {
+    return ::statx(dirFd, name, AT_STATX_DONT_SYNC,
+                   STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO, &info) == 0;
+}
+#endif
+
+} // namespace
+
+DirectoryWalker::DirectoryWalker(Filter filter, int threadCount)
+    : m_filter(std::move(filter))
+    , m_threadCount(threadCount > 0 ? threadCount : qBound(4, QThread::idealThreadCount() * 2, 16))
+{
+}
+
+QVector<DirectoryWalker::Entry> DirectoryWalker::walk(const QString& rootDir, const IgnoreRules& rules,
+                                                      const std::atomic<bool>* cancelled) {
+    QVector<Entry> entries;
+    walk(rootDir, rules, [&entries](QVector<Entry>&& batch) {
+        entries += batch;
+    }, cancelled);
+    return entries;
+}
+
+void DirectoryWalker::walk(const QString& rootDir, const IgnoreRules& rules, const Sink& sink,
+                           const std::atomic<bool>* cancelled) {
+    struct Queue {
+        QMutex mutex;
+        std::deque<Task> tasks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    for (int i = 0; i < m_threadCount; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+
+    // Folders queued or being read; children are counted before their
+    // parent is finished, so zero means the walk is complete
+    std::atomic<int> outstanding{1};
+    QMutex sinkMutex;
+
+    // Folders sitting in the queues, changed under the queue's lock. Idle
+    // threads sleep on idle until one is queued or the walk ends.
+    std::atomic<int> queued{1};
+    QMutex idleMutex;
+    QWaitCondition idle;
+
+    auto wakeIdle = [&](bool all) {
+        QMutexLocker locker(&idleMutex);
+        if (all) {
+            idle.wakeAll();
+        } else {
+            idle.wakeOne();
+        }
+    };
+
+    const QString root = QDir::cleanPath(QDir(rootDir).absolutePath());
+    queues[0]->tasks.push_back({root, rules.enter(root)});
+
+    auto takeTask = [&](int self) -> std::optional<Task> {
+        {
+            Queue& own = *queues[self];
+            QMutexLocker locker(&own.mutex);
+            if (!own.tasks.empty()) {
+                Task task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                --queued;
+                return task;
+            }
+        }
+        for (int offset = 1; offset < m_threadCount; ++offset) {
+            Queue& victim = *queues[(self + offset) % m_threadCount];
+            QMutexLocker locker(&victim.mutex);
+            if (!victim.tasks.empty()) {
+                Task task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                --queued;
+                return task;
+            }
+        }
+        return std::nullopt;
+    };
+
+    auto work = [&](int self) {
+        QVector<Entry> files;
+        QVector<Task> subdirs;
+        while (outstanding.load() > 0) {
+            if (cancelled && cancelled->load()) {
+                // A sleeping thread only wakes when a worker signals it
+                wakeIdle(true);
+                return;
+            }
+
+            std::optional<Task> task = takeTask(self);
+            if (!task) {
+                // Checked under the lock, so a push or the last folder
+                // finishing cannot signal in between and be missed
+                QMutexLocker locker(&idleMutex);
+                if (queued.load() == 0 && outstanding.load() > 0 && !(cancelled && cancelled->load())) {
+                    idle.wait(&idleMutex);
+                }
+                continue;
+            }
+
+            files.clear();
+            subdirs.clear();
+            readDirectory(*task, files, subdirs);
+
+            if (!subdirs.isEmpty()) {
+                outstanding += int(subdirs.size());
+                {
+                    Queue& own = *queues[self];
+                    QMutexLocker locker(&own.mutex);
+                    for (Task& subdir : subdirs) {
+                        own.tasks.push_back(std::move(subdir));
+                    }
+                    queued += int(subdirs.size());
+                }
+                // This thread takes one folder itself; the rest are for others
+                if (subdirs.size() > 1) wakeIdle(subdirs.size() > 2);
+            }
+            if (!files.isEmpty()) {
+                QMutexLocker locker(&sinkMutex);
+                sink(std::move(files));
+                files = QVector<Entry>();
+            }
+            if (--outstanding == 0) wakeIdle(true);
+        }
+    };
+
+    std::vector<std::unique_ptr<QThread>> threads;
+    for (int i = 1; i < m_threadCount; ++i) {
+        threads.emplace_back(QThread::create(work, i));
+        threads.back()->start();
+    }
+    work(0);
+    for (auto& thread : threads) {
+        thread->wait();
+    }
+}
+
+void DirectoryWalker::readDirectory(const Task& task, QVector<Entry>& files, QVector<Task>& subdirs) const {
+    const QString prefix = task.dir.endsWith('/') ? task.dir : task.dir + '/';
+
+#ifdef Q_OS_LINUX
+    int dirFd = ::open(QFile::encodeName(task.dir).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) return;
+
+    // Names whose type or metadata needs a statx, done after the listing
+    QVector<QByteArray> wanted;
+    QVector<QByteArray> unknown;
+
+    alignas(8) char buffer[64 * 1024];
+    for (;;) {
+        long bytes = ::syscall(SYS_getdents64, dirFd, buffer, sizeof(buffer));
+        if (bytes <= 0) break;
+
+        for (long offset = 0; offset < bytes;) {
+            const auto* entry = reinterpret_cast<const LinuxDirent64*>(buffer + offset);
+            offset += entry->d_reclen;
+
+            const char* rawName = entry->d_name;
+            if (qstrcmp(rawName, ".") == 0 || qstrcmp(rawName, "..") == 0) continue;
+
+            const QString name = QFile::decodeName(rawName);
+            if (IgnoreRules::isBuiltInIgnored(name)) continue;
+
+            if (entry->d_type == DT_DIR) {
+                const QString path = prefix + name;
+                if (!task.rules.isIgnored(path, name, true)) {
+                    subdirs.append({path, task.rules.enter(path)});
+                }
+            } else if (entry->d_type == DT_REG) {
+                if (m_filter(name)) wanted.append(rawName);
+            } else if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                unknown.append(rawName);
+            }
+        }
+    }
+
+    // Filesystems without d_type, and symlinks: file targets count as
+    // files, folder targets are not followed
+    for (const QByteArray& rawName : std::as_const(unknown)) {
+        struct statx info;
+        struct stat link;
+        if (!statEntry(dirFd, rawName.constData(), info)) continue;
+        const QString name = QFile::decodeName(rawName);
+        if (S_ISREG(info.stx_mode)) {
+            if (m_filter(name)) wanted.append(rawName);
+        } else if (S_ISDIR(info.stx_mode) &&
+                   ::fstatat(dirFd, rawName.constData(), &link, AT_SYMLINK_NOFOLLOW) == 0 &&
+                   S_ISDIR(link.st_mode)) {
+            const QString path = prefix + name;
+            if (!task.rules.isIgnored(path, name, true)) {
+                subdirs.append({path, task.rules.enter(path)});
+            }
+        }
+    }
+
+    for (const QByteArray& rawName : std::as_const(wanted)) {
+        const QString name = QFile::decodeName(rawName);
+        const QString path = prefix + name;
+        if (task.rules.isIgnored(path, name, false)) continue;
+
+        struct statx info;
+        if (!statEntry(dirFd, rawName.constData(), info)) continue;
+
+        Entry entry;
+        entry.path = path;
+        entry.size = qint64(info.stx_size);
+        entry.modifiedTime = qint64(info.stx_mtime.tv_sec);
+        entry.device = quint64(makedev(info.stx_dev_major, info.stx_dev_minor));
+        entry.inode = quint64(info.stx_ino);
+        files.append(entry);
+    }
+
+    ::close(dirFd);
+#else
+    QDirIterator it(task.dir, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+    while (it.hasNext()) {
+        const QString path = it.next();
+        const QFileInfo info = it.fileInfo();
+        const QString name = info.fileName();
+
+        if (info.isDir()) {
+            if (!info.isSymLink() && !task.rules.isIgnored(path, name, true)) {
+                subdirs.append({path, task.rules.enter(path)});
+            }
+            continue;
+        }
+        if (!m_filter(name) || task.rules.isIgnored(path, name, false)) continue;
+
+        Entry entry;
+        entry.path = path;
+        entry.size = info.size();
+        entry.modifiedTime = info.lastModified().toSecsSinceEpoch();
+        files.append(entry);
+    }
+#endif
+}
+
+} // namespace KeyTagger
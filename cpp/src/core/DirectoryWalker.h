@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+#include <functional>
+#include <atomic>
+#include "IgnoreRules.h"
+
+namespace KeyTagger {
+
+/**
+ * DirectoryWalker - Parallel enumeration of a folder tree
+ *
+ * Folders are spread over a pool of threads, each with its own deque.
+ * A thread works depth-first from the back of its deque and, when idle,
+ * steals the oldest folder from another thread, so wide and deep trees
+ * both keep every thread busy while each one waits on readdir latency.
+ *
+ * On Linux folders are read with getdents64, using d_type to tell files
+ * from folders without a stat. Only files that pass the filter are
+ * statx'ed, batched per folder relative to its open descriptor. Other
+ * platforms use QDirIterator, whose find data already carries size and
+ * time. IgnoreRules are checked before a folder is queued, so excluded
+ * subtrees are never opened.
+ */
+class DirectoryWalker {
+public:
+    struct Entry {
+        QString path;
+        qint64 size = 0;
+        qint64 modifiedTime = 0;    // Seconds since the epoch
+        quint64 device = 0;         // Both 0 where inodes are not available
+        quint64 inode = 0;
+    };
+
+    // Decides from the file name alone whether a file is wanted; called
+    // from several threads at once
+    using Filter = std::function<bool(const QString& fileName)>;
+    // Receives one folder's wanted files; calls are serialized
+    using Sink = std::function<void(QVector<Entry>&& batch)>;
+
+    explicit DirectoryWalker(Filter filter, int threadCount = 0);
+
+    // Blocks until the tree is walked or *cancelled becomes true
+    void walk(const QString& rootDir, const IgnoreRules& rules, const Sink& sink,
+              const std::atomic<bool>* cancelled = nullptr);
+    QVector<Entry> walk(const QString& rootDir, const IgnoreRules& rules,
+                        const std::atomic<bool>* cancelled = nullptr);
+
+private:
+    struct Task {
+        QString dir;
+        IgnoreRules rules;
+    };
+
+    // Reads one folder: wanted files go to files, subfolders to subdirs
+    void readDirectory(const Task& task, QVector<Entry>& files, QVector<Task>& subdirs) const;
+
+    Filter m_filter;
+    int m_threadCount;
+};
+
+} // namespace KeyTagger
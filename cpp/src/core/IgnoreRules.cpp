@@ -0,0 +1,110 @@
+#include "IgnoreRules.h"
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+
+namespace KeyTagger {
+
+namespace {
+
+// Folders that never hold a user's media (compared lowercase)
+const QSet<QString> SystemFolders = {
+    "$recycle.bin", "system volume information", "lost+found", "@eadir", "#recycle", "__macosx"
+};
+
+// One alternation for all globs, or an empty expression if there are none
+QRegularExpression compile(const QStringList& globs, const QString& source) {
+    if (globs.isEmpty()) return QRegularExpression();
+
+    QStringList parts;
+    for (const QString& glob : globs) {
+        parts << "(?:" + QRegularExpression::wildcardToRegularExpression(glob) + ")";
+    }
+    QRegularExpression expression(parts.join('|'), QRegularExpression::CaseInsensitiveOption);
+    if (!expression.isValid()) {
+        qWarning() << "Ignoring invalid patterns in" << source << ":" << expression.errorString();
+        return QRegularExpression();
+    }
+    expression.optimize();
+    return expression;
+}
+
+bool matches(const QRegularExpression& expression, const QString& text) {
+    return !expression.pattern().isEmpty() && expression.match(text).hasMatch();
+}
+
+} // namespace
+
+IgnoreRules::IgnoreRules(const QStringList& excludedPaths) {
+    auto paths = std::make_shared<QSet<QString>>();
+    for (const QString& path : excludedPaths) {
+        paths->insert(QDir::cleanPath(QDir(path).absolutePath()));
+    }
+    m_excludedPaths = paths;
+}
+
+IgnoreRules IgnoreRules::enter(const QString& dir) const {
+    IgnoreRules rules = *this;
+    if (auto set = load(dir)) {
+        rules.m_sets.append(set);
+    }
+    return rules;
+}
+
+bool IgnoreRules::isIgnored(const QString& path, const QString& name, bool isDir) const {
+    if (isBuiltInIgnored(name)) return true;
+    if (isDir && m_excludedPaths->contains(QDir::cleanPath(path))) return true;
+
+    for (const auto& set : m_sets) {
+        if (matches(set->names, name) || (isDir && matches(set->dirNames, name))) {
+            return true;
+        }
+        if (set->paths.pattern().isEmpty() && set->dirPaths.pattern().isEmpty()) continue;
+
+        const QString relative = path.mid(set->baseDir.size() + 1);
+        if (matches(set->paths, relative) || (isDir && matches(set->dirPaths, relative))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool IgnoreRules::isBuiltInIgnored(const QString& name) {
+    return name.startsWith('.') || SystemFolders.contains(name.toLower());
+}
+
+std::shared_ptr<const IgnoreRules::PatternSet> IgnoreRules::load(const QString& dir) {
+    QFile file(QDir(dir).filePath(FileName));
+    if (!file.exists() || !file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return nullptr;
+    }
+
+    QStringList names, dirNames, paths, dirPaths;
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        QString pattern = in.readLine().trimmed();
+        if (pattern.isEmpty() || pattern.startsWith('#')) continue;
+
+        bool dirOnly = pattern.endsWith('/');
+        while (pattern.endsWith('/')) pattern.chop(1);
+        if (pattern.isEmpty()) continue;
+
+        if (pattern.contains('/')) {
+            while (pattern.startsWith('/')) pattern.remove(0, 1);
+            (dirOnly ? dirPaths : paths) << pattern;
+        } else {
+            (dirOnly ? dirNames : names) << pattern;
+        }
+    }
+
+    auto set = std::make_shared<PatternSet>();
+    set->baseDir = QDir::cleanPath(dir);
+    set->names = compile(names, file.fileName());
+    set->dirNames = compile(dirNames, file.fileName());
+    set->paths = compile(paths, file.fileName());
+    set->dirPaths = compile(dirPaths, file.fileName());
+    return set;
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QRegularExpression>
+#include <QVector>
+#include <QSet>
+#include <memory>
+
+namespace KeyTagger {
+
+/**
+ * IgnoreRules - Decides which files and folders a scan skips
+ *
+ * Built in: folders the app writes to, hidden entries and the usual
+ * system folders. On top of that any folder may hold a .keytaggerignore
+ * file with one glob per line, gitignore style: "#" starts a comment, a
+ * trailing "/" only matches folders, and a pattern containing "/" is
+ * matched against the path below that folder instead of the entry name.
+ * Rules apply to their folder's whole subtree and match case-insensitively.
+ *
+ * The globs of one file are compiled into a single regular expression.
+ * Values share their compiled sets, so enter() is cheap per folder.
+ */
+class IgnoreRules {
+public:
+    static constexpr const char* FileName = ".keytaggerignore";
+
+    // excludedPaths are absolute folders that are always skipped
+    explicit IgnoreRules(const QStringList& excludedPaths = {});
+
+    // Rules for the entries of dir: these plus dir's own ignore file
+    IgnoreRules enter(const QString& dir) const;
+
+    // path is absolute and name is its last component
+    bool isIgnored(const QString& path, const QString& name, bool isDir) const;
+
+    // Hidden and system entries, skipped whatever the rules say
+    static bool isBuiltInIgnored(const QString& name);
+
+private:
+    struct PatternSet {
+        QString baseDir;
+        QRegularExpression names;       // Entry name, files and folders
+        QRegularExpression dirNames;    // Entry name, folders only
+        QRegularExpression paths;       // Path below baseDir, files and folders
+        QRegularExpression dirPaths;    // Path below baseDir, folders only
+    };
+
+    static std::shared_ptr<const PatternSet> load(const QString& dir);
+
+    std::shared_ptr<const QSet<QString>> m_excludedPaths;
+    QVector<std::shared_ptr<const PatternSet>> m_sets;
+};
+
+} // namespace KeyTagger
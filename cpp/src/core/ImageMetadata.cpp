@@ -0,0 +1,373 @@
+#include "ImageMetadata.h"
+#include <QFile>
+#include <QDateTime>
+#include <QtEndian>
+#include <climits>
+#include <cstring>
+
+namespace KeyTagger {
+
+namespace {
+
+// Bounds on work done for one file, whatever its headers claim
+constexpr int MaxJpegSegments = 64;
+constexpr int MaxPngChunks = 64;
+constexpr int MaxWebPChunks = 64;
+constexpr int MaxIfdEntries = 512;
+
+bool readAt(QIODevice& device, qint64 offset, void* data, qint64 size) {
+    if (offset < 0 || size < 0 || offset > device.size() - size) return false;
+    return device.seek(offset) && device.read(static_cast<char*>(data), size) == size;
+}
+
+quint16 be16(const uchar* p) { return qFromBigEndian<quint16>(p); }
+quint32 be32(const uchar* p) { return qFromBigEndian<quint32>(p); }
+quint16 le16(const uchar* p) { return qFromLittleEndian<quint16>(p); }
+quint32 le32(const uchar* p) { return qFromLittleEndian<quint32>(p); }
+quint32 le24(const uchar* p) { return p[0] | (p[1] << 8) | (quint32(p[2]) << 16); }
+
+// EXIF dates are "YYYY:MM:DD HH:MM:SS" in the camera's local time
+std::optional<qint64> parseExifDate(const char* text) {
+    QDateTime dt = QDateTime::fromString(QString::fromLatin1(text), "yyyy:MM:dd HH:mm:ss");
+    if (!dt.isValid()) return std::nullopt;
+    return dt.toSecsSinceEpoch();
+}
+
+// What the TIFF structure of a file or an EXIF block says
+struct TiffInfo {
+    int width = 0;
+    int height = 0;
+    int orientation = 1;
+    char dateTimeOriginal[20] = {};
+    char dateTime[20] = {};
+    qint64 thumbnailOffset = 0;     // Absolute
+    qint64 thumbnailSize = 0;
+};
+
+// TIFF structure stored at [base, end) of device; offsets inside it are
+// relative to base
+class TiffReader {
+public:
+    TiffReader(QIODevice& device, qint64 base, qint64 end)
+        : m_device(device), m_base(base), m_end(qMin(end, device.size())) {}
+
+    bool parse(TiffInfo& info) {
+        uchar header[8];
+        if (!read(0, header, sizeof(header))) return false;
+        if (std::memcmp(header, "II*\0", 4) == 0) {
+            m_littleEndian = true;
+        } else if (std::memcmp(header, "MM\0*", 4) == 0) {
+            m_littleEndian = false;
+        } else {
+            return false;
+        }
+
+        quint32 exifIfd = 0;
+        quint32 ifd1 = readIfd(u32(header + 4), [&](quint16 tag, quint16 type, quint32 count, const uchar* value) {
+            switch (tag) {
+                case 0x0100: info.width = int(number(type, value)); break;
+                case 0x0101: info.height = int(number(type, value)); break;
+                case 0x0112: info.orientation = int(number(type, value)); break;
+                case 0x0132: text(type, count, value, info.dateTime); break;
+                case 0x8769: exifIfd = number(type, value); break;
+            }
+        });
+
+        if (exifIfd) {
+            readIfd(exifIfd, [&](quint16 tag, quint16 type, quint32 count, const uchar* value) {
+                if (tag == 0x9003) text(type, count, value, info.dateTimeOriginal);
+            });
+        }
+
+        // IFD1 describes the thumbnail
+        if (ifd1) {
+            quint32 offset = 0, size = 0;
+            readIfd(ifd1, [&](quint16 tag, quint16 type, quint32, const uchar* value) {
+                if (tag == 0x0201) offset = number(type, value);
+                if (tag == 0x0202) size = number(type, value);
+            });
+            if (offset && size && qint64(offset) + size <= m_end - m_base) {
+                info.thumbnailOffset = m_base + offset;
+                info.thumbnailSize = size;
+            }
+        }
+
+        if (info.orientation < 1 || info.orientation > 8) {
+            info.orientation = 1;
+        }
+        return true;
+    }
+
+private:
+    bool read(qint64 offset, void* data, qint64 size) {
+        if (offset < 0 || offset > m_end - m_base - size) return false;
+        return readAt(m_device, m_base + offset, data, size);
+    }
+
+    quint16 u16(const uchar* p) const { return m_littleEndian ? le16(p) : be16(p); }
+    quint32 u32(const uchar* p) const { return m_littleEndian ? le32(p) : be32(p); }
+
+    // SHORT or LONG value stored inline in an entry
+    quint32 number(quint16 type, const uchar* value) const {
+        if (type == 3) return u16(value);
+        if (type == 4) return u32(value);
+        return 0;
+    }
+
+    // ASCII value, inline when it fits in four bytes
+    void text(quint16 type, quint32 count, const uchar* value, char (&out)[20]) {
+        if (type != 2 || count == 0) return;
+        qint64 size = qMin<qint64>(count, sizeof(out) - 1);
+        if (count <= 4) {
+            std::memcpy(out, value, size);
+        } else if (!read(u32(value), out, size)) {
+            return;
+        }
+        out[size] = '\0';
+    }
+
+    // Calls visit for each entry of the IFD at offset; returns the offset
+    // of the next IFD, 0 at the end of the chain
+    template <typename Visit>
+    quint32 readIfd(quint32 offset, Visit visit) {
+        uchar countBytes[2];
+        if (!read(offset, countBytes, 2)) return 0;
+        int count = qMin<int>(u16(countBytes), MaxIfdEntries);
+
+        for (int i = 0; i < count; ++i) {
+            uchar entry[12];
+            if (!read(qint64(offset) + 2 + i * 12, entry, sizeof(entry))) return 0;
+            visit(u16(entry), u16(entry + 2), u32(entry + 4), entry + 8);
+        }
+
+        uchar next[4];
+        if (!read(qint64(offset) + 2 + count * 12, next, 4)) return 0;
+        quint32 nextOffset = u32(next);
+        return nextOffset != offset ? nextOffset : 0;
+    }
+
+    QIODevice& m_device;
+    qint64 m_base;
+    qint64 m_end;
+    bool m_littleEndian = true;
+};
+
+// Orientation, dates and thumbnail from an EXIF block
+void applyExif(const TiffInfo& exif, ImageMetadata& meta) {
+    meta.orientation = exif.orientation;
+    meta.capturedTimeUtc = parseExifDate(exif.dateTimeOriginal);
+    if (!meta.capturedTimeUtc) {
+        meta.capturedTimeUtc = parseExifDate(exif.dateTime);
+    }
+    meta.thumbnailOffset = exif.thumbnailOffset;
+    meta.thumbnailSize = exif.thumbnailSize;
+}
+
+// EXIF payloads in JPEG APP1 always, and in PNG or WebP sometimes, start
+// with "Exif\0\0" before the TIFF header
+void readExif(QIODevice& device, qint64 offset, qint64 size, ImageMetadata& meta) {
+    char prefix[6];
+    if (size >= 6 && readAt(device, offset, prefix, 6) && std::memcmp(prefix, "Exif\0\0", 6) == 0) {
+        offset += 6;
+        size -= 6;
+    }
+    TiffInfo exif;
+    if (TiffReader(device, offset, offset + size).parse(exif)) {
+        applyExif(exif, meta);
+    }
+}
+
+bool readJpeg(QIODevice& device, ImageMetadata& meta) {
+    qint64 pos = 2;
+    bool exifSeen = false;
+    for (int i = 0; i < MaxJpegSegments; ++i) {
+        uchar marker[2];
+        if (!readAt(device, pos, marker, 2) || marker[0] != 0xFF) return false;
+        // Markers may be padded with any number of 0xFF bytes
+        while (marker[1] == 0xFF) {
+            if (!readAt(device, ++pos + 1, &marker[1], 1)) return false;
+        }
+        pos += 2;
+
+        const uchar code = marker[1];
+        if (code == 0x01 || (code >= 0xD0 && code <= 0xD8)) continue;
+        if (code == 0xD9 || code == 0xDA) return false;     // Image data before any frame header
+
+        uchar lengthBytes[2];
+        if (!readAt(device, pos, lengthBytes, 2)) return false;
+        const quint16 length = be16(lengthBytes);
+        if (length < 2) return false;
+
+        if (code == 0xE1 && !exifSeen) {
+            char prefix[6];
+            if (length >= 8 && readAt(device, pos + 2, prefix, 6) && std::memcmp(prefix, "Exif\0\0", 6) == 0) {
+                readExif(device, pos + 2, length - 2, meta);
+                exifSeen = true;
+            }
+        } else if (code >= 0xC0 && code <= 0xCF && code != 0xC4 && code != 0xC8 && code != 0xCC) {
+            // Start of frame: precision, height, width
+            uchar frame[5];
+            if (length < 7 || !readAt(device, pos + 2, frame, sizeof(frame))) return false;
+            meta.height = be16(frame + 1);
+            meta.width = be16(frame + 3);
+            return true;
+        }
+        pos += length;
+    }
+    return false;
+}
+
+bool readPng(QIODevice& device, ImageMetadata& meta) {
+    uchar ihdr[16];
+    if (!readAt(device, 8, ihdr, sizeof(ihdr)) || std::memcmp(ihdr + 4, "IHDR", 4) != 0) return false;
+    meta.width = int(qMin<quint32>(be32(ihdr + 8), INT_MAX));
+    meta.height = int(qMin<quint32>(be32(ihdr + 12), INT_MAX));
+
+    // eXIf, when present, precedes the image data
+    qint64 pos = 8 + 8 + be32(ihdr) + 4;
+    for (int i = 0; i < MaxPngChunks; ++i) {
+        uchar chunk[8];
+        if (!readAt(device, pos, chunk, sizeof(chunk))) break;
+        const quint32 length = be32(chunk);
+        if (std::memcmp(chunk + 4, "IDAT", 4) == 0 || std::memcmp(chunk + 4, "IEND", 4) == 0) break;
+        if (std::memcmp(chunk + 4, "eXIf", 4) == 0) {
+            readExif(device, pos + 8, length, meta);
+            break;
+        }
+        pos += 8 + qint64(length) + 4;
+    }
+    return true;
+}
+
+bool readWebP(QIODevice& device, ImageMetadata& meta) {
+    uchar riff[12];
+    if (!readAt(device, 0, riff, sizeof(riff))) return false;
+    const qint64 end = qMin<qint64>(8 + qint64(le32(riff + 4)), device.size());
+
+    bool hasExif = false;
+    qint64 pos = 12;
+    for (int i = 0; i < MaxWebPChunks && pos + 8 <= end; ++i) {
+        uchar chunk[8];
+        if (!readAt(device, pos, chunk, sizeof(chunk))) break;
+        const qint64 length = le32(chunk + 4);
+        const qint64 payload = pos + 8;
+
+        if (i == 0) {
+            uchar head[10];
+            if (!readAt(device, payload, head, sizeof(head))) return false;
+            if (std::memcmp(chunk, "VP8X", 4) == 0) {
+                // Extended: flags, then 24-bit canvas size minus one
+                hasExif = head[0] & 0x08;
+                meta.width = int(le24(head + 4)) + 1;
+                meta.height = int(le24(head + 7)) + 1;
+            } else if (std::memcmp(chunk, "VP8 ", 4) == 0) {
+                // Lossy: frame tag, start code, 14-bit sizes
+                if (head[3] != 0x9D || head[4] != 0x01 || head[5] != 0x2A) return false;
+                meta.width = le16(head + 6) & 0x3FFF;
+                meta.height = le16(head + 8) & 0x3FFF;
+                return true;
+            } else if (std::memcmp(chunk, "VP8L", 4) == 0) {
+                // Lossless: signature, then 14-bit sizes minus one
+                if (head[0] != 0x2F) return false;
+                const quint32 bits = le32(head + 1);
+                meta.width = int(bits & 0x3FFF) + 1;
+                meta.height = int((bits >> 14) & 0x3FFF) + 1;
+                return true;
+            } else {
+                return false;
+            }
+            if (!hasExif) return true;
+        } else if (std::memcmp(chunk, "EXIF", 4) == 0) {
+            readExif(device, payload, qMin(length, end - payload), meta);
+            break;
+        }
+        pos = payload + length + (length & 1);
+    }
+    return meta.width > 0;
+}
+
+bool readGif(QIODevice& device, ImageMetadata& meta) {
+    uchar screen[4];
+    if (!readAt(device, 6, screen, sizeof(screen))) return false;
+    meta.width = le16(screen);
+    meta.height = le16(screen + 2);
+    return true;
+}
+
+bool readBmp(QIODevice& device, ImageMetadata& meta) {
+    uchar header[12];
+    if (!readAt(device, 14, header, sizeof(header))) return false;
+    if (le32(header) == 12) {
+        // OS/2 core header with 16-bit sizes
+        meta.width = le16(header + 4);
+        meta.height = le16(header + 6);
+    } else {
+        // Negative height marks a top-down bitmap; a negative width is
+        // invalid. The magnitude is taken in 64 bits, INT_MIN has no
+        // 32-bit one.
+        const qint64 width = qint32(le32(header + 4));
+        const qint64 height = qAbs(qint64(qint32(le32(header + 8))));
+        if (width <= 0 || height == 0 || height > INT_MAX) return false;
+        meta.width = int(width);
+        meta.height = int(height);
+    }
+    return true;
+}
+
+bool readTiff(QIODevice& device, ImageMetadata& meta) {
+    TiffInfo info;
+    if (!TiffReader(device, 0, device.size()).parse(info)) return false;
+    meta.width = info.width;
+    meta.height = info.height;
+    applyExif(info, meta);
+    return true;
+}
+
+} // namespace
+
+std::optional<ImageMetadata> ImageMetadata::read(const QString& filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return std::nullopt;
+    }
+    return read(file);
+}
+
+std::optional<ImageMetadata> ImageMetadata::read(QIODevice& device) {
+    using MediaTypes::Format;
+
+    uchar magic[12] = {};
+    const qint64 got = device.seek(0) ? device.read(reinterpret_cast<char*>(magic), sizeof(magic)) : -1;
+    if (got < 4) {
+        return std::nullopt;
+    }
+
+    ImageMetadata meta;
+    bool ok = false;
+    if (magic[0] == 0xFF && magic[1] == 0xD8) {
+        meta.format = Format::Jpeg;
+        ok = readJpeg(device, meta);
+    } else if (got >= 8 && std::memcmp(magic, "\x89PNG\r\n\x1a\n", 8) == 0) {
+        meta.format = Format::Png;
+        ok = readPng(device, meta);
+    } else if (got >= 12 && std::memcmp(magic, "RIFF", 4) == 0 && std::memcmp(magic + 8, "WEBP", 4) == 0) {
+        meta.format = Format::WebP;
+        ok = readWebP(device, meta);
+    } else if (got >= 6 && (std::memcmp(magic, "GIF87a", 6) == 0 || std::memcmp(magic, "GIF89a", 6) == 0)) {
+        meta.format = Format::Gif;
+        ok = readGif(device, meta);
+    } else if (std::memcmp(magic, "II*\0", 4) == 0 || std::memcmp(magic, "MM\0*", 4) == 0) {
+        meta.format = Format::Tiff;
+        ok = readTiff(device, meta);
+    } else if (magic[0] == 'B' && magic[1] == 'M') {
+        meta.format = Format::Bmp;
+        ok = readBmp(device, meta);
+    }
+
+    if (!ok || meta.width <= 0 || meta.height <= 0) {
+        return std::nullopt;
+    }
+    return meta;
+}
+
+} // namespace KeyTagger
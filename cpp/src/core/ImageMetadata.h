@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QString>
+#include <QIODevice>
+#include <optional>
+#include "MediaTypes.h"
+
+namespace KeyTagger {
+
+/**
+ * ImageMetadata - Image facts read from file headers
+ *
+ * Recognizes JPEG, TIFF, PNG, WebP, GIF and BMP by their magic bytes and
+ * reads dimensions, EXIF orientation, capture time and the location of
+ * the embedded EXIF thumbnail without handing the file to a codec. Only
+ * headers are read: JPEG segments up to the frame header, TIFF IFDs, the
+ * PNG chunks before image data and the WebP chunk list, each with small
+ * bounded reads. Every offset taken from the file is range-checked, so
+ * truncated or hostile files yield nullopt or partial results, never a
+ * read outside the file.
+ */
+struct ImageMetadata {
+    MediaTypes::Format format = MediaTypes::Format::None;
+    int width = 0;                          // Stored pixels, before orientation
+    int height = 0;
+    int orientation = 1;                    // EXIF orientation, 1-8
+    std::optional<qint64> capturedTimeUtc;  // DateTimeOriginal, else DateTime
+    qint64 thumbnailOffset = 0;             // Embedded JPEG thumbnail, absolute in the file
+    qint64 thumbnailSize = 0;
+
+    bool hasThumbnail() const { return thumbnailSize > 0; }
+    // Orientations 5-8 rotate by 90 degrees, swapping width and height
+    bool isTransposed() const { return orientation >= 5 && orientation <= 8; }
+
+    // nullopt if the file cannot be opened or is not a recognized image
+    static std::optional<ImageMetadata> read(const QString& filePath);
+    // device must be open and seekable
+    static std::optional<ImageMetadata> read(QIODevice& device);
+};
+
+} // namespace KeyTagger
@@ -1,32 +1,10 @@
 #include "MediaRecord.h"
-#include <QSet>
+#include "MediaTypes.h"
 
 namespace KeyTagger {
 
-static const QSet<QString> IMAGE_EXTENSIONS = {
-    ".jpg", ".jpeg", ".png", ".webp", ".bmp", ".tif", ".tiff", ".gif"
-};
-
-static const QSet<QString> VIDEO_EXTENSIONS = {
-    ".mp4", ".mov", ".avi", ".mkv", ".webm", ".m4v", ".wmv", ".3gp"
-};
-
-static const QSet<QString> AUDIO_EXTENSIONS = {
-    ".m4a", ".mp3", ".wav", ".flac", ".ogg", ".aac"
-};
-
 MediaType MediaRecord::typeFromExtension(const QString& ext) {
-    QString lower = ext.toLower();
-    if (IMAGE_EXTENSIONS.contains(lower)) {
-        return MediaType::Image;
-    }
-    if (VIDEO_EXTENSIONS.contains(lower)) {
-        return MediaType::Video;
-    }
-    if (AUDIO_EXTENSIONS.contains(lower)) {
-        return MediaType::Audio;
-    }
-    return MediaType::Unknown;
+    return MediaTypes::classify(ext);
 }
 
 QString MediaRecord::mediaTypeToString(MediaType type) {
@@ -46,5 +24,18 @@ MediaType MediaRecord::stringToMediaType(const QString& str) {
     return MediaType::Unknown;
 }
 
+std::optional<qint64> MediaRecord::pHashToInt(const QString& hex) {
+    bool ok = false;
+    quint64 value = hex.toULongLong(&ok, 16);
+    if (!ok || hex.isEmpty()) {
+        return std::nullopt;
+    }
+    return qint64(value);
+}
+
+QString MediaRecord::pHashFromInt(qint64 value) {
+    return QString("%1").arg(quint64(value), 16, 16, QChar('0'));
+}
+
 } // namespace KeyTagger
 
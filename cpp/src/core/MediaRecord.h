@@ -2,17 +2,66 @@
 
 #include <QString>
 #include <QDateTime>
+#include <QFlags>
 #include <optional>
 
 namespace KeyTagger {
 
+// Stored as INTEGER in media.media_type; never renumber
 enum class MediaType {
-    Image,
-    Video,
-    Audio,
-    Unknown
+    Image = 0,
+    Video = 1,
+    Audio = 2,
+    Unknown = 3
 };
 
+// Stored as INTEGER in media.status; never renumber
+enum class MediaStatus {
+    Active = 0,
+    Deleted = 1
+};
+
+// Why a file could not be processed, which decides when it is retried
+enum class MediaError {
+    None = 0,
+    Unreadable = 1,     // Could not be read; retried with backoff
+    Undecodable = 2     // Read but not decoded; retried once the file changes
+};
+
+// Columns of the media table, so queries can load only what a caller shows
+enum class MediaField : quint32 {
+    Id              = 1 << 0,
+    FilePath        = 1 << 1,
+    RootDir         = 1 << 2,
+    FileName        = 1 << 3,
+    Sha256          = 1 << 4,
+    PHash           = 1 << 5,
+    Width           = 1 << 6,
+    Height          = 1 << 7,
+    SizeBytes       = 1 << 8,
+    CapturedTime    = 1 << 9,
+    ModifiedTime    = 1 << 10,
+    MediaType       = 1 << 11,
+    ThumbnailPath   = 1 << 12,
+    Status          = 1 << 13,
+    Error           = 1 << 14,
+    QuickHash       = 1 << 15,
+    ErrorClass      = 1 << 16,
+    FailureCount    = 1 << 17,
+    RetryAfter      = 1 << 18,
+    Duration        = 1 << 19
+};
+Q_DECLARE_FLAGS(MediaFields, MediaField)
+Q_DECLARE_OPERATORS_FOR_FLAGS(MediaFields)
+
+inline constexpr MediaFields AllMediaFields = MediaFields::fromInt((1 << 20) - 1);
+
+// What the gallery grid and viewer read from a record
+inline constexpr MediaFields GridMediaFields =
+    MediaField::Id | MediaField::FilePath | MediaField::FileName | MediaField::MediaType |
+    MediaField::ThumbnailPath | MediaField::Width | MediaField::Height |
+    MediaField::SizeBytes | MediaField::ModifiedTime;
+
 struct MediaRecord {
     qint64 id = 0;
     QString filePath;
@@ -27,8 +76,13 @@ struct MediaRecord {
     std::optional<qint64> modifiedTimeUtc;
     MediaType mediaType = MediaType::Unknown;
     QString thumbnailPath;
-    QString status = "active";
+    MediaStatus status = MediaStatus::Active;
     QString error;
+    std::optional<qint64> quickHash;    // Size, head, tail and sampled blocks; see ScannerWorker
+    MediaError errorClass = MediaError::None;
+    int failureCount = 0;               // Consecutive failures of errorClass
+    std::optional<qint64> retryAfterUtc;
+    std::optional<qint64> durationMs;   // Videos, from the container header
 
     bool isValid() const { return id > 0 && !filePath.isEmpty(); }
     bool isImage() const { return mediaType == MediaType::Image; }
@@ -38,6 +92,10 @@ struct MediaRecord {
     static MediaType typeFromExtension(const QString& ext);
     static QString mediaTypeToString(MediaType type);
     static MediaType stringToMediaType(const QString& str);
+    
+    // 16-digit hex perceptual hash <-> the 64-bit integer stored in p_hash
+    static std::optional<qint64> pHashToInt(const QString& hex);
+    static QString pHashFromInt(qint64 value);
 };
 
 } // namespace KeyTagger
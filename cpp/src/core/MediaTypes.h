@@ -0,0 +1,159 @@
+#pragma once
+
+#include <QStringView>
+#include "MediaRecord.h"
+
+namespace KeyTagger {
+
+/**
+ * MediaTypes - File extension to media type, without allocating
+ *
+ * Every known extension is packed into a 64-bit key, one lowercase ASCII
+ * byte per character, and placed in a 64-slot table by a multiplicative
+ * hash. The multiplier is searched for at compile time and the build
+ * fails if it does not separate all keys, so a lookup is one multiply,
+ * one shift and one compare. Callers pass a file name or path; nothing
+ * is lowercased or copied on the heap.
+ */
+namespace MediaTypes {
+
+enum class Format : quint8 {
+    None,
+    Jpeg, Png, WebP, Bmp, Tiff, Gif,
+    Mp4, Mov, Avi, Mkv, WebM, M4v, Wmv, ThreeGp,
+    M4a, Mp3, Wav, Flac, Ogg, Aac
+};
+
+namespace detail {
+
+struct Known {
+    const char* extension;
+    Format format;
+};
+
+inline constexpr Known KnownExtensions[] = {
+    {"jpg", Format::Jpeg}, {"jpeg", Format::Jpeg}, {"png", Format::Png}, {"webp", Format::WebP},
+    {"bmp", Format::Bmp}, {"tif", Format::Tiff}, {"tiff", Format::Tiff}, {"gif", Format::Gif},
+    {"mp4", Format::Mp4}, {"mov", Format::Mov}, {"avi", Format::Avi}, {"mkv", Format::Mkv},
+    {"webm", Format::WebM}, {"m4v", Format::M4v}, {"wmv", Format::Wmv}, {"3gp", Format::ThreeGp},
+    {"m4a", Format::M4a}, {"mp3", Format::Mp3}, {"wav", Format::Wav}, {"flac", Format::Flac},
+    {"ogg", Format::Ogg}, {"aac", Format::Aac},
+};
+
+inline constexpr int MaxExtensionLength = 8;
+inline constexpr int TableBits = 6;
+inline constexpr int TableSize = 1 << TableBits;
+
+constexpr quint64 packKey(const char* extension) {
+    quint64 key = 0;
+    for (int i = 0; i < MaxExtensionLength && extension[i]; ++i) {
+        key |= quint64(quint8(extension[i])) << (8 * i);
+    }
+    return key;
+}
+
+constexpr int slotOf(quint64 key, quint64 multiplier) {
+    return int((key * multiplier) >> (64 - TableBits));
+}
+
+constexpr bool separatesAll(quint64 multiplier) {
+    bool used[TableSize] = {};
+    for (const Known& known : KnownExtensions) {
+        int slot = slotOf(packKey(known.extension), multiplier);
+        if (used[slot]) return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr quint64 findMultiplier() {
+    for (quint64 i = 1; i < 4096; ++i) {
+        quint64 multiplier = (i * 0x9E3779B97F4A7C15ull) | 1;
+        if (separatesAll(multiplier)) return multiplier;
+    }
+    return 0;
+}
+
+inline constexpr quint64 Multiplier = findMultiplier();
+static_assert(Multiplier != 0, "No perfect hash for the extension table; raise TableBits");
+
+struct Slot {
+    quint64 key = 0;
+    Format format = Format::None;
+};
+
+struct Table {
+    Slot slots[TableSize] = {};
+};
+
+constexpr Table buildTable() {
+    Table table;
+    for (const Known& known : KnownExtensions) {
+        quint64 key = packKey(known.extension);
+        table.slots[slotOf(key, Multiplier)] = {key, known.format};
+    }
+    return table;
+}
+
+inline constexpr Table Lookup = buildTable();
+
+} // namespace detail
+
+constexpr MediaType typeOf(Format format) {
+    switch (format) {
+        case Format::Jpeg: case Format::Png: case Format::WebP:
+        case Format::Bmp: case Format::Tiff: case Format::Gif:
+            return MediaType::Image;
+        case Format::Mp4: case Format::Mov: case Format::Avi: case Format::Mkv:
+        case Format::WebM: case Format::M4v: case Format::Wmv: case Format::ThreeGp:
+            return MediaType::Video;
+        case Format::M4a: case Format::Mp3: case Format::Wav:
+        case Format::Flac: case Format::Ogg: case Format::Aac:
+            return MediaType::Audio;
+        case Format::None:
+            break;
+    }
+    return MediaType::Unknown;
+}
+
+// Format named by the extension of fileName, which may be a full path or
+// just ".ext"; matching ignores ASCII case
+constexpr Format formatOf(QStringView fileName) {
+    qsizetype dot = fileName.size();
+    while (dot > 0 && fileName.size() - dot <= detail::MaxExtensionLength) {
+        char16_t c = fileName[--dot].unicode();
+        if (c == u'.') break;
+        if (c == u'/' || c == u'\\') return Format::None;
+    }
+    if (fileName.isEmpty() || fileName[dot] != u'.') return Format::None;
+
+    if (dot + 1 == fileName.size()) return Format::None;
+
+    quint64 key = 0;
+    for (qsizetype i = 0; dot + 1 + i < fileName.size(); ++i) {
+        char16_t c = fileName[dot + 1 + i].unicode();
+        if (c >= u'A' && c <= u'Z') {
+            c = char16_t(c + (u'a' - u'A'));
+        } else if (c > 0x7f) {
+            return Format::None;
+        }
+        key |= quint64(c) << (8 * i);
+    }
+
+    const detail::Slot& slot = detail::Lookup.slots[detail::slotOf(key, detail::Multiplier)];
+    return slot.key == key ? slot.format : Format::None;
+}
+
+constexpr MediaType classify(QStringView fileName) {
+    return typeOf(formatOf(fileName));
+}
+
+static_assert(classify(u"IMG_0001.JPG") == MediaType::Image);
+static_assert(classify(u"clip.webm") == MediaType::Video);
+static_assert(classify(u".flac") == MediaType::Audio);
+static_assert(classify(u"notes.txt") == MediaType::Unknown);
+static_assert(classify(u"folder.jpg/readme") == MediaType::Unknown);
+
+} // namespace MediaTypes
+
+} // namespace KeyTagger
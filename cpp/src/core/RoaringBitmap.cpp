@@ -0,0 +1,406 @@
+#include "RoaringBitmap.h"
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace KeyTagger {
+
+// ---------------------------------------------------------------------------
+// Container
+// ---------------------------------------------------------------------------
+
+bool RoaringBitmap::Container::contains(quint16 low) const {
+    if (isBitmap()) {
+        return words[low >> 6] & (quint64(1) << (low & 63));
+    }
+    return std::binary_search(array.cbegin(), array.cend(), low);
+}
+
+bool RoaringBitmap::Container::add(quint16 low) {
+    if (isBitmap()) {
+        quint64& word = words[low >> 6];
+        const quint64 mask = quint64(1) << (low & 63);
+        if (word & mask) return false;
+        word |= mask;
+        ++cardinality;
+        return true;
+    }
+
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it != array.end() && *it == low) return false;
+    array.insert(it, low);
+    ++cardinality;
+    normalize();
+    return true;
+}
+
+bool RoaringBitmap::Container::remove(quint16 low) {
+    if (isBitmap()) {
+        quint64& word = words[low >> 6];
+        const quint64 mask = quint64(1) << (low & 63);
+        if (!(word & mask)) return false;
+        word &= ~mask;
+        --cardinality;
+        normalize();
+        return true;
+    }
+
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it == array.end() || *it != low) return false;
+    array.erase(it);
+    --cardinality;
+    return true;
+}
+
+void RoaringBitmap::Container::normalize() {
+    if (isBitmap() && cardinality <= ArrayLimit) {
+        QVector<quint16> values;
+        values.reserve(cardinality);
+        for (int w = 0; w < WordCount; ++w) {
+            quint64 word = words[w];
+            while (word) {
+                values.append(quint16(w * 64 + qCountTrailingZeroBits(word)));
+                word &= word - 1;
+            }
+        }
+        array = std::move(values);
+        words.clear();
+    } else if (!isBitmap() && cardinality > ArrayLimit) {
+        words.fill(0, WordCount);
+        for (quint16 low : std::as_const(array)) {
+            words[low >> 6] |= quint64(1) << (low & 63);
+        }
+        array.clear();
+    }
+}
+
+bool RoaringBitmap::Container::operator==(const Container& other) const {
+    if (cardinality != other.cardinality) return false;
+    if (isBitmap() != other.isBitmap()) return false;
+    return isBitmap() ? words == other.words : array == other.array;
+}
+
+RoaringBitmap::Container RoaringBitmap::intersect(const Container& a, const Container& b) {
+    Container result;
+
+    if (a.isBitmap() && b.isBitmap()) {
+        result.words.resize(WordCount);
+        int count = 0;
+        for (int w = 0; w < WordCount; ++w) {
+            const quint64 word = a.words[w] & b.words[w];
+            result.words[w] = word;
+            count += qPopulationCount(word);
+        }
+        result.cardinality = count;
+    } else if (!a.isBitmap() && !b.isBitmap()) {
+        result.array.reserve(std::min(a.cardinality, b.cardinality));
+        std::set_intersection(a.array.cbegin(), a.array.cend(), b.array.cbegin(), b.array.cend(),
+                              std::back_inserter(result.array));
+        result.cardinality = result.array.size();
+    } else {
+        const Container& sparse = a.isBitmap() ? b : a;
+        const Container& dense = a.isBitmap() ? a : b;
+        result.array.reserve(sparse.cardinality);
+        for (quint16 low : sparse.array) {
+            if (dense.contains(low)) result.array.append(low);
+        }
+        result.cardinality = result.array.size();
+    }
+
+    result.normalize();
+    return result;
+}
+
+RoaringBitmap::Container RoaringBitmap::unite(const Container& a, const Container& b) {
+    Container result;
+
+    if (a.isBitmap() || b.isBitmap()) {
+        const Container& dense = a.isBitmap() ? a : b;
+        const Container& other = a.isBitmap() ? b : a;
+        result.words = dense.words;
+        if (other.isBitmap()) {
+            for (int w = 0; w < WordCount; ++w) {
+                result.words[w] |= other.words[w];
+            }
+        } else {
+            for (quint16 low : other.array) {
+                result.words[low >> 6] |= quint64(1) << (low & 63);
+            }
+        }
+        int count = 0;
+        for (quint64 word : std::as_const(result.words)) {
+            count += qPopulationCount(word);
+        }
+        result.cardinality = count;
+    } else {
+        result.array.reserve(a.cardinality + b.cardinality);
+        std::set_union(a.array.cbegin(), a.array.cend(), b.array.cbegin(), b.array.cend(),
+                       std::back_inserter(result.array));
+        result.cardinality = result.array.size();
+    }
+
+    result.normalize();
+    return result;
+}
+
+RoaringBitmap::Container RoaringBitmap::subtract(const Container& a, const Container& b) {
+    Container result;
+
+    if (a.isBitmap()) {
+        result.words = a.words;
+        if (b.isBitmap()) {
+            for (int w = 0; w < WordCount; ++w) {
+                result.words[w] &= ~b.words[w];
+            }
+        } else {
+            for (quint16 low : b.array) {
+                result.words[low >> 6] &= ~(quint64(1) << (low & 63));
+            }
+        }
+        int count = 0;
+        for (quint64 word : std::as_const(result.words)) {
+            count += qPopulationCount(word);
+        }
+        result.cardinality = count;
+    } else if (b.isBitmap()) {
+        result.array.reserve(a.cardinality);
+        for (quint16 low : a.array) {
+            if (!b.contains(low)) result.array.append(low);
+        }
+        result.cardinality = result.array.size();
+    } else {
+        result.array.reserve(a.cardinality);
+        std::set_difference(a.array.cbegin(), a.array.cend(), b.array.cbegin(), b.array.cend(),
+                            std::back_inserter(result.array));
+        result.cardinality = result.array.size();
+    }
+
+    result.normalize();
+    return result;
+}
+
+quint64 RoaringBitmap::intersectCount(const Container& a, const Container& b) {
+    if (a.isBitmap() && b.isBitmap()) {
+        quint64 count = 0;
+        for (int w = 0; w < WordCount; ++w) {
+            count += qPopulationCount(a.words[w] & b.words[w]);
+        }
+        return count;
+    }
+
+    if (!a.isBitmap() && !b.isBitmap()) {
+        quint64 count = 0;
+        auto i = a.array.cbegin();
+        auto j = b.array.cbegin();
+        while (i != a.array.cend() && j != b.array.cend()) {
+            if (*i < *j) {
+                ++i;
+            } else if (*j < *i) {
+                ++j;
+            } else {
+                ++count;
+                ++i;
+                ++j;
+            }
+        }
+        return count;
+    }
+
+    const Container& sparse = a.isBitmap() ? b : a;
+    const Container& dense = a.isBitmap() ? a : b;
+    quint64 count = 0;
+    for (quint16 low : sparse.array) {
+        if (dense.contains(low)) ++count;
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// RoaringBitmap
+// ---------------------------------------------------------------------------
+
+RoaringBitmap RoaringBitmap::fromSorted(const QVector<quint32>& ids) {
+    RoaringBitmap bitmap;
+
+    int i = 0;
+    while (i < ids.size()) {
+        const quint16 key = quint16(ids[i] >> 16);
+        Container container;
+        while (i < ids.size() && quint16(ids[i] >> 16) == key) {
+            const quint16 low = quint16(ids[i] & 0xFFFF);
+            if (container.array.isEmpty() || container.array.last() != low) {
+                container.array.append(low);
+            }
+            ++i;
+        }
+        container.cardinality = container.array.size();
+        container.normalize();
+
+        bitmap.m_keys.append(key);
+        bitmap.m_containers.append(std::move(container));
+    }
+
+    return bitmap;
+}
+
+int RoaringBitmap::indexOf(quint16 key) const {
+    auto it = std::lower_bound(m_keys.cbegin(), m_keys.cend(), key);
+    if (it != m_keys.cend() && *it == key) {
+        return int(it - m_keys.cbegin());
+    }
+    return -1;
+}
+
+void RoaringBitmap::add(quint32 id) {
+    const quint16 key = quint16(id >> 16);
+    auto it = std::lower_bound(m_keys.begin(), m_keys.end(), key);
+    const int pos = int(it - m_keys.begin());
+
+    if (it == m_keys.end() || *it != key) {
+        m_keys.insert(pos, key);
+        m_containers.insert(pos, Container());
+    }
+    m_containers[pos].add(quint16(id & 0xFFFF));
+}
+
+void RoaringBitmap::remove(quint32 id) {
+    const int pos = indexOf(quint16(id >> 16));
+    if (pos < 0) return;
+
+    Container& container = m_containers[pos];
+    container.remove(quint16(id & 0xFFFF));
+    if (container.cardinality == 0) {
+        m_keys.removeAt(pos);
+        m_containers.removeAt(pos);
+    }
+}
+
+bool RoaringBitmap::contains(quint32 id) const {
+    const int pos = indexOf(quint16(id >> 16));
+    return pos >= 0 && m_containers[pos].contains(quint16(id & 0xFFFF));
+}
+
+void RoaringBitmap::clear() {
+    m_keys.clear();
+    m_containers.clear();
+}
+
+quint64 RoaringBitmap::cardinality() const {
+    quint64 total = 0;
+    for (const Container& container : m_containers) {
+        total += container.cardinality;
+    }
+    return total;
+}
+
+quint64 RoaringBitmap::andCardinality(const RoaringBitmap& other) const {
+    quint64 total = 0;
+    int i = 0;
+    int j = 0;
+    while (i < m_keys.size() && j < other.m_keys.size()) {
+        if (m_keys[i] < other.m_keys[j]) {
+            ++i;
+        } else if (other.m_keys[j] < m_keys[i]) {
+            ++j;
+        } else {
+            total += intersectCount(m_containers[i], other.m_containers[j]);
+            ++i;
+            ++j;
+        }
+    }
+    return total;
+}
+
+RoaringBitmap RoaringBitmap::operator&(const RoaringBitmap& other) const {
+    RoaringBitmap result;
+    int i = 0;
+    int j = 0;
+    while (i < m_keys.size() && j < other.m_keys.size()) {
+        if (m_keys[i] < other.m_keys[j]) {
+            ++i;
+        } else if (other.m_keys[j] < m_keys[i]) {
+            ++j;
+        } else {
+            Container container = intersect(m_containers[i], other.m_containers[j]);
+            if (container.cardinality > 0) {
+                result.m_keys.append(m_keys[i]);
+                result.m_containers.append(std::move(container));
+            }
+            ++i;
+            ++j;
+        }
+    }
+    return result;
+}
+
+RoaringBitmap RoaringBitmap::operator|(const RoaringBitmap& other) const {
+    RoaringBitmap result;
+    int i = 0;
+    int j = 0;
+    while (i < m_keys.size() || j < other.m_keys.size()) {
+        if (j >= other.m_keys.size() || (i < m_keys.size() && m_keys[i] < other.m_keys[j])) {
+            result.m_keys.append(m_keys[i]);
+            result.m_containers.append(m_containers[i]);
+            ++i;
+        } else if (i >= m_keys.size() || other.m_keys[j] < m_keys[i]) {
+            result.m_keys.append(other.m_keys[j]);
+            result.m_containers.append(other.m_containers[j]);
+            ++j;
+        } else {
+            result.m_keys.append(m_keys[i]);
+            result.m_containers.append(unite(m_containers[i], other.m_containers[j]));
+            ++i;
+            ++j;
+        }
+    }
+    return result;
+}
+
+RoaringBitmap RoaringBitmap::operator-(const RoaringBitmap& other) const {
+    RoaringBitmap result;
+    int j = 0;
+    for (int i = 0; i < m_keys.size(); ++i) {
+        while (j < other.m_keys.size() && other.m_keys[j] < m_keys[i]) {
+            ++j;
+        }
+        if (j < other.m_keys.size() && other.m_keys[j] == m_keys[i]) {
+            Container container = subtract(m_containers[i], other.m_containers[j]);
+            if (container.cardinality > 0) {
+                result.m_keys.append(m_keys[i]);
+                result.m_containers.append(std::move(container));
+            }
+        } else {
+            result.m_keys.append(m_keys[i]);
+            result.m_containers.append(m_containers[i]);
+        }
+    }
+    return result;
+}
+
+RoaringBitmap& RoaringBitmap::operator&=(const RoaringBitmap& other) {
+    *this = *this & other;
+    return *this;
+}
+
+RoaringBitmap& RoaringBitmap::operator|=(const RoaringBitmap& other) {
+    *this = *this | other;
+    return *this;
+}
+
+RoaringBitmap& RoaringBitmap::operator-=(const RoaringBitmap& other) {
+    *this = *this - other;
+    return *this;
+}
+
+bool RoaringBitmap::operator==(const RoaringBitmap& other) const {
+    return m_keys == other.m_keys && m_containers == other.m_containers;
+}
+
+QVector<quint32> RoaringBitmap::toVector() const {
+    QVector<quint32> ids;
+    ids.reserve(int(cardinality()));
+    forEach([&ids](quint32 id) { ids.append(id); });
+    return ids;
+}
+
+} // namespace KeyTagger
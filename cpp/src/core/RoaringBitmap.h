@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QVector>
+#include <QtGlobal>
+#include <QtAlgorithms>
+
+namespace KeyTagger {
+
+/**
+ * RoaringBitmap - Compressed set of 32-bit ids
+ *
+ * Ids are split into 65536-wide chunks keyed by their high 16 bits.
+ * Sparse chunks are stored as sorted arrays of the low bits, dense ones
+ * as 1024 x 64-bit words, so set operations on dense chunks become
+ * straight word loops that the compiler can vectorize, and cardinality
+ * is a popcount. Media ids are dense, so a whole library's worth of
+ * tag membership stays small enough to keep in memory.
+ */
+class RoaringBitmap {
+public:
+    RoaringBitmap() = default;
+
+    static RoaringBitmap fromSorted(const QVector<quint32>& ids);
+
+    void add(quint32 id);
+    void remove(quint32 id);
+    bool contains(quint32 id) const;
+    void clear();
+
+    quint64 cardinality() const;
+    bool isEmpty() const { return m_keys.isEmpty(); }
+
+    // Size of the intersection without materializing it
+    quint64 andCardinality(const RoaringBitmap& other) const;
+
+    RoaringBitmap operator&(const RoaringBitmap& other) const;
+    RoaringBitmap operator|(const RoaringBitmap& other) const;
+    RoaringBitmap operator-(const RoaringBitmap& other) const;
+    RoaringBitmap& operator&=(const RoaringBitmap& other);
+    RoaringBitmap& operator|=(const RoaringBitmap& other);
+    RoaringBitmap& operator-=(const RoaringBitmap& other);
+    bool operator==(const RoaringBitmap& other) const;
+
+    // Ids in ascending order
+    QVector<quint32> toVector() const;
+
+    template <typename Fn>
+    void forEach(Fn&& fn) const;
+
+private:
+    struct Container {
+        QVector<quint16> array;     // Sorted low bits while sparse
+        QVector<quint64> words;     // Bitset while dense
+        int cardinality = 0;
+
+        bool isBitmap() const { return !words.isEmpty(); }
+        bool contains(quint16 low) const;
+        bool add(quint16 low);
+        bool remove(quint16 low);
+        void normalize();
+        bool operator==(const Container& other) const;
+    };
+
+    static Container intersect(const Container& a, const Container& b);
+    static Container unite(const Container& a, const Container& b);
+    static Container subtract(const Container& a, const Container& b);
+    static quint64 intersectCount(const Container& a, const Container& b);
+
+    int indexOf(quint16 key) const;
+
+    QVector<quint16> m_keys;            // High 16 bits, ascending
+    QVector<Container> m_containers;
+
+    // Arrays above this size take more space than a bitset
+    static constexpr int ArrayLimit = 4096;
+    static constexpr int WordCount = 1024;
+};
+
+template <typename Fn>
+void RoaringBitmap::forEach(Fn&& fn) const {
+    for (int i = 0; i < m_keys.size(); ++i) {
+        const quint32 high = quint32(m_keys[i]) << 16;
+        const Container& c = m_containers[i];
+        if (c.isBitmap()) {
+            for (int w = 0; w < WordCount; ++w) {
+                quint64 word = c.words[w];
+                while (word) {
+                    const int bit = qCountTrailingZeroBits(word);
+                    fn(high | quint32(w * 64 + bit));
+                    word &= word - 1;
+                }
+            }
+        } else {
+            for (quint16 low : c.array) {
+                fn(high | low);
+            }
+        }
+    }
+}
+
+} // namespace KeyTagger
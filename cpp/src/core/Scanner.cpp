@@ -1,14 +1,22 @@
 #include "Scanner.h"
 #include "Database.h"
 #include "MediaRecord.h"
+#include "MediaTypes.h"
+#include "ImageMetadata.h"
+#include "VideoMetadata.h"
+#include "DecodeScheduler.h"
+#include "ThumbnailGenerator.h"
+#include "IgnoreRules.h"
+#include "DirectoryWalker.h"
 
 #include <QDir>
-#include <QDirIterator>
 #include <QFileInfo>
+#include <QDateTime>
 #include <QCryptographicHash>
-#include <QImage>
+#include <QHash>
 #include <QImageReader>
-#include <QPainter>
+#include <QMutexLocker>
+#include <QtEndian>
 #include <QDebug>
 
 #include <opencv2/core.hpp>
@@ -16,28 +24,82 @@
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/videoio.hpp>
 
+#ifdef Q_OS_WIN
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
 namespace KeyTagger {
 
-static const QSet<QString> IMAGE_EXTENSIONS = {
-    ".jpg", ".jpeg", ".png", ".webp", ".bmp", ".tif", ".tiff", ".gif"
+// Identifies the file behind a path, so hard links and bind mounts of
+// one file are hashed and decoded once per scan
+struct FileIdentity {
+    quint64 device = 0;
+    quint64 inode = 0;
+    qint64 size = 0;
+    qint64 modified = 0;
+    
+    bool operator==(const FileIdentity& other) const {
+        return device == other.device && inode == other.inode &&
+               size == other.size && modified == other.modified;
+    }
 };
 
-static const QSet<QString> VIDEO_EXTENSIONS = {
-    ".mp4", ".mov", ".avi", ".mkv", ".webm", ".m4v", ".wmv", ".3gp"
-};
+static size_t qHash(const FileIdentity& id, size_t seed = 0) {
+    return qHashMulti(seed, id.device, id.inode, id.size, id.modified);
+}
 
-static const QSet<QString> AUDIO_EXTENSIONS = {
-    ".m4a", ".mp3", ".wav", ".flac", ".ogg", ".aac"
-};
+static std::optional<FileIdentity> fileIdentity(const QString& filePath) {
+    FileIdentity id;
+#ifdef Q_OS_WIN
+    HANDLE handle = CreateFileW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(filePath).utf16()),
+                                0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return std::nullopt;
+    BY_HANDLE_FILE_INFORMATION info;
+    bool ok = GetFileInformationByHandle(handle, &info);
+    CloseHandle(handle);
+    if (!ok) return std::nullopt;
+    
+    id.device = info.dwVolumeSerialNumber;
+    id.inode = (quint64(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    id.size = (qint64(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    id.modified = (qint64(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+    if (::stat(QFile::encodeName(filePath).constData(), &st) != 0) return std::nullopt;
+    
+    id.device = quint64(st.st_dev);
+    id.inode = quint64(st.st_ino);
+    id.size = qint64(st.st_size);
+    id.modified = qint64(st.st_mtime);
+#endif
+    return id;
+}
 
 // ======================== ScannerWorker ========================
 
+// Waits for a database write, giving up once token is cancelled; the
+// write itself still runs on the writer thread
+template <typename T>
+static bool waitUnlessCancelled(QFuture<T> future, const CancellationToken& token) {
+    // Runs on the writer thread as the write resolves, waking this one
+    // the way a cancel would
+    future.then(QtFuture::Launch::Sync, [token](const QFuture<T>&) { token.notify(); });
+    return token.waitUntil([&future]() { return future.isFinished(); });
+}
+
 ScannerWorker::ScannerWorker(Database* db, const QString& rootDir, 
-                             const QString& thumbnailsDir, QObject* parent)
+                             const QString& thumbnailsDir, std::shared_ptr<ScanHints> hints,
+                             QObject* parent)
     : QObject(parent)
     , m_db(db)
     , m_rootDir(QDir(rootDir).absolutePath())
     , m_thumbnailsDir(thumbnailsDir)
+    , m_hints(std::move(hints))
 {
     if (m_thumbnailsDir.isEmpty()) {
         m_thumbnailsDir = QDir(m_rootDir).filePath("thumbnails");
@@ -45,7 +107,11 @@ ScannerWorker::ScannerWorker(Database* db, const QString& rootDir,
 }
 
 void ScannerWorker::cancel() {
-    m_cancelled = true;
+    m_token.cancel();
+}
+
+void ScannerWorker::setMetadataFirst(bool enabled) {
+    m_metadataFirst = enabled;
 }
 
 QString ScannerWorker::computeSha256(const QString& filePath) {
@@ -56,18 +122,74 @@ QString ScannerWorker::computeSha256(const QString& filePath) {
     
     QCryptographicHash hash(QCryptographicHash::Sha256);
     
+    // Checked per chunk so cancelling does not wait for a large file
     const qint64 chunkSize = 1024 * 1024; // 1MB chunks
     while (!file.atEnd()) {
+        if (m_token.isCancelled()) return QString();
         hash.addData(file.read(chunkSize));
     }
     
     return hash.result().toHex();
 }
 
-QString ScannerWorker::computeImagePHash(const QString& filePath) {
+std::optional<qint64> ScannerWorker::computeQuickHash(const QString& filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return std::nullopt;
+    }
+    
+    // Size, head, tail and a few blocks in between: a few hundred KB at
+    // most, yet any real edit to a media file changes one of them
+    constexpr qint64 EdgeBytes = 64 * 1024;
+    constexpr qint64 SampleBytes = 4 * 1024;
+    constexpr int Samples = 4;
+    
+    const qint64 size = file.size();
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(QByteArray::number(size));
+    
+    if (size <= 2 * EdgeBytes + Samples * SampleBytes) {
+        hash.addData(file.readAll());
+    } else {
+        hash.addData(file.read(EdgeBytes));
+        for (int i = 1; i <= Samples; ++i) {
+            file.seek(size * i / (Samples + 1));
+            hash.addData(file.read(SampleBytes));
+        }
+        file.seek(size - EdgeBytes);
+        hash.addData(file.read(EdgeBytes));
+    }
+    
+    return qFromBigEndian<qint64>(hash.result().constData());
+}
+
+QString ScannerWorker::computeImagePHash(const QString& filePath, const std::optional<ImageMetadata>& metadata) {
     // Simple perceptual hash using DCT approach
     try {
-        cv::Mat img = cv::imread(filePath.toStdString(), cv::IMREAD_GRAYSCALE);
+        // Formats the header parser does not know still have their frame
+        // charged; when nothing reads the size the decode runs alone
+        const QSize size = metadata ? QSize(metadata->width, metadata->height) : QImageReader(filePath).size();
+        const qint64 pixels = size.isValid() ? qint64(size.width()) * size.height() : 0;
+        
+        // Only 32x32 pixels survive, so very large frames are read reduced:
+        // JPEG at an eighth of its size inside the codec, other formats
+        // through the scheduler's reduced paths
+        const bool reduced = pixels > ReducedPHashPixels;
+        const bool isJpeg = metadata && metadata->format == MediaTypes::Format::Jpeg;
+        cv::Mat img;
+        if (reduced && !isJpeg) {
+            QImage small = DecodeScheduler::instance().decodeImage(filePath, ReducedPHashEdge, &m_token);
+            if (small.isNull()) return QString();
+            small = small.convertToFormat(QImage::Format_Grayscale8);
+            img = cv::Mat(small.height(), small.width(), CV_8UC1,
+                          const_cast<uchar*>(small.constBits()), size_t(small.bytesPerLine())).clone();
+        } else {
+            const qint64 cost = !size.isValid() ? DecodeScheduler::instance().budget()
+                                : reduced ? pixels * 3 / 64 : pixels * 3;
+            DecodeScheduler::Permit permit = DecodeScheduler::instance().acquire(cost, &m_token);
+            if (!permit.isValid()) return QString();
+            img = cv::imread(filePath.toStdString(), reduced ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_GRAYSCALE);
+        }
         if (img.empty()) return QString();
         
         // Resize to 32x32
@@ -111,74 +233,6 @@ QString ScannerWorker::computeImagePHash(const QString& filePath) {
     }
 }
 
-bool ScannerWorker::createImageThumbnail(const QString& sourcePath, const QString& destPath, int maxSize) {
-    try {
-        QImage img(sourcePath);
-        if (img.isNull()) return false;
-        
-        // Scale to fit in maxSize x maxSize
-        QImage scaled = img.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-        
-        // Convert to RGB if necessary
-        if (scaled.hasAlphaChannel()) {
-            QImage rgb(scaled.size(), QImage::Format_RGB32);
-            rgb.fill(Qt::black);
-            QPainter painter(&rgb);
-            painter.drawImage(0, 0, scaled);
-            painter.end();
-            scaled = rgb;
-        }
-        
-        QDir().mkpath(QFileInfo(destPath).absolutePath());
-        return scaled.save(destPath, "JPEG", 85);
-    } catch (...) {
-        return false;
-    }
-}
-
-bool ScannerWorker::createVideoThumbnail(const QString& sourcePath, const QString& destPath, int maxSize) {
-    try {
-        cv::VideoCapture cap(sourcePath.toStdString());
-        if (!cap.isOpened()) return false;
-        
-        // Seek to middle frame
-        int frameCount = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_COUNT));
-        if (frameCount > 0) {
-            cap.set(cv::CAP_PROP_POS_FRAMES, frameCount / 2);
-        }
-        
-        cv::Mat frame;
-        if (!cap.read(frame)) {
-            cap.release();
-            return false;
-        }
-        
-        // Convert BGR to RGB
-        cv::Mat rgb;
-        cv::cvtColor(frame, rgb, cv::COLOR_BGR2RGB);
-        
-        // Create QImage
-        QImage img(rgb.data, rgb.cols, rgb.rows, static_cast<int>(rgb.step), QImage::Format_RGB888);
-        QImage copy = img.copy(); // Make a deep copy since cv::Mat will be destroyed
-        
-        cap.release();
-        
-        // Scale
-        QImage scaled = copy.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-        
-        QDir().mkpath(QFileInfo(destPath).absolutePath());
-        return scaled.save(destPath, "JPEG", 85);
-    } catch (...) {
-        return false;
-    }
-}
-
-QPair<int, int> ScannerWorker::getImageDimensions(const QString& filePath) {
-    QImageReader reader(filePath);
-    QSize size = reader.size();
-    return {size.width(), size.height()};
-}
-
 QPair<int, int> ScannerWorker::getVideoDimensions(const QString& filePath) {
     try {
         cv::VideoCapture cap(filePath.toStdString());
@@ -194,67 +248,201 @@ QPair<int, int> ScannerWorker::getVideoDimensions(const QString& filePath) {
     }
 }
 
-qint64 ScannerWorker::getImageCaptureTime(const QString& filePath) {
-    // Try to extract EXIF DateTimeOriginal
-    // This is a simplified version - for full EXIF support, consider using libexiv2
-    QImageReader reader(filePath);
-    QString text = reader.text("DateTimeOriginal");
-    if (text.isEmpty()) {
-        text = reader.text("DateTime");
-    }
+void ScannerWorker::process() {
+    ScanResult result;
     
-    if (!text.isEmpty()) {
-        // Parse "YYYY:MM:DD HH:MM:SS" format
-        QDateTime dt = QDateTime::fromString(text, "yyyy:MM:dd HH:mm:ss");
-        if (dt.isValid()) {
-            return dt.toSecsSinceEpoch();
-        }
+    // Get list of media files, never including our own thumbnails
+    QStringList excluded{m_thumbnailsDir};
+    for (const QString& root : m_db->rootFolders()) {
+        excluded << QDir(root).filePath("thumbnails");
     }
+    QVector<DirectoryWalker::Entry> entries = Scanner::listMediaEntries(m_rootDir, excluded, m_token.flag());
     
-    return 0;
-}
-
-void ScannerWorker::process() {
-    ScanResult result;
+    // A partial listing must not mark the rest of the root missing
+    if (m_token.isCancelled()) {
+        result.cancelled = true;
+        emit finished(result);
+        return;
+    }
     
-    // Get list of media files
-    QStringList files = Scanner::listMediaFiles(m_rootDir);
+    QStringList files;
+    files.reserve(entries.size());
+    for (const DirectoryWalker::Entry& entry : std::as_const(entries)) {
+        files.append(entry.path);
+    }
     
-    // Mark missing files as deleted
-    try {
-        m_db->markMissingFilesDeleted(files, m_rootDir);
-    } catch (...) {}
+    // Mark missing files as deleted; wait so they can be matched below
+    if (!waitUnlessCancelled(m_db->markMissingFilesDeleted(files, m_rootDir), m_token)) {
+        result.cancelled = true;
+        emit finished(result);
+        return;
+    }
     
     int total = files.size();
     
     // Get existing media map for incremental scanning
     auto existingMap = m_db->existingMediaMapForRoot(m_rootDir);
     
+    // Missing records by size: a new path with the same size and sha256
+    // is the same file renamed or moved, and takes over the old record
+    QMultiHash<qint64, MediaRecord> missingBySize;
+    for (const MediaRecord& missing : m_db->missingMediaForRoot(m_rootDir)) {
+        missingBySize.insert(missing.sizeBytes.value_or(-1), missing);
+    }
+    
+    // Records built this scan, by the file they were read from
+    QHash<FileIdentity, MediaRecord> processedFiles;
+    
     QDir().mkpath(m_thumbnailsDir);
     
-    for (int idx = 0; idx < total && !m_cancelled; ++idx) {
-        const QString& filePath = files[idx];
-        emit progress(idx + 1, total, filePath);
+    // Upserts are group-committed by the writer thread; keep their futures
+    // so the result can count them without waiting on every row
+    QList<QFuture<qint64>> pendingWrites;
+    auto collectWrites = [&](bool waitForAll) {
+        while (!pendingWrites.isEmpty()) {
+            QFuture<qint64>& write = pendingWrites.first();
+            if (!waitForAll && !write.isFinished()) break;
+            if (writeResult(write).value_or(0) > 0) {
+                result.addedOrUpdated++;
+            }
+            pendingWrites.removeFirst();
+        }
+    };
+    
+    // Store a failed file with its class, and for unreadable files a retry
+    // time that doubles with every consecutive failure
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    auto recordFailure = [&](MediaRecord record, MediaError errorClass, const QString& message) {
+        auto prev = existingMap.constFind(record.filePath);
+        record.errorClass = errorClass;
+        record.error = message;
+        record.failureCount = 1;
+        if (prev != existingMap.constEnd() && prev->value("error_class").toInt() == int(errorClass)) {
+            record.failureCount = prev->value("failure_count").toInt() + 1;
+        }
+        if (errorClass == MediaError::Unreadable) {
+            qint64 delay = RetryBaseSecs << qMin(record.failureCount - 1, 16);
+            record.retryAfterUtc = now + qMin(delay, RetryMaxSecs);
+        }
+        
+        m_db->upsertMedia(record);
+        result.errors++;
+        result.failures.append({record.filePath, message});
+    };
+    
+    // Files are visited in directory order, except that hinted ones are
+    // taken first: the files on screen, then the folder being browsed
+    QVector<bool> visited(total, false);
+    QHash<QString, int> indexOfPath;
+    QVector<int> visibleQueue;
+    QVector<int> folderQueue;
+    QString hintedFolder;
+    int visibleNext = 0, folderNext = 0, sequentialNext = 0;
+    
+    auto takeHints = [&]() {
+        QStringList paths;
+        QString folder;
+        {
+            QMutexLocker locker(&m_hints->mutex);
+            paths.swap(m_hints->paths);
+            folder = m_hints->folder;
+            m_hints->pending.store(false, std::memory_order_relaxed);
+        }
+        
+        if (indexOfPath.isEmpty()) {
+            indexOfPath.reserve(total);
+            for (int i = 0; i < total; ++i) {
+                indexOfPath.insert(entries[i].path, i);
+            }
+        }
+        
+        // Only what is on screen now matters, so newer hints replace older
+        visibleQueue.clear();
+        visibleNext = 0;
+        for (const QString& path : std::as_const(paths)) {
+            int i = indexOfPath.value(path, -1);
+            if (i >= 0 && !visited[i]) visibleQueue.append(i);
+        }
+        
+        // Browsing the scanned root itself is plain directory order
+        if (folder != hintedFolder) {
+            hintedFolder = folder;
+            folderQueue.clear();
+            folderNext = 0;
+            if (!folder.isEmpty() && folder != m_rootDir) {
+                const QString prefix = folder + '/';
+                for (int i = sequentialNext; i < total; ++i) {
+                    if (!visited[i] && entries[i].path.startsWith(prefix)) folderQueue.append(i);
+                }
+            }
+        }
+    };
+    
+    auto nextIndex = [&]() -> int {
+        if (m_hints->pending.load(std::memory_order_acquire)) takeHints();
+        while (visibleNext < visibleQueue.size()) {
+            int i = visibleQueue[visibleNext++];
+            if (!visited[i]) return i;
+        }
+        while (folderNext < folderQueue.size()) {
+            int i = folderQueue[folderNext++];
+            if (!visited[i]) return i;
+        }
+        while (visited[sequentialNext]) ++sequentialNext;
+        return sequentialNext;
+    };
+    
+    for (int done = 0; done < total && !m_token.isCancelled(); ++done) {
+        const int idx = nextIndex();
+        visited[idx] = true;
+        const DirectoryWalker::Entry& entry = entries[idx];
+        const QString& filePath = entry.path;
+        emit progress(done + 1, total, filePath);
         
         QFileInfo fi(filePath);
         QString fileName = fi.fileName();
-        QString ext = fi.suffix().toLower();
-        ext = "." + ext;
+        MediaType mediaType = MediaTypes::classify(fileName);
         
         try {
-            qint64 sizeBytes = fi.size();
-            qint64 modifiedTimeUtc = fi.lastModified().toSecsSinceEpoch();
+            // The walker already read size and time
+            qint64 sizeBytes = entry.size;
+            qint64 modifiedTimeUtc = entry.modifiedTime;
+            std::optional<qint64> quickHash;
             
             // Check if we can skip this file
             if (existingMap.contains(filePath)) {
                 auto& prev = existingMap[filePath];
-                if (prev["size_bytes"].toLongLong() == sizeBytes &&
+                
+                // Known failures wait for the file to change, or for their
+                // backoff to run out if the failure may be transient
+                MediaError prevError = MediaError(prev["error_class"].toInt());
+                if (prevError != MediaError::None &&
+                    prev["size_bytes"].toLongLong() == sizeBytes &&
+                    prev["modified_time_utc"].toLongLong() == modifiedTimeUtc &&
+                    (prevError == MediaError::Undecodable || prev["retry_after_utc"].toLongLong() > now)) {
+                    result.skipped.append({filePath, prev["error"].toString(), prevError});
+                    result.scanned++;
+                    continue;
+                }
+                
+                if (prevError == MediaError::None &&
+                    prev["size_bytes"].toLongLong() == sizeBytes &&
                     prev["modified_time_utc"].toLongLong() == modifiedTimeUtc &&
                     !prev["sha256"].toString().isEmpty()) {
                     
-                    // Check if thumbnail exists
+                    // Videos stored before durations were recorded get
+                    // them from the container header
+                    if (mediaType == MediaType::Video && prev["duration_ms"].isNull()) {
+                        auto metadata = VideoMetadata::read(filePath);
+                        if (metadata && metadata->durationMs) {
+                            m_db->updateVideoMetadata(filePath, *metadata->durationMs, metadata->creationTimeUtc);
+                        }
+                    }
+                    
+                    // Check if thumbnail exists; a metadata-first scan
+                    // leaves missing ones to ThumbnailGenerator
                     QString existingThumb = prev["thumbnail_path"].toString();
-                    if (!existingThumb.isEmpty() && QFile::exists(existingThumb)) {
+                    if ((!existingThumb.isEmpty() && QFile::exists(existingThumb)) || m_metadataFirst) {
                         result.scanned++;
                         continue;
                     }
@@ -263,49 +451,178 @@ void ScannerWorker::process() {
                     QString sha256 = prev["sha256"].toString();
                     QString thumbPath = QDir(m_thumbnailsDir).filePath(sha256 + ".jpg");
                     
+                    bool needsThumb = mediaType == MediaType::Image || mediaType == MediaType::Video;
                     bool thumbCreated = false;
-                    if (Scanner::isImageFile(filePath)) {
-                        thumbCreated = createImageThumbnail(filePath, thumbPath);
-                    } else if (Scanner::isVideoFile(filePath)) {
-                        thumbCreated = createVideoThumbnail(filePath, thumbPath);
+                    if (mediaType == MediaType::Image) {
+                        thumbCreated = ThumbnailGenerator::writeImageThumbnail(filePath, thumbPath,
+                                                                               ThumbnailGenerator::DefaultSize, &m_token);
+                    } else if (mediaType == MediaType::Video) {
+                        thumbCreated = ThumbnailGenerator::writeVideoThumbnail(filePath, thumbPath);
                     }
                     
-                    if (thumbCreated && thumbPath != existingThumb) {
-                        m_db->updateThumbnailPath(filePath, thumbPath);
+                    // A file that cannot be thumbnailed goes through full
+                    // processing once, which records it as a failure
+                    if (thumbCreated || !needsThumb) {
+                        if (thumbCreated && thumbPath != existingThumb) {
+                            m_db->updateThumbnailPath(filePath, thumbPath);
+                        }
+                        if (thumbCreated) {
+                            emit thumbnailReady(filePath, thumbPath);
+                        }
+                        result.scanned++;
+                        continue;
                     }
-                    
+                }
+                
+                // Same size, new mtime: if the quick hash still matches only
+                // the timestamp moved, so the stored digest, pHash and
+                // thumbnail stay valid. An unchanged file only gets here when
+                // its thumbnail could not be rebuilt, and must go on to be
+                // recorded as a failure rather than be decoded every scan.
+                if (prevError == MediaError::None && prev["size_bytes"].toLongLong() == sizeBytes &&
+                    prev["modified_time_utc"].toLongLong() != modifiedTimeUtc &&
+                    !prev["sha256"].toString().isEmpty() && !prev["quick_hash"].isNull()) {
+                    quickHash = computeQuickHash(filePath);
+                    if (quickHash && *quickHash == prev["quick_hash"].toLongLong()) {
+                        m_db->updateModifiedTime(filePath, modifiedTimeUtc);
+                        result.scanned++;
+                        continue;
+                    }
+                }
+            }
+            
+            // Full processing for new or changed files, unless another
+            // link to the same file was processed already
+            std::optional<FileIdentity> identity = entry.inode != 0
+                ? std::optional<FileIdentity>(FileIdentity{entry.device, entry.inode, entry.size, entry.modifiedTime})
+                : fileIdentity(filePath);
+            auto linked = identity ? processedFiles.constFind(*identity) : processedFiles.constEnd();
+            const bool isLinked = linked != processedFiles.constEnd();
+            
+            // The quick hash reads a few hundred KB, so it runs first: it
+            // narrows the move candidates and catches unreadable files
+            // before the digest reads the whole file
+            if (!quickHash) {
+                quickHash = isLinked ? linked->quickHash : computeQuickHash(filePath);
+            }
+            
+            QVector<QMultiHash<qint64, MediaRecord>::iterator> moveCandidates;
+            if (!existingMap.contains(filePath)) {
+                auto it = missingBySize.find(sizeBytes);
+                for (; it != missingBySize.end() && it.key() == sizeBytes; ++it) {
+                    if (it->quickHash && quickHash && *it->quickHash != *quickHash) continue;
+                    moveCandidates.append(it);
+                }
+            }
+            
+            QString sha256;
+            if (isLinked) {
+                sha256 = linked->sha256;
+            } else if (quickHash) {
+                sha256 = computeSha256(filePath);
+            }
+            
+            // An interrupted hash is not a read failure
+            if (m_token.isCancelled()) break;
+            
+            if (sha256.isEmpty()) {
+                MediaRecord record;
+                record.filePath = filePath;
+                record.rootDir = m_rootDir;
+                record.fileName = fileName;
+                record.sizeBytes = sizeBytes;
+                record.modifiedTimeUtc = modifiedTimeUtc;
+                record.mediaType = mediaType;
+                recordFailure(record, MediaError::Unreadable, "Could not read file");
+                result.scanned++;
+                continue;
+            }
+            
+            // Only candidates that passed the quick hash compare digests
+            if (!moveCandidates.isEmpty()) {
+                qint64 movedId = 0;
+                for (auto it : std::as_const(moveCandidates)) {
+                    if (it->sha256 == sha256) {
+                        movedId = it->id;
+                        missingBySize.erase(it);
+                        break;
+                    }
+                }
+                if (movedId != 0) {
+                    pendingWrites.append(m_db->relocateMedia(movedId, filePath, m_rootDir, modifiedTimeUtc));
+                    collectWrites(false);
+                    result.moved++;
                     result.scanned++;
                     continue;
                 }
             }
             
-            // Full processing for new or changed files
-            QString sha256 = computeSha256(filePath);
+            if (isLinked) {
+                MediaRecord record = *linked;
+                record.filePath = filePath;
+                record.fileName = fileName;
+                
+                pendingWrites.append(m_db->upsertMedia(record));
+                collectWrites(false);
+                result.scanned++;
+                continue;
+            }
+            
             QString pHash;
             int width = 0, height = 0;
             qint64 capturedTime = 0;
+            std::optional<qint64> durationMs;
             QString thumbPath = QDir(m_thumbnailsDir).filePath(sha256 + ".jpg");
-            
-            MediaType mediaType = MediaRecord::typeFromExtension(ext);
+            QString decodeError;
             
             if (mediaType == MediaType::Image) {
-                pHash = computeImagePHash(filePath);
-                auto dims = getImageDimensions(filePath);
-                width = dims.first;
-                height = dims.second;
-                capturedTime = getImageCaptureTime(filePath);
+                std::optional<ImageMetadata> metadata = ImageMetadata::read(filePath);
+                if (metadata) {
+                    width = metadata->width;
+                    height = metadata->height;
+                    capturedTime = metadata->capturedTimeUtc.value_or(0);
+                } else {
+                    // Formats the header parser does not know, such as AVIF
+                    QSize size = QImageReader(filePath).size();
+                    if (size.isValid()) {
+                        width = size.width();
+                        height = size.height();
+                    }
+                }
+                pHash = computeImagePHash(filePath, metadata);
                 
-                if (!QFile::exists(thumbPath)) {
-                    createImageThumbnail(filePath, thumbPath);
+                if (pHash.isEmpty() && width == 0 && height == 0) {
+                    decodeError = "Could not decode image";
+                    thumbPath.clear();
+                } else if (!QFile::exists(thumbPath)) {
+                    // Metadata-first scans leave thumbnails to ThumbnailGenerator
+                    if (m_metadataFirst) {
+                        thumbPath.clear();
+                    } else if (!ThumbnailGenerator::writeImageThumbnail(filePath, thumbPath,
+                                                                        ThumbnailGenerator::DefaultSize, &m_token)) {
+                        decodeError = "Could not create thumbnail";
+                        thumbPath.clear();
+                    }
                 }
             } else if (mediaType == MediaType::Video) {
-                auto dims = getVideoDimensions(filePath);
-                width = dims.first;
-                height = dims.second;
+                if (auto metadata = VideoMetadata::read(filePath)) {
+                    width = metadata->width;
+                    height = metadata->height;
+                    durationMs = metadata->durationMs;
+                    capturedTime = metadata->creationTimeUtc.value_or(0);
+                } else {
+                    // Containers the header parser does not know, such as ASF
+                    auto dims = getVideoDimensions(filePath);
+                    width = dims.first;
+                    height = dims.second;
+                }
                 
                 if (!QFile::exists(thumbPath)) {
-                    if (!createVideoThumbnail(filePath, thumbPath)) {
+                    if (m_metadataFirst) {
                         thumbPath.clear();
+                    } else if (!ThumbnailGenerator::writeVideoThumbnail(filePath, thumbPath)) {
+                        thumbPath.clear();
+                        decodeError = "Could not decode video";
                     }
                 }
             } else {
@@ -313,6 +630,9 @@ void ScannerWorker::process() {
                 thumbPath.clear();
             }
             
+            // Stages cut short by cancellation are not decode failures
+            if (m_token.isCancelled()) break;
+            
             MediaRecord record;
             record.filePath = filePath;
             record.rootDir = m_rootDir;
@@ -326,10 +646,26 @@ void ScannerWorker::process() {
             record.modifiedTimeUtc = modifiedTimeUtc;
             record.mediaType = mediaType;
             record.thumbnailPath = thumbPath;
+            record.quickHash = quickHash;
+            record.durationMs = durationMs;
             
-            qint64 mediaId = m_db->upsertMedia(record);
-            if (mediaId > 0) {
-                result.addedOrUpdated++;
+            // Keep the digest of undecodable files so moves are still found
+            if (!decodeError.isEmpty()) {
+                recordFailure(record, MediaError::Undecodable, decodeError);
+                result.scanned++;
+                continue;
+            }
+            
+            if (identity) {
+                processedFiles.insert(*identity, record);
+            }
+            
+            pendingWrites.append(m_db->upsertMedia(record));
+            collectWrites(false);
+            
+            // Rows already in the gallery can show a changed file's thumbnail
+            if (!thumbPath.isEmpty() && existingMap.contains(filePath)) {
+                emit thumbnailReady(filePath, thumbPath);
             }
             
         } catch (const std::exception& e) {
@@ -340,16 +676,25 @@ void ScannerWorker::process() {
             errorRecord.filePath = filePath;
             errorRecord.rootDir = m_rootDir;
             errorRecord.fileName = fileName;
-            errorRecord.mediaType = MediaRecord::typeFromExtension(ext);
-            errorRecord.error = QString::fromStdString(e.what());
-            m_db->upsertMedia(errorRecord);
-            
-            result.errors++;
+            errorRecord.sizeBytes = entry.size;
+            errorRecord.modifiedTimeUtc = entry.modifiedTime;
+            errorRecord.mediaType = mediaType;
+            recordFailure(errorRecord, MediaError::Undecodable, QString::fromStdString(e.what()));
         }
         
         result.scanned++;
     }
     
+    // Make sure everything we queued is committed before reporting back.
+    // A cancelled scan does not wait: its queued writes still commit.
+    result.cancelled = m_token.isCancelled();
+    if (!result.cancelled && waitUnlessCancelled(m_db->flush(), m_token)) {
+        collectWrites(true);
+    } else {
+        result.cancelled = true;
+        collectWrites(false);
+    }
+    
     emit finished(result);
 }
 
@@ -362,20 +707,23 @@ Scanner::Scanner(Database* db, QObject* parent)
 }
 
 Scanner::~Scanner() {
-    cancel();
+    cancelAndWait();
 }
 
 void Scanner::scanDirectory(const QString& rootDir, const QString& thumbnailsDir) {
     if (isRunning()) {
-        cancel();
+        cancelAndWait();
     }
     
     m_workerThread = new QThread(this);
-    m_worker = new ScannerWorker(m_db, rootDir, thumbnailsDir);
+    m_hints = std::make_shared<ScanHints>();
+    m_worker = new ScannerWorker(m_db, rootDir, thumbnailsDir, m_hints);
+    m_worker->setMetadataFirst(m_metadataFirst);
     m_worker->moveToThread(m_workerThread);
     
     connect(m_workerThread, &QThread::started, m_worker, &ScannerWorker::process);
     connect(m_worker, &ScannerWorker::progress, this, &Scanner::scanProgress);
+    connect(m_worker, &ScannerWorker::thumbnailReady, this, &Scanner::thumbnailReady);
     connect(m_worker, &ScannerWorker::finished, this, [this](ScanResult result) {
         emit scanFinished(result);
         m_workerThread->quit();
@@ -395,49 +743,74 @@ void Scanner::cancel() {
     if (m_worker) {
         m_worker->cancel();
     }
-    if (m_workerThread) {
-        m_workerThread->quit();
-        m_workerThread->wait(5000);
-    }
+}
+
+void Scanner::cancelAndWait() {
+    cancel();
+    if (!m_workerThread) return;
+    
+    m_workerThread->quit();
+    if (m_workerThread->wait(QDeadlineTimer(CancelWaitMs))) return;
+    
+    // A decode that ignores cancellation must not hang the GUI thread.
+    // Leave the worker to finish on its own: quit() above ends the thread
+    // once process() returns, and both then delete themselves.
+    qWarning() << "Scan worker did not stop within" << CancelWaitMs << "ms, detaching it";
+    disconnect(m_worker, nullptr, this, nullptr);
+    disconnect(m_workerThread, nullptr, this, nullptr);
+    m_workerThread->setParent(nullptr);
+    m_worker = nullptr;
+    m_workerThread = nullptr;
+    m_hints.reset();
 }
 
 bool Scanner::isRunning() const {
     return m_workerThread && m_workerThread->isRunning();
 }
 
-QStringList Scanner::listMediaFiles(const QString& rootDir) {
-    QStringList files;
-    QString absRoot = QDir(rootDir).absolutePath();
+void Scanner::setMetadataFirst(bool enabled) {
+    m_metadataFirst = enabled;
+}
+
+bool Scanner::metadataFirst() const {
+    return m_metadataFirst;
+}
+
+void Scanner::prioritize(const QStringList& filePaths, const QString& folder) {
+    if (!isRunning() || !m_hints) return;
     
-    QDirIterator it(absRoot, QDir::Files, QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        QString path = it.next();
-        QString ext = QFileInfo(path).suffix().toLower();
-        ext = "." + ext;
-        
-        if (IMAGE_EXTENSIONS.contains(ext) || 
-            VIDEO_EXTENSIONS.contains(ext) || 
-            AUDIO_EXTENSIONS.contains(ext)) {
-            files.append(path);
-        }
+    QMutexLocker locker(&m_hints->mutex);
+    m_hints->paths = filePaths;
+    m_hints->folder = folder.isEmpty() ? QString() : QDir(folder).absolutePath();
+    m_hints->pending.store(true, std::memory_order_release);
+}
+
+QStringList Scanner::listMediaFiles(const QString& rootDir, const QStringList& excludedPaths) {
+    QStringList files;
+    for (const DirectoryWalker::Entry& entry : listMediaEntries(rootDir, excludedPaths)) {
+        files.append(entry.path);
     }
-    
     return files;
 }
 
+QVector<DirectoryWalker::Entry> Scanner::listMediaEntries(const QString& rootDir, const QStringList& excludedPaths,
+                                                          const std::atomic<bool>* cancelled) {
+    DirectoryWalker walker([](const QString& fileName) {
+        return MediaTypes::formatOf(fileName) != MediaTypes::Format::None;
+    });
+    return walker.walk(rootDir, IgnoreRules(excludedPaths), cancelled);
+}
+
 bool Scanner::isImageFile(const QString& path) {
-    QString ext = "." + QFileInfo(path).suffix().toLower();
-    return IMAGE_EXTENSIONS.contains(ext);
+    return MediaTypes::classify(path) == MediaType::Image;
 }
 
 bool Scanner::isVideoFile(const QString& path) {
-    QString ext = "." + QFileInfo(path).suffix().toLower();
-    return VIDEO_EXTENSIONS.contains(ext);
+    return MediaTypes::classify(path) == MediaType::Video;
 }
 
 bool Scanner::isAudioFile(const QString& path) {
-    QString ext = "." + QFileInfo(path).suffix().toLower();
-    return AUDIO_EXTENSIONS.contains(ext);
+    return MediaTypes::classify(path) == MediaType::Audio;
 }
 
 } // namespace KeyTagger
@@ -3,17 +3,46 @@
 #include <QObject>
 #include <QString>
 #include <QStringList>
+#include <QVector>
+#include <QPair>
 #include <QThread>
+#include <QMutex>
 #include <atomic>
+#include <memory>
+#include <optional>
+#include "DirectoryWalker.h"
+#include "ImageMetadata.h"
+#include "MediaRecord.h"
+#include "CancellationToken.h"
 
 namespace KeyTagger {
 
 class Database;
 
+// A known failure left alone by a scan, with what was stored for it
+struct SkippedFailure {
+    QString path;
+    QString error;
+    MediaError errorClass = MediaError::None;
+};
+
 struct ScanResult {
     int scanned = 0;
     int addedOrUpdated = 0;
+    int moved = 0;
+    QVector<SkippedFailure> skipped;            // Known failures not retried yet
+    QVector<QPair<QString, QString>> failures;  // Path and message, this scan only
     int errors = 0;
+    bool cancelled = false;                     // Stopped early; counts cover the files done
+};
+
+// Priority hints from the GUI. Shared between Scanner and its worker so
+// hints can be posted without touching a worker that may be exiting.
+struct ScanHints {
+    QMutex mutex;
+    QStringList paths;                      // Files on screen, replaced by each hint
+    QString folder;                         // Folder being browsed, empty for none
+    std::atomic<bool> pending{false};       // Set when either changed
 };
 
 class ScannerWorker : public QObject {
@@ -21,7 +50,11 @@ class ScannerWorker : public QObject {
 
 public:
     explicit ScannerWorker(Database* db, const QString& rootDir, 
-                           const QString& thumbnailsDir, QObject* parent = nullptr);
+                           const QString& thumbnailsDir, std::shared_ptr<ScanHints> hints,
+                           QObject* parent = nullptr);
+
+    // Store records without writing thumbnails; call before process()
+    void setMetadataFirst(bool enabled);
 
 public slots:
     void process();
@@ -29,22 +62,30 @@ public slots:
 
 signals:
     void progress(int current, int total, const QString& currentFile);
+    void thumbnailReady(const QString& filePath, const QString& thumbnailPath);
     void finished(ScanResult result);
     void error(const QString& message);
 
 private:
     QString computeSha256(const QString& filePath);
-    QString computeImagePHash(const QString& filePath);
-    bool createImageThumbnail(const QString& sourcePath, const QString& destPath, int maxSize = 512);
-    bool createVideoThumbnail(const QString& sourcePath, const QString& destPath, int maxSize = 512);
-    QPair<int, int> getImageDimensions(const QString& filePath);
+    std::optional<qint64> computeQuickHash(const QString& filePath);
+    QString computeImagePHash(const QString& filePath, const std::optional<ImageMetadata>& metadata);
     QPair<int, int> getVideoDimensions(const QString& filePath);
-    qint64 getImageCaptureTime(const QString& filePath);
+
+    // Backoff for unreadable files: 15 minutes, doubling up to a week
+    static constexpr qint64 RetryBaseSecs = 15 * 60;
+    static constexpr qint64 RetryMaxSecs = 7 * 24 * 60 * 60;
+    // Frames above this are read reduced for the perceptual hash
+    static constexpr qint64 ReducedPHashPixels = 24 * 1000 * 1000;
+    // Edge such frames are reduced to when the codec cannot do it itself
+    static constexpr int ReducedPHashEdge = 256;
 
     Database* m_db;
     QString m_rootDir;
     QString m_thumbnailsDir;
-    std::atomic<bool> m_cancelled{false};
+    CancellationToken m_token;
+    std::shared_ptr<ScanHints> m_hints;
+    bool m_metadataFirst = false;
 };
 
 class Scanner : public QObject {
@@ -55,16 +96,39 @@ public:
     ~Scanner();
 
     void scanDirectory(const QString& rootDir, const QString& thumbnailsDir = QString());
+    // Returns at once; scanFinished follows with result.cancelled set once
+    // the worker has stopped, typically within a file's current hash chunk
     void cancel();
+    // Cancel and block until the worker thread has exited, or detach it
+    // with a warning if it has not stopped within CancelWaitMs
+    void cancelAndWait();
     bool isRunning() const;
 
-    static QStringList listMediaFiles(const QString& rootDir);
+    // Move files to the front of the running scan's queue: filePaths are
+    // the files on screen without a thumbnail and replace earlier hints,
+    // folder is the one being browsed. No-op when no scan is running.
+    void prioritize(const QStringList& filePaths, const QString& folder = QString());
+
+    // Metadata-first scans record hashes, dimensions and times but write no
+    // thumbnails, leaving them to ThumbnailGenerator. Applies to the next scan.
+    void setMetadataFirst(bool enabled);
+    bool metadataFirst() const;
+
+    // Media below rootDir, honouring IgnoreRules; excludedPaths are
+    // folders to skip entirely
+    static QStringList listMediaFiles(const QString& rootDir, const QStringList& excludedPaths = {});
+    // Same files with their size, time and inode, read in parallel
+    static QVector<DirectoryWalker::Entry> listMediaEntries(const QString& rootDir,
+                                                            const QStringList& excludedPaths = {},
+                                                            const std::atomic<bool>* cancelled = nullptr);
     static bool isImageFile(const QString& path);
     static bool isVideoFile(const QString& path);
     static bool isAudioFile(const QString& path);
 
 signals:
     void scanProgress(int current, int total, const QString& currentFile);
+    // A thumbnail was written for a file already in the database
+    void thumbnailReady(const QString& filePath, const QString& thumbnailPath);
     void scanFinished(ScanResult result);
     void scanError(const QString& message);
 
@@ -72,6 +136,10 @@ private:
     Database* m_db;
     QThread* m_workerThread = nullptr;
     ScannerWorker* m_worker = nullptr;
+    std::shared_ptr<ScanHints> m_hints;
+    bool m_metadataFirst = false;
+
+    static constexpr int CancelWaitMs = 5000;
 };
 
 } // namespace KeyTagger
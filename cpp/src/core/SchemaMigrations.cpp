@@ -0,0 +1,380 @@
+#include "SchemaMigrations.h"
+#include "MediaRecord.h"
+#include "DirectoryCache.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QStringList>
+#include <QHash>
+#include <QPair>
+#include <QElapsedTimer>
+#include <QDebug>
+
+namespace KeyTagger {
+
+namespace {
+
+bool execAll(QSqlDatabase& db, const QStringList& statements) {
+    QSqlQuery query(db);
+    for (const QString& sql : statements) {
+        if (!query.exec(sql)) {
+            qWarning() << "Migration statement failed:" << query.lastError().text() << "\n" << sql;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Drop every trigger; Database recreates the current ones after migrating
+bool dropTriggers(QSqlDatabase& db) {
+    QSqlQuery query(db);
+    QStringList names;
+    if (!query.exec("SELECT name FROM sqlite_master WHERE type = 'trigger'")) {
+        return false;
+    }
+    while (query.next()) {
+        names << query.value(0).toString();
+    }
+    query.finish();
+
+    QStringList statements;
+    for (const QString& name : names) {
+        statements << QString("DROP TRIGGER IF EXISTS \"%1\"").arg(name);
+    }
+    return execAll(db, statements);
+}
+
+} // namespace
+
+const QVector<SchemaMigrations::Migration>& SchemaMigrations::migrations() {
+    static const QVector<Migration> list = {
+        {1, "base schema", &SchemaMigrations::createBaseSchema},
+        {2, "integer encodings, roots table, WITHOUT ROWID media_tags", &SchemaMigrations::compactEncodings},
+        {3, "directories table, media paths as (dir_id, file_name)", &SchemaMigrations::normalizeDirectories},
+        {4, "thumbnail paths relative to their root", &SchemaMigrations::relativeThumbnails},
+        {5, "quick_hash column", &SchemaMigrations::addQuickHash},
+        {6, "failure class and retry backoff columns", &SchemaMigrations::addFailureTracking},
+        {7, "duration_ms column", &SchemaMigrations::addDuration},
+    };
+    return list;
+}
+
+int SchemaMigrations::version(QSqlDatabase& db) {
+    QSqlQuery query(db);
+    if (query.exec("PRAGMA user_version") && query.next()) {
+        return query.value(0).toInt();
+    }
+    return 0;
+}
+
+bool SchemaMigrations::migrate(QSqlDatabase& db, bool* changed) {
+    if (changed) *changed = false;
+
+    int current = version(db);
+    if (current > CurrentVersion) {
+        qWarning() << "Database schema version" << current << "is newer than this build supports ("
+                   << CurrentVersion << ")";
+        return false;
+    }
+
+    QSqlQuery query(db);
+    for (const Migration& migration : migrations()) {
+        if (migration.version <= current) continue;
+
+        QElapsedTimer timer;
+        timer.start();
+
+        query.exec("SAVEPOINT schema_migration");
+        if (!migration.apply(db)) {
+            qWarning() << "Schema migration to version" << migration.version << "failed:" << migration.description;
+            query.exec("ROLLBACK TO schema_migration");
+            query.exec("RELEASE schema_migration");
+            return false;
+        }
+        query.exec(QString("PRAGMA user_version = %1").arg(migration.version));
+        query.exec("RELEASE schema_migration");
+
+        qDebug() << "Schema migrated to version" << migration.version << "(" << migration.description << ") in"
+                 << timer.elapsed() << "ms";
+        current = migration.version;
+        if (changed) *changed = true;
+    }
+
+    return true;
+}
+
+bool SchemaMigrations::createBaseSchema(QSqlDatabase& db) {
+    // Databases written by the Python version already have these tables
+    return execAll(db, {
+        R"(
+            CREATE TABLE IF NOT EXISTS media (
+                id INTEGER PRIMARY KEY,
+                file_path TEXT NOT NULL UNIQUE,
+                root_dir TEXT NOT NULL,
+                file_name TEXT NOT NULL,
+                sha256 TEXT,
+                p_hash TEXT,
+                width INTEGER,
+                height INTEGER,
+                size_bytes INTEGER,
+                captured_time_utc INTEGER,
+                modified_time_utc INTEGER,
+                media_type TEXT NOT NULL,
+                thumbnail_path TEXT,
+                status TEXT NOT NULL DEFAULT 'active',
+                error TEXT
+            )
+        )",
+        "CREATE INDEX IF NOT EXISTS idx_media_sha256 ON media(sha256)",
+        "CREATE INDEX IF NOT EXISTS idx_media_phash ON media(p_hash)",
+        "CREATE INDEX IF NOT EXISTS idx_media_file_path ON media(file_path)",
+        "CREATE INDEX IF NOT EXISTS idx_media_modified ON media(modified_time_utc)",
+        "CREATE INDEX IF NOT EXISTS idx_media_root_dir ON media(root_dir)",
+        R"(
+            CREATE TABLE IF NOT EXISTS tags (
+                id INTEGER PRIMARY KEY,
+                name TEXT NOT NULL UNIQUE
+            )
+        )",
+        R"(
+            CREATE TABLE IF NOT EXISTS media_tags (
+                media_id INTEGER NOT NULL,
+                tag_id INTEGER NOT NULL,
+                PRIMARY KEY (media_id, tag_id),
+                FOREIGN KEY (media_id) REFERENCES media(id) ON DELETE CASCADE,
+                FOREIGN KEY (tag_id) REFERENCES tags(id) ON DELETE CASCADE
+            )
+        )",
+        "CREATE INDEX IF NOT EXISTS idx_media_tags_media_id ON media_tags(media_id)",
+        "CREATE INDEX IF NOT EXISTS idx_media_tags_tag_id ON media_tags(tag_id)",
+    });
+}
+
+bool SchemaMigrations::compactEncodings(QSqlDatabase& db) {
+    // The summary and FTS triggers read the TEXT columns being replaced
+    if (!dropTriggers(db)) return false;
+
+    auto typeCase = [](MediaType type) {
+        return QString("WHEN '%1' THEN %2").arg(MediaRecord::mediaTypeToString(type)).arg(int(type));
+    };
+    QString mediaTypeSql = QString("CASE lower(m.media_type) %1 %2 %3 ELSE %4 END")
+        .arg(typeCase(MediaType::Image), typeCase(MediaType::Video), typeCase(MediaType::Audio))
+        .arg(int(MediaType::Unknown));
+    QString statusSql = QString("CASE m.status WHEN 'active' THEN %1 ELSE %2 END")
+        .arg(int(MediaStatus::Active)).arg(int(MediaStatus::Deleted));
+
+    bool ok = execAll(db, {
+        R"(
+            CREATE TABLE roots (
+                id INTEGER PRIMARY KEY,
+                path TEXT NOT NULL UNIQUE
+            )
+        )",
+        "INSERT INTO roots(path) SELECT DISTINCT root_dir FROM media",
+        R"(
+            CREATE TABLE media_v2 (
+                id INTEGER PRIMARY KEY,
+                root_id INTEGER NOT NULL REFERENCES roots(id),
+                file_path TEXT NOT NULL UNIQUE,
+                file_name TEXT NOT NULL,
+                sha256 TEXT,
+                p_hash INTEGER,
+                width INTEGER,
+                height INTEGER,
+                size_bytes INTEGER,
+                captured_time_utc INTEGER,
+                modified_time_utc INTEGER,
+                media_type INTEGER NOT NULL,
+                thumbnail_path TEXT,
+                status INTEGER NOT NULL DEFAULT 0,
+                error TEXT
+            )
+        )",
+        QString(R"(
+            INSERT INTO media_v2 (
+                id, root_id, file_path, file_name, sha256, width, height, size_bytes,
+                captured_time_utc, modified_time_utc, media_type, thumbnail_path, status, error
+            )
+            SELECT m.id, r.id, m.file_path, m.file_name, m.sha256, m.width, m.height, m.size_bytes,
+                   m.captured_time_utc, m.modified_time_utc, %1, m.thumbnail_path, %2, m.error
+            FROM media m JOIN roots r ON r.path = m.root_dir
+        )").arg(mediaTypeSql, statusSql),
+    });
+    if (!ok) return false;
+
+    // SQLite cannot parse hex, so convert the perceptual hashes here
+    QSqlQuery read(db);
+    read.setForwardOnly(true);
+    QSqlQuery write(db);
+    write.prepare("UPDATE media_v2 SET p_hash = ? WHERE id = ?");
+    if (!read.exec("SELECT id, p_hash FROM media WHERE p_hash IS NOT NULL AND p_hash <> ''")) {
+        return false;
+    }
+    while (read.next()) {
+        std::optional<qint64> hash = MediaRecord::pHashToInt(read.value(1).toString());
+        if (!hash) continue;
+        write.addBindValue(*hash);
+        write.addBindValue(read.value(0));
+        if (!write.exec()) return false;
+    }
+    read.finish();
+
+    // The UNIQUE constraints' autoindexes replace idx_media_file_path and
+    // idx_media_tags_media_id
+    return execAll(db, {
+        "DROP TABLE media",
+        "ALTER TABLE media_v2 RENAME TO media",
+        "CREATE INDEX idx_media_root ON media(root_id)",
+        "CREATE INDEX idx_media_sha256 ON media(sha256)",
+        "CREATE INDEX idx_media_phash ON media(p_hash)",
+        "CREATE INDEX idx_media_modified ON media(modified_time_utc)",
+        R"(
+            CREATE TABLE media_tags_v2 (
+                media_id INTEGER NOT NULL REFERENCES media(id) ON DELETE CASCADE,
+                tag_id INTEGER NOT NULL REFERENCES tags(id) ON DELETE CASCADE,
+                PRIMARY KEY (media_id, tag_id)
+            ) WITHOUT ROWID
+        )",
+        "INSERT OR IGNORE INTO media_tags_v2(media_id, tag_id) SELECT media_id, tag_id FROM media_tags",
+        "DROP TABLE media_tags",
+        "ALTER TABLE media_tags_v2 RENAME TO media_tags",
+        "CREATE INDEX idx_media_tags_tag_id ON media_tags(tag_id)",
+    });
+}
+
+bool SchemaMigrations::normalizeDirectories(QSqlDatabase& db) {
+    // The FTS triggers read file_path and root_id
+    if (!dropTriggers(db)) return false;
+
+    bool ok = execAll(db, {
+        R"(
+            CREATE TABLE directories (
+                id INTEGER PRIMARY KEY,
+                root_id INTEGER NOT NULL REFERENCES roots(id),
+                path TEXT NOT NULL,
+                UNIQUE (root_id, path)
+            )
+        )",
+        R"(
+            CREATE TABLE media_v3 (
+                id INTEGER PRIMARY KEY,
+                dir_id INTEGER NOT NULL REFERENCES directories(id),
+                file_name TEXT NOT NULL,
+                sha256 TEXT,
+                p_hash INTEGER,
+                width INTEGER,
+                height INTEGER,
+                size_bytes INTEGER,
+                captured_time_utc INTEGER,
+                modified_time_utc INTEGER,
+                media_type INTEGER NOT NULL,
+                thumbnail_path TEXT,
+                status INTEGER NOT NULL DEFAULT 0,
+                error TEXT,
+                UNIQUE (dir_id, file_name)
+            )
+        )",
+    });
+    if (!ok) return false;
+
+    // Split paths with the same rules the writer uses for new rows
+    QSqlQuery read(db);
+    read.setForwardOnly(true);
+    QSqlQuery insertRoot(db);
+    insertRoot.prepare("INSERT INTO roots(path) VALUES (?) ON CONFLICT(path) DO NOTHING");
+    QSqlQuery selectRoot(db);
+    selectRoot.prepare("SELECT id FROM roots WHERE path = ?");
+    QSqlQuery insertDir(db);
+    insertDir.prepare("INSERT INTO directories(root_id, path) VALUES (?, ?)");
+    QSqlQuery copy(db);
+    copy.prepare(R"(
+        INSERT INTO media_v3 (
+            id, dir_id, file_name, sha256, p_hash, width, height, size_bytes,
+            captured_time_utc, modified_time_utc, media_type, thumbnail_path, status, error
+        )
+        SELECT id, ?, ?, sha256, p_hash, width, height, size_bytes,
+               captured_time_utc, modified_time_utc, media_type, thumbnail_path, status, error
+        FROM media WHERE id = ?
+    )");
+
+    QHash<QString, qint64> rootIds;
+    QHash<QPair<qint64, QString>, qint64> dirIds;
+
+    if (!read.exec("SELECT m.id, m.file_path, r.path FROM media m JOIN roots r ON r.id = m.root_id")) {
+        return false;
+    }
+    while (read.next()) {
+        DirectoryCache::Location location =
+            DirectoryCache::splitPath(read.value(1).toString(), read.value(2).toString());
+
+        qint64 rootId = rootIds.value(location.rootPath, 0);
+        if (rootId == 0) {
+            insertRoot.addBindValue(location.rootPath);
+            selectRoot.addBindValue(location.rootPath);
+            if (!insertRoot.exec() || !selectRoot.exec() || !selectRoot.next()) return false;
+            rootId = selectRoot.value(0).toLongLong();
+            selectRoot.finish();
+            rootIds.insert(location.rootPath, rootId);
+        }
+
+        auto dirKey = qMakePair(rootId, location.directory);
+        qint64 dirId = dirIds.value(dirKey, 0);
+        if (dirId == 0) {
+            insertDir.addBindValue(rootId);
+            insertDir.addBindValue(location.directory);
+            if (!insertDir.exec()) return false;
+            dirId = insertDir.lastInsertId().toLongLong();
+            dirIds.insert(dirKey, dirId);
+        }
+
+        copy.addBindValue(dirId);
+        copy.addBindValue(location.fileName);
+        copy.addBindValue(read.value(0));
+        if (!copy.exec()) {
+            qWarning() << "Failed to move media" << read.value(1).toString() << ":" << copy.lastError().text();
+            return false;
+        }
+    }
+    read.finish();
+
+    // UNIQUE (dir_id, file_name) also serves per-folder lookups
+    return execAll(db, {
+        "DROP TABLE media",
+        "ALTER TABLE media_v3 RENAME TO media",
+        "CREATE INDEX idx_media_sha256 ON media(sha256)",
+        "CREATE INDEX idx_media_phash ON media(p_hash)",
+        "CREATE INDEX idx_media_modified ON media(modified_time_utc)",
+    });
+}
+
+bool SchemaMigrations::relativeThumbnails(QSqlDatabase& db) {
+    // Thumbnails live in <root>/thumbnails; strip "<root>/" so they follow a relink
+    const QString root = "(SELECT r.path FROM directories d JOIN roots r ON r.id = d.root_id "
+                         "WHERE d.id = media.dir_id)";
+    return execAll(db, {
+        QString(R"(
+            UPDATE media SET thumbnail_path = substr(thumbnail_path, length(%1) + 2)
+            WHERE substr(thumbnail_path, 1, length(%1) + 1) = %1 || '/'
+        )").arg(root),
+    });
+}
+
+bool SchemaMigrations::addQuickHash(QSqlDatabase& db) {
+    // Filled in as files are rescanned; NULL means "not known yet"
+    return execAll(db, {"ALTER TABLE media ADD COLUMN quick_hash INTEGER"});
+}
+
+bool SchemaMigrations::addFailureTracking(QSqlDatabase& db) {
+    // Older error rows get no class, so they are retried once and classified then
+    return execAll(db, {
+        "ALTER TABLE media ADD COLUMN error_class INTEGER NOT NULL DEFAULT 0",
+        "ALTER TABLE media ADD COLUMN failure_count INTEGER NOT NULL DEFAULT 0",
+        "ALTER TABLE media ADD COLUMN retry_after_utc INTEGER",
+    });
+}
+
+bool SchemaMigrations::addDuration(QSqlDatabase& db) {
+    // Existing videos are filled in from their headers on the next scan
+    return execAll(db, {"ALTER TABLE media ADD COLUMN duration_ms INTEGER"});
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QSqlDatabase>
+#include <QVector>
+
+namespace KeyTagger {
+
+/**
+ * SchemaMigrations - Versioned upgrades of the SQLite schema
+ *
+ * The schema version lives in PRAGMA user_version. Each migration moves
+ * the database from version N-1 to N inside its own savepoint, so a
+ * failing step leaves the file at the last good version. Triggers, the
+ * summary tables and the FTS index are derived objects and are (re)created
+ * by Database after migrating; migrations that change the columns they
+ * read must drop them.
+ *
+ * Version 1 is the schema shared with the Python version. Version 2
+ * stores status, media_type and p_hash as integers, moves root folders
+ * into a roots table and makes media_tags a WITHOUT ROWID table.
+ * Version 3 replaces file_path with (dir_id, file_name) over a
+ * directories table whose paths are relative to their root. Version 4
+ * stores thumbnail paths inside a root relative to it as well, and
+ * version 5 adds the quick_hash change-detection column. Version 6
+ * records why a file failed and when to retry it, and version 7 adds
+ * video durations.
+ */
+class SchemaMigrations {
+public:
+    static constexpr int CurrentVersion = 7;
+
+    // Bring db up to CurrentVersion. Must run inside a transaction.
+    // Returns false if a migration failed or the file is from a newer build.
+    static bool migrate(QSqlDatabase& db, bool* changed = nullptr);
+
+    static int version(QSqlDatabase& db);
+
+private:
+    struct Migration {
+        int version;
+        const char* description;
+        bool (*apply)(QSqlDatabase& db);
+    };
+
+    static const QVector<Migration>& migrations();
+
+    static bool createBaseSchema(QSqlDatabase& db);
+    static bool compactEncodings(QSqlDatabase& db);
+    static bool normalizeDirectories(QSqlDatabase& db);
+    static bool relativeThumbnails(QSqlDatabase& db);
+    static bool addQuickHash(QSqlDatabase& db);
+    static bool addFailureTracking(QSqlDatabase& db);
+    static bool addDuration(QSqlDatabase& db);
+};
+
+} // namespace KeyTagger
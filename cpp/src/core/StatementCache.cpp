@@ -0,0 +1,81 @@
+#include "StatementCache.h"
+#include <QSqlError>
+#include <QDebug>
+
+namespace KeyTagger {
+
+StatementCache::StatementCache(const QSqlDatabase& db)
+    : m_db(db)
+{
+}
+
+StatementCache::~StatementCache() {
+    clear();
+}
+
+namespace {
+
+// Shares ownership of the cached statement and finishes it on release
+std::shared_ptr<QSqlQuery> resettingHandle(const std::shared_ptr<QSqlQuery>& statement) {
+    return std::shared_ptr<QSqlQuery>(statement.get(), [statement](QSqlQuery* query) {
+        query->finish();
+    });
+}
+
+} // namespace
+
+std::shared_ptr<QSqlQuery> StatementCache::prepare(const QString& sql) {
+    auto it = m_statements.constFind(sql);
+    bool inUse = false;
+    if (it != m_statements.constEnd()) {
+        // A handle still out (e.g. an outer loop stepping the same SQL)
+        // keeps the cached statement; finishing it would cut that loop short
+        inUse = it->use_count() > 1;
+        if (!inUse) {
+            // Reset any previous result set before the caller rebinds
+            (*it)->finish();
+            ++m_hits;
+            return resettingHandle(*it);
+        }
+    }
+    
+    ++m_misses;
+    
+    if (!inUse && m_statements.size() >= MaxStatements) {
+        clear();
+    }
+    
+    auto query = std::make_shared<QSqlQuery>(m_db);
+    query->setForwardOnly(true);
+    if (!query->prepare(sql)) {
+        // Not cached so a later schema change can make it valid
+        qWarning() << "Failed to prepare statement:" << query->lastError().text();
+        return query;
+    }
+    
+    if (inUse) {
+        // Uncached one-off, dropped when the caller is done with it
+        return query;
+    }
+    
+    m_statements.insert(sql, query);
+    return resettingHandle(query);
+}
+
+void StatementCache::clear() {
+    m_statements.clear();
+}
+
+quint64 StatementCache::hits() const {
+    return m_hits.load();
+}
+
+quint64 StatementCache::misses() const {
+    return m_misses.load();
+}
+
+int StatementCache::size() const {
+    return m_statements.size();
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <atomic>
+#include <memory>
+
+namespace KeyTagger {
+
+/**
+ * StatementCache - Per-connection cache of prepared statements
+ *
+ * Statements are keyed by their SQL text and prepared once per
+ * connection, so tight loops only pay for binding and stepping.
+ * Not thread-safe: each connection (and therefore each thread)
+ * owns its own cache. The hit/miss counters may be read from anywhere.
+ */
+class StatementCache {
+public:
+    explicit StatementCache(const QSqlDatabase& db);
+    ~StatementCache();
+
+    // Returns a ready-to-bind statement for sql, preparing it on first use.
+    // The handle stays valid even if the cache evicts it meanwhile, and
+    // resets the statement when its last copy goes away, so a read that
+    // stops after one row never leaves its read transaction open. While
+    // an earlier handle for the same sql is still held, a fresh uncached
+    // statement is returned instead of resetting the shared one.
+    std::shared_ptr<QSqlQuery> prepare(const QString& sql);
+    void clear();
+
+    // Reuse counters
+    quint64 hits() const;
+    quint64 misses() const;
+    int size() const;
+
+private:
+    QSqlDatabase m_db;
+    QHash<QString, std::shared_ptr<QSqlQuery>> m_statements;
+    
+    std::atomic<quint64> m_hits{0};
+    std::atomic<quint64> m_misses{0};
+    
+    // Guards against unbounded growth from ad-hoc SQL
+    static constexpr int MaxStatements = 128;
+};
+
+} // namespace KeyTagger
@@ -0,0 +1,355 @@
+#include "TagIndex.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <algorithm>
+
+namespace KeyTagger {
+
+namespace {
+
+// Ids index the dense sort-key vector, so keep them within reason
+constexpr qint64 MaxIndexedId = qint64(1) << 26;
+
+} // namespace
+
+bool TagIndex::fitsIndex(qint64 id) {
+    return id > 0 && id < MaxIndexedId;
+}
+
+bool TagIndex::build(QSqlDatabase& db) {
+    QWriteLocker locker(&m_lock);
+    invalidateFacets();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    m_ready = false;
+    m_tagNames.clear();
+    m_tagIds.clear();
+    m_tags.clear();
+    m_types.clear();
+    m_roots.clear();
+    m_active.clear();
+    m_all.clear();
+    m_modified.clear();
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+
+    // Media attributes, in id order so bitmaps are appended to
+    if (!query.exec("SELECT m.id, m.media_type, r.path, m.status, m.modified_time_utc "
+                    "FROM media m JOIN directories d ON d.id = m.dir_id "
+                    "JOIN roots r ON r.id = d.root_id ORDER BY m.id")) {
+        qWarning() << "Tag index: failed to read media:" << query.lastError().text();
+        return false;
+    }
+    while (query.next()) {
+        qint64 id = query.value(0).toLongLong();
+        if (!fitsIndex(id)) {
+            qWarning() << "Tag index: media id" << id << "out of range, index disabled";
+            return false;
+        }
+
+        quint32 key = quint32(id);
+        m_all.add(key);
+        m_types[query.value(1).toInt()].add(key);
+        m_roots[query.value(2).toString()].add(key);
+        if (query.value(3).toInt() == int(MediaStatus::Active)) {
+            m_active.add(key);
+        }
+
+        if (m_modified.size() <= id) {
+            m_modified.resize(id + 1);
+        }
+        m_modified[id] = query.value(4).toLongLong();
+    }
+
+    if (!query.exec("SELECT id, name FROM tags")) {
+        qWarning() << "Tag index: failed to read tags:" << query.lastError().text();
+        return false;
+    }
+    while (query.next()) {
+        qint64 id = query.value(0).toLongLong();
+        QString name = query.value(1).toString();
+        m_tagNames.insert(id, name);
+        m_tagIds.insert(name, id);
+    }
+
+    // Sorted by (tag_id, media_id) straight off idx_media_tags_tag_id
+    if (!query.exec("SELECT tag_id, media_id FROM media_tags ORDER BY tag_id, media_id")) {
+        qWarning() << "Tag index: failed to read media_tags:" << query.lastError().text();
+        return false;
+    }
+    qint64 currentTag = -1;
+    QVector<quint32> members;
+    auto flushTag = [&]() {
+        if (currentTag >= 0) {
+            m_tags.insert(currentTag, RoaringBitmap::fromSorted(members));
+        }
+        members.clear();
+    };
+    while (query.next()) {
+        qint64 tagId = query.value(0).toLongLong();
+        qint64 mediaId = query.value(1).toLongLong();
+        if (tagId != currentTag) {
+            flushTag();
+            currentTag = tagId;
+        }
+        if (fitsIndex(mediaId)) {
+            members.append(quint32(mediaId));
+        }
+    }
+    flushTag();
+
+    m_ready = true;
+    qDebug() << "Tag index built:" << m_all.cardinality() << "media," << m_tags.size()
+             << "tags in" << timer.elapsed() << "ms";
+    return true;
+}
+
+void TagIndex::clear() {
+    QWriteLocker locker(&m_lock);
+    invalidateFacets();
+    m_ready = false;
+    m_tagNames.clear();
+    m_tagIds.clear();
+    m_tags.clear();
+    m_types.clear();
+    m_roots.clear();
+    m_active.clear();
+    m_all.clear();
+    m_modified.clear();
+}
+
+bool TagIndex::isReady() const {
+    QReadLocker locker(&m_lock);
+    return m_ready;
+}
+
+void TagIndex::invalidateFacets() {
+    QMutexLocker facetLocker(&m_facetMutex);
+    m_facetValid = false;
+    m_facetResult.clear();
+    m_facetCounts.clear();
+}
+
+void TagIndex::removeMediaEverywhere(quint32 id) {
+    for (auto& bitmap : m_tags) bitmap.remove(id);
+    for (auto& bitmap : m_types) bitmap.remove(id);
+    for (auto& bitmap : m_roots) bitmap.remove(id);
+    m_active.remove(id);
+    m_all.remove(id);
+}
+
+void TagIndex::apply(const IndexChangeset& changes) {
+    QWriteLocker locker(&m_lock);
+    if (!m_ready) return;
+    invalidateFacets();
+
+    for (const IndexChange& change : changes) {
+        if (change.mediaId != 0 && !fitsIndex(change.mediaId)) {
+            qWarning() << "Tag index: media id" << change.mediaId << "out of range, index disabled";
+            m_ready = false;
+            return;
+        }
+        const quint32 media = quint32(change.mediaId);
+
+        switch (change.kind) {
+            case IndexChange::Kind::UpsertMedia:
+                for (auto& bitmap : m_types) bitmap.remove(media);
+                for (auto& bitmap : m_roots) bitmap.remove(media);
+                m_types[int(change.mediaType)].add(media);
+                m_roots[change.text].add(media);
+                m_all.add(media);
+                m_active.add(media);
+                if (m_modified.size() <= change.mediaId) {
+                    m_modified.resize(change.mediaId + 1);
+                }
+                m_modified[change.mediaId] = change.modifiedTime;
+                break;
+            case IndexChange::Kind::DeactivateMedia:
+                m_active.remove(media);
+                break;
+            case IndexChange::Kind::RelinkRoot: {
+                RoaringBitmap moved = m_roots.take(change.previousText);
+                m_roots[change.text] |= moved;
+                break;
+            }
+            case IndexChange::Kind::DeleteMedia:
+                removeMediaEverywhere(media);
+                break;
+            case IndexChange::Kind::LinkTag:
+                m_tags[change.tagId].add(media);
+                break;
+            case IndexChange::Kind::UnlinkTag: {
+                auto it = m_tags.find(change.tagId);
+                if (it != m_tags.end()) it->remove(media);
+                break;
+            }
+            case IndexChange::Kind::CreateTag:
+                m_tagNames.insert(change.tagId, change.text);
+                m_tagIds.insert(change.text, change.tagId);
+                break;
+            case IndexChange::Kind::DeleteTag:
+                m_tagIds.remove(m_tagNames.take(change.tagId));
+                m_tags.remove(change.tagId);
+                break;
+        }
+    }
+}
+
+std::optional<RoaringBitmap> TagIndex::evaluateNode(const TagQueryNode& node) const {
+    switch (node.kind) {
+        case TagQueryNode::Kind::Tag:
+            return m_tags.value(m_tagIds.value(node.value, -1));
+
+        case TagQueryNode::Kind::Type:
+            return m_types.value(int(MediaRecord::stringToMediaType(node.value)));
+
+        case TagQueryNode::Kind::Compare:
+            // Width, height and size are not indexed
+            return std::nullopt;
+
+        case TagQueryNode::Kind::Not: {
+            auto inner = evaluateNode(*node.children.first());
+            if (!inner) return std::nullopt;
+            return m_all - *inner;
+        }
+
+        case TagQueryNode::Kind::Or: {
+            RoaringBitmap result;
+            for (const auto& child : node.children) {
+                auto part = evaluateNode(*child);
+                if (!part) return std::nullopt;
+                result |= *part;
+            }
+            return result;
+        }
+
+        case TagQueryNode::Kind::And: {
+            // Intersect positives smallest first, then subtract negations
+            QVector<RoaringBitmap> positives;
+            QVector<RoaringBitmap> negatives;
+            for (const auto& child : node.children) {
+                bool negated = child->kind == TagQueryNode::Kind::Not;
+                auto part = evaluateNode(negated ? *child->children.first() : *child);
+                if (!part) return std::nullopt;
+                (negated ? negatives : positives).append(std::move(*part));
+            }
+
+            std::sort(positives.begin(), positives.end(), [](const RoaringBitmap& a, const RoaringBitmap& b) {
+                return a.cardinality() < b.cardinality();
+            });
+
+            RoaringBitmap result = positives.isEmpty() ? m_all : positives.first();
+            for (int i = 1; i < positives.size() && !result.isEmpty(); ++i) {
+                result &= positives[i];
+            }
+            for (int i = 0; i < negatives.size() && !result.isEmpty(); ++i) {
+                result -= negatives[i];
+            }
+            return result;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<RoaringBitmap> TagIndex::evaluate(const TagQuery& query, const QString& rootDir) const {
+    QReadLocker locker(&m_lock);
+    if (!m_ready || !query.isValid()) return std::nullopt;
+
+    RoaringBitmap result = m_active;
+    if (!rootDir.isEmpty()) {
+        // Only whole roots have a bitmap; subfolders, and roots with other
+        // roots nested below them, are filtered in SQL
+        const QString path = QDir(rootDir).absolutePath();
+        auto root = m_roots.constFind(path);
+        if (root == m_roots.constEnd()) return std::nullopt;
+        for (auto it = m_roots.constBegin(); it != m_roots.constEnd(); ++it) {
+            if (it.key().startsWith(path + '/')) return std::nullopt;
+        }
+        result &= *root;
+    }
+
+    if (!query.isEmpty()) {
+        auto matched = evaluateNode(*query.root());
+        if (!matched) return std::nullopt;
+        result &= *matched;
+    }
+
+    return result;
+}
+
+QVector<qint64> TagIndex::orderedIds(const RoaringBitmap& ids) const {
+    QVector<qint64> ordered;
+    ordered.reserve(int(ids.cardinality()));
+    ids.forEach([&ordered](quint32 id) { ordered.append(id); });
+
+    QReadLocker locker(&m_lock);
+    auto modified = [this](qint64 id) {
+        return id < m_modified.size() ? m_modified[id] : 0;
+    };
+    std::sort(ordered.begin(), ordered.end(), [&modified](qint64 a, qint64 b) {
+        qint64 ma = modified(a);
+        qint64 mb = modified(b);
+        return ma != mb ? ma > mb : a > b;
+    });
+    return ordered;
+}
+
+QHash<QString, int> TagIndex::facetCounts(const RoaringBitmap& result) const {
+    QReadLocker locker(&m_lock);
+    QMutexLocker facetLocker(&m_facetMutex);
+
+    QHash<qint64, int> counts;
+    if (m_facetValid && result == m_facetResult) {
+        counts = m_facetCounts;
+    } else if (m_facetValid && (result - m_facetResult).isEmpty()) {
+        // A subset of the last result: tags absent from it stay absent
+        for (auto it = m_facetCounts.cbegin(); it != m_facetCounts.cend(); ++it) {
+            int count = int(m_tags.value(it.key()).andCardinality(result));
+            if (count > 0) counts.insert(it.key(), count);
+        }
+    } else {
+        for (auto it = m_tags.cbegin(); it != m_tags.cend(); ++it) {
+            int count = int(it.value().andCardinality(result));
+            if (count > 0) counts.insert(it.key(), count);
+        }
+    }
+
+    m_facetResult = result;
+    m_facetCounts = counts;
+    m_facetValid = true;
+
+    QHash<QString, int> named;
+    named.reserve(counts.size());
+    for (auto it = counts.cbegin(); it != counts.cend(); ++it) {
+        auto name = m_tagNames.constFind(it.key());
+        if (name != m_tagNames.cend()) named.insert(*name, it.value());
+    }
+    return named;
+}
+
+RoaringBitmap TagIndex::tagBitmap(const QString& tagName) const {
+    QReadLocker locker(&m_lock);
+    return m_tags.value(m_tagIds.value(tagName, -1));
+}
+
+RoaringBitmap TagIndex::activeBitmap() const {
+    QReadLocker locker(&m_lock);
+    return m_active;
+}
+
+QHash<QString, RoaringBitmap> TagIndex::tagBitmaps() const {
+    QReadLocker locker(&m_lock);
+    QHash<QString, RoaringBitmap> result;
+    for (auto it = m_tagIds.cbegin(); it != m_tagIds.cend(); ++it) {
+        result.insert(it.key(), m_tags.value(it.value()));
+    }
+    return result;
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <QVector>
+#include <QSqlDatabase>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <optional>
+#include "RoaringBitmap.h"
+#include "MediaRecord.h"
+#include "TagQuery.h"
+
+namespace KeyTagger {
+
+/**
+ * IndexChange - One committed mutation, as seen by the TagIndex
+ *
+ * The writer records these in commit order so the in-memory index can
+ * follow the database without re-reading it.
+ */
+struct IndexChange {
+    enum class Kind {
+        UpsertMedia,        // mediaId, mediaType, text = root dir, modifiedTime
+        DeactivateMedia,    // mediaId
+        DeleteMedia,        // mediaId
+        LinkTag,            // mediaId, tagId
+        UnlinkTag,          // mediaId, tagId
+        CreateTag,          // tagId, text = name
+        DeleteTag,          // tagId; also drops every link to it
+        RelinkRoot          // text = new root path, previousText = old one
+    };
+
+    Kind kind;
+    qint64 mediaId = 0;
+    qint64 tagId = 0;
+    MediaType mediaType = MediaType::Unknown;
+    qint64 modifiedTime = 0;
+    QString text;
+    QString previousText;
+};
+
+using IndexChangeset = QVector<IndexChange>;
+
+/**
+ * TagIndex - In-memory bitmap index over media membership
+ *
+ * Holds one RoaringBitmap per tag, per media type and per root folder,
+ * plus the set of active media. Tag queries without attribute
+ * comparisons are answered by bitmap algebra instead of SQL. Built once
+ * from a read connection and then kept current from writer changesets.
+ *
+ * Reads may happen from any thread; build() and apply() take the lock
+ * exclusively.
+ */
+class TagIndex {
+public:
+    TagIndex() = default;
+
+    bool build(QSqlDatabase& db);
+    void apply(const IndexChangeset& changes);
+    void clear();
+
+    bool isReady() const;
+
+    // Active media matching query (and rootDir if given), or nullopt if
+    // the query needs columns the index does not hold or rootDir is not
+    // a scan root
+    std::optional<RoaringBitmap> evaluate(const TagQuery& query, const QString& rootDir = QString()) const;
+
+    // Ids ordered newest first, matching "modified_time_utc DESC, id DESC"
+    QVector<qint64> orderedIds(const RoaringBitmap& ids) const;
+
+    // Members of result carrying each tag, for faceted sidebar counts.
+    // Narrowing the previous result only recounts tags still present.
+    QHash<QString, int> facetCounts(const RoaringBitmap& result) const;
+
+    RoaringBitmap tagBitmap(const QString& tagName) const;
+    RoaringBitmap activeBitmap() const;
+    QHash<QString, RoaringBitmap> tagBitmaps() const;
+
+private:
+    std::optional<RoaringBitmap> evaluateNode(const TagQueryNode& node) const;
+    void invalidateFacets();
+    void removeMediaEverywhere(quint32 id);
+    static bool fitsIndex(qint64 id);
+
+    mutable QReadWriteLock m_lock;
+    bool m_ready = false;
+
+    QHash<qint64, QString> m_tagNames;
+    QHash<QString, qint64> m_tagIds;
+    QHash<qint64, RoaringBitmap> m_tags;
+    QHash<int, RoaringBitmap> m_types;
+    QHash<QString, RoaringBitmap> m_roots;
+    RoaringBitmap m_active;
+    RoaringBitmap m_all;
+
+    // Sort key per id, for ordering results without a database round trip
+    QVector<qint64> m_modified;
+
+    // Last facet computation; cleared whenever the index changes
+    mutable QMutex m_facetMutex;
+    mutable RoaringBitmap m_facetResult;
+    mutable QHash<qint64, int> m_facetCounts;
+    mutable bool m_facetValid = false;
+};
+
+} // namespace KeyTagger
@@ -0,0 +1,684 @@
+#include "TagQuery.h"
+#include "MediaRecord.h"
+#include <QRegularExpression>
+#include <algorithm>
+#include <cmath>
+
+namespace KeyTagger {
+
+namespace {
+
+using NodePtr = std::shared_ptr<TagQueryNode>;
+
+struct Token {
+    enum class Type {
+        Word,
+        Quoted,
+        LParen,
+        RParen,
+        Op,
+        Minus,
+        End
+    };
+
+    Type type = Type::End;
+    QString text;
+    int pos = 0;
+};
+
+bool isOpChar(QChar c) {
+    return c == '<' || c == '>' || c == '=' || c == '!';
+}
+
+bool isKeyword(const Token& token, const char* keyword) {
+    return token.type == Token::Type::Word
+        && token.text.compare(QLatin1String(keyword), Qt::CaseInsensitive) == 0;
+}
+
+NodePtr makeLeaf(TagQueryNode::Kind kind, const QString& value) {
+    auto node = std::make_shared<TagQueryNode>();
+    node->kind = kind;
+    node->value = value;
+    return node;
+}
+
+NodePtr makeBranch(TagQueryNode::Kind kind, QVector<NodePtr> children) {
+    if (children.size() == 1 && kind != TagQueryNode::Kind::Not) {
+        return children.first();
+    }
+    auto node = std::make_shared<TagQueryNode>();
+    node->kind = kind;
+    node->children = std::move(children);
+    return node;
+}
+
+QString quoteTag(const QString& name) {
+    static const QRegularExpression plain("^[^\\s()\"<>=!-][^\\s()\"<>=!]*$");
+    if (plain.match(name).hasMatch()
+        && !name.startsWith("type:")
+        && name.compare("and", Qt::CaseInsensitive) != 0
+        && name.compare("or", Qt::CaseInsensitive) != 0
+        && name.compare("not", Qt::CaseInsensitive) != 0) {
+        return name;
+    }
+    return '"' + name + '"';
+}
+
+void collectTags(const TagQueryNode* node, QStringList& names, bool& attributes) {
+    if (!node) return;
+    switch (node->kind) {
+        case TagQueryNode::Kind::Tag:
+            if (!names.contains(node->value)) names << node->value;
+            break;
+        case TagQueryNode::Kind::Type:
+        case TagQueryNode::Kind::Compare:
+            attributes = true;
+            break;
+        default:
+            for (const auto& child : node->children) {
+                collectTags(child.get(), names, attributes);
+            }
+    }
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// Parser
+// ---------------------------------------------------------------------------
+
+class TagQueryParser {
+public:
+    explicit TagQueryParser(const QString& text) : m_text(text) {}
+
+    TagQuery run() {
+        TagQuery query;
+
+        tokenize();
+        if (m_error.isEmpty() && m_tokens.first().type != Token::Type::End) {
+            NodePtr root = parseOr();
+            if (m_error.isEmpty() && peek().type != Token::Type::End) {
+                fail(QString("Unexpected '%1'").arg(peek().text), peek().pos);
+            }
+            if (m_error.isEmpty()) {
+                query.m_root = root;
+            }
+        }
+
+        query.m_error = m_error;
+        query.m_errorPosition = m_errorPosition;
+        return query;
+    }
+
+private:
+    void tokenize() {
+        int i = 0;
+        const int n = m_text.size();
+
+        while (i < n) {
+            QChar c = m_text[i];
+            if (c.isSpace()) {
+                ++i;
+                continue;
+            }
+
+            Token token;
+            token.pos = i;
+
+            if (c == '(' || c == ')') {
+                token.type = c == '(' ? Token::Type::LParen : Token::Type::RParen;
+                token.text = c;
+                ++i;
+            } else if (c == '"') {
+                int end = m_text.indexOf('"', i + 1);
+                if (end < 0) {
+                    fail("Unterminated quote", i);
+                    return;
+                }
+                token.type = Token::Type::Quoted;
+                token.text = m_text.mid(i + 1, end - i - 1);
+                i = end + 1;
+            } else if (isOpChar(c)) {
+                token.type = Token::Type::Op;
+                token.text = c;
+                ++i;
+                if (i < n && m_text[i] == '=') {
+                    token.text += '=';
+                    ++i;
+                }
+                if (token.text == "!") {
+                    fail("Expected '!='", token.pos);
+                    return;
+                }
+            } else if (c == '-' && i + 1 < n && !m_text[i + 1].isSpace()) {
+                token.type = Token::Type::Minus;
+                token.text = c;
+                ++i;
+            } else {
+                int start = i;
+                while (i < n && !m_text[i].isSpace() && m_text[i] != '(' && m_text[i] != ')'
+                       && m_text[i] != '"' && !isOpChar(m_text[i])) {
+                    ++i;
+                }
+                token.type = Token::Type::Word;
+                token.text = m_text.mid(start, i - start);
+            }
+
+            m_tokens.append(token);
+        }
+
+        Token end;
+        end.pos = n;
+        m_tokens.append(end);
+    }
+
+    const Token& peek() const { return m_tokens[m_pos]; }
+    const Token& next() { return m_tokens[m_pos < m_tokens.size() - 1 ? m_pos++ : m_pos]; }
+
+    void fail(const QString& message, int pos) {
+        if (!m_error.isEmpty()) return;
+        m_error = message;
+        m_errorPosition = pos;
+    }
+
+    bool startsUnary(const Token& token) const {
+        switch (token.type) {
+            case Token::Type::Word:
+                return !isKeyword(token, "AND") && !isKeyword(token, "OR");
+            case Token::Type::Quoted:
+            case Token::Type::LParen:
+            case Token::Type::Minus:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    NodePtr parseOr() {
+        QVector<NodePtr> terms;
+        terms << parseAnd();
+        while (m_error.isEmpty() && isKeyword(peek(), "OR")) {
+            next();
+            terms << parseAnd();
+        }
+        return m_error.isEmpty() ? makeBranch(TagQueryNode::Kind::Or, terms) : nullptr;
+    }
+
+    NodePtr parseAnd() {
+        QVector<NodePtr> terms;
+        terms << parseUnary();
+        while (m_error.isEmpty()) {
+            if (isKeyword(peek(), "AND")) {
+                next();
+            } else if (!startsUnary(peek())) {
+                break;
+            }
+            terms << parseUnary();
+        }
+        return m_error.isEmpty() ? makeBranch(TagQueryNode::Kind::And, terms) : nullptr;
+    }
+
+    NodePtr parseUnary() {
+        if (isKeyword(peek(), "NOT") || peek().type == Token::Type::Minus) {
+            bool minus = next().type == Token::Type::Minus;
+            NodePtr operand = minus ? parsePrimary() : parseUnary();
+            return m_error.isEmpty() ? makeBranch(TagQueryNode::Kind::Not, {operand}) : nullptr;
+        }
+        return parsePrimary();
+    }
+
+    NodePtr parsePrimary() {
+        const Token token = next();
+
+        switch (token.type) {
+            case Token::Type::LParen: {
+                NodePtr inner = parseOr();
+                if (m_error.isEmpty() && next().type != Token::Type::RParen) {
+                    fail("Missing ')'", token.pos);
+                }
+                return m_error.isEmpty() ? inner : nullptr;
+            }
+            case Token::Type::Quoted: {
+                QString name = token.text.trimmed().toLower();
+                if (name.isEmpty()) {
+                    fail("Empty tag", token.pos);
+                    return nullptr;
+                }
+                return makeLeaf(TagQueryNode::Kind::Tag, name);
+            }
+            case Token::Type::Word:
+                if (isKeyword(token, "AND") || isKeyword(token, "OR")) {
+                    fail(QString("Expected a tag before '%1'").arg(token.text), token.pos);
+                    return nullptr;
+                }
+                if (peek().type == Token::Type::Op) {
+                    return parseComparison(token);
+                }
+                return parseWord(token);
+            case Token::Type::End:
+                fail("Unexpected end of query", token.pos);
+                return nullptr;
+            default:
+                fail(QString("Unexpected '%1'").arg(token.text), token.pos);
+                return nullptr;
+        }
+    }
+
+    NodePtr parseWord(const Token& token) {
+        QString word = token.text.toLower();
+
+        int colon = word.indexOf(':');
+        if (colon > 0 && word.left(colon) == "type") {
+            QString type = word.mid(colon + 1);
+            if (type != "image" && type != "video" && type != "audio") {
+                fail(QString("Unknown media type '%1'").arg(type), token.pos + colon + 1);
+                return nullptr;
+            }
+            return makeLeaf(TagQueryNode::Kind::Type, type);
+        }
+
+        // Other prefixes (e.g. "artist:name") are ordinary tag names
+        return makeLeaf(TagQueryNode::Kind::Tag, word);
+    }
+
+    NodePtr parseComparison(const Token& field) {
+        static const QHash<QString, QString> columns = {
+            {"width", "width"},
+            {"height", "height"},
+            {"size", "size_bytes"}
+        };
+
+        QString name = field.text.toLower();
+        if (!columns.contains(name)) {
+            fail(QString("Cannot compare '%1'; use width, height or size").arg(field.text), field.pos);
+            return nullptr;
+        }
+
+        const Token op = next();
+        const Token value = next();
+        if (value.type != Token::Type::Word) {
+            fail("Expected a number", value.pos);
+            return nullptr;
+        }
+
+        static const QRegularExpression number(
+            "^(\\d+(?:\\.\\d+)?)(k|kb|m|mb|g|gb)?$",
+            QRegularExpression::CaseInsensitiveOption);
+        QRegularExpressionMatch match = number.match(value.text);
+        if (!match.hasMatch() || (!match.captured(2).isEmpty() && name != "size")) {
+            fail(QString("Invalid number '%1'").arg(value.text), value.pos);
+            return nullptr;
+        }
+
+        double amount = match.captured(1).toDouble();
+        QChar unit = match.captured(2).isEmpty() ? QChar() : match.captured(2).at(0).toLower();
+        if (unit == 'k') amount *= 1024.0;
+        if (unit == 'm') amount *= 1024.0 * 1024.0;
+        if (unit == 'g') amount *= 1024.0 * 1024.0 * 1024.0;
+
+        auto node = makeLeaf(TagQueryNode::Kind::Compare, columns.value(name));
+        node->op = op.text == "!=" ? "<>" : op.text;
+        node->number = static_cast<qint64>(std::llround(amount));
+        return node;
+    }
+
+    QString m_text;
+    QVector<Token> m_tokens;
+    int m_pos = 0;
+    QString m_error;
+    int m_errorPosition = -1;
+};
+
+// ---------------------------------------------------------------------------
+// TagQuery
+// ---------------------------------------------------------------------------
+
+QString TagQueryNode::toString() const {
+    auto wrap = [](const TagQueryNode& child) {
+        bool leaf = child.kind != Kind::And && child.kind != Kind::Or;
+        return leaf ? child.toString() : "(" + child.toString() + ")";
+    };
+
+    switch (kind) {
+        case Kind::Tag:
+            return quoteTag(value);
+        case Kind::Type:
+            return "type:" + value;
+        case Kind::Compare: {
+            QString field = value == "size_bytes" ? "size" : value;
+            return field + (op == "<>" ? "!=" : op) + QString::number(number);
+        }
+        case Kind::Not:
+            return "NOT " + wrap(*children.first());
+        case Kind::And:
+        case Kind::Or: {
+            QStringList parts;
+            for (const auto& child : children) {
+                parts << wrap(*child);
+            }
+            return parts.join(kind == Kind::And ? " AND " : " OR ");
+        }
+    }
+    return QString();
+}
+
+TagQuery TagQuery::parse(const QString& text) {
+    return TagQueryParser(text).run();
+}
+
+TagQuery TagQuery::allOf(const QStringList& tags) {
+    QVector<NodePtr> leaves;
+    for (const QString& tag : tags) {
+        QString name = tag.trimmed().toLower();
+        if (!name.isEmpty()) leaves << makeLeaf(TagQueryNode::Kind::Tag, name);
+    }
+
+    TagQuery query;
+    if (!leaves.isEmpty()) query.m_root = makeBranch(TagQueryNode::Kind::And, leaves);
+    return query;
+}
+
+TagQuery TagQuery::anyOf(const QStringList& tags) {
+    TagQuery query = allOf(tags);
+    if (query.m_root && query.m_root->kind == TagQueryNode::Kind::And) {
+        query.m_root->kind = TagQueryNode::Kind::Or;
+    }
+    return query;
+}
+
+TagQuery TagQuery::intersection(const TagQuery& a, const TagQuery& b) {
+    if (!a.isValid() || b.isEmpty()) return a;
+    if (!b.isValid() || a.isEmpty()) return b;
+
+    TagQuery query;
+    query.m_root = makeBranch(TagQueryNode::Kind::And, {a.m_root, b.m_root});
+    return query;
+}
+
+QString TagQuery::toString() const {
+    return m_root ? m_root->toString() : QString();
+}
+
+QStringList TagQuery::tagNames() const {
+    QStringList names;
+    bool attributes = false;
+    collectTags(m_root.get(), names, attributes);
+    return names;
+}
+
+bool TagQuery::hasAttributeTerms() const {
+    QStringList names;
+    bool attributes = false;
+    collectTags(m_root.get(), names, attributes);
+    return attributes;
+}
+
+// ---------------------------------------------------------------------------
+// Planner
+// ---------------------------------------------------------------------------
+
+struct TagQueryPlanner::Fragment {
+    enum class Constant {
+        None,
+        True,
+        False
+    };
+
+    QString sql;
+    QVariantList params;
+    double selectivity = 1.0;   // Estimated fraction of media matched
+    QStringList explain;        // First line describes this node
+    Constant constant = Constant::None;
+    QString tagName;            // Set for a positive tag leaf
+
+    static Fragment fixed(bool value, const QString& reason) {
+        Fragment fragment;
+        fragment.constant = value ? Constant::True : Constant::False;
+        fragment.sql = value ? "1" : "0";
+        fragment.selectivity = value ? 1.0 : 0.0;
+        fragment.explain << reason;
+        return fragment;
+    }
+
+    bool isTag() const { return !tagName.isEmpty(); }
+};
+
+namespace {
+
+// Children of node, with nested nodes of the same kind spliced in
+QVector<const TagQueryNode*> flattened(const TagQueryNode& node) {
+    QVector<const TagQueryNode*> result;
+    for (const auto& child : node.children) {
+        if (child->kind == node.kind) {
+            result += flattened(*child);
+        } else {
+            result << child.get();
+        }
+    }
+    return result;
+}
+
+QStringList indented(const QStringList& lines) {
+    QStringList result;
+    for (const QString& line : lines) {
+        result << "  " + line;
+    }
+    return result;
+}
+
+} // namespace
+
+TagQueryPlanner::TagQueryPlanner(const Statistics& stats)
+    : m_stats(stats)
+{
+}
+
+double TagQueryPlanner::fraction(qint64 rows) const {
+    if (m_stats.totalMedia <= 0) return rows > 0 ? 1.0 : 0.0;
+    return std::min(1.0, static_cast<double>(rows) / m_stats.totalMedia);
+}
+
+TagQueryPlanner::Plan TagQueryPlanner::compile(const TagQuery& query) const {
+    Plan plan;
+
+    if (!query.isValid() || query.isEmpty()) {
+        plan.whereSql = query.isValid() ? "1" : "0";
+        plan.explain = query.isValid() ? "Empty query: all media" : "Invalid query: " + query.errorString();
+        plan.estimatedRows = query.isValid() ? m_stats.totalMedia : 0;
+        return plan;
+    }
+
+    Fragment root = compileNode(*query.root(), true);
+    plan.whereSql = root.sql;
+    plan.params = root.params;
+    plan.estimatedRows = root.selectivity * m_stats.totalMedia;
+    plan.explain = QString("Query: %1\nEstimated rows: %2\n%3")
+        .arg(query.toString())
+        .arg(std::llround(plan.estimatedRows))
+        .arg(root.explain.join('\n'));
+    return plan;
+}
+
+TagQueryPlanner::Fragment TagQueryPlanner::compileNode(const TagQueryNode& node, bool topLevel) const {
+    switch (node.kind) {
+        case TagQueryNode::Kind::Tag: return compileTag(node.value, topLevel);
+        case TagQueryNode::Kind::And: return compileAnd(node, topLevel);
+        case TagQueryNode::Kind::Or: return compileOr(node, topLevel);
+        case TagQueryNode::Kind::Not: return compileNot(node);
+        default: return compileAttribute(node);
+    }
+}
+
+TagQueryPlanner::Fragment TagQueryPlanner::compileTag(const QString& name, bool topLevel) const {
+    if (!m_stats.tagIds.contains(name)) {
+        return Fragment::fixed(false, QString("tag %1: unknown, matches nothing").arg(quoteTag(name)));
+    }
+
+    qint64 rows = m_stats.tagCounts.value(name);
+
+    Fragment fragment;
+    fragment.tagName = name;
+    fragment.selectivity = fraction(rows);
+    fragment.params << m_stats.tagIds.value(name);
+
+    if (topLevel) {
+        // Enumerate the tag's media from the tag_id index and look rows up by id
+        fragment.sql = "media.id IN (SELECT media_id FROM media_tags WHERE tag_id = ?)";
+        fragment.explain << QString("drive: tag %1 (%2 rows) via idx_media_tags_tag_id")
+            .arg(quoteTag(name)).arg(rows);
+    } else {
+        // One primary-key lookup per candidate row
+        fragment.sql = "EXISTS (SELECT 1 FROM media_tags WHERE media_id = media.id AND tag_id = ?)";
+        fragment.explain << QString("probe: tag %1 (%2 rows) via media_tags primary key")
+            .arg(quoteTag(name)).arg(rows);
+    }
+    return fragment;
+}
+
+TagQueryPlanner::Fragment TagQueryPlanner::compileAnd(const TagQueryNode& node, bool topLevel) const {
+    QVector<Fragment> parts;
+    for (const TagQueryNode* child : flattened(node)) {
+        Fragment part = compileNode(*child, false);
+        if (part.constant == Fragment::Constant::False) return part;
+        if (part.constant == Fragment::Constant::True) continue;
+        parts << part;
+    }
+    if (parts.isEmpty()) return Fragment::fixed(true, "AND of always-true terms");
+
+    // Most selective first, so rows are rejected as early as possible
+    std::stable_sort(parts.begin(), parts.end(), [](const Fragment& a, const Fragment& b) {
+        return a.selectivity < b.selectivity;
+    });
+
+    // Drive the scan from the rarest tag instead of scanning media
+    if (topLevel) {
+        auto driver = std::find_if(parts.begin(), parts.end(), [](const Fragment& f) { return f.isTag(); });
+        if (driver != parts.end()) {
+            Fragment driving = compileTag(driver->tagName, true);
+            parts.erase(driver);
+            parts.prepend(driving);
+        }
+    }
+
+    if (parts.size() == 1) return parts.first();
+
+    Fragment fragment;
+    QStringList sql;
+    QStringList children;
+    for (const Fragment& part : parts) {
+        sql << part.sql;
+        fragment.params += part.params;
+        fragment.selectivity *= part.selectivity;
+        children += part.explain;
+    }
+    fragment.sql = "(" + sql.join(" AND ") + ")";
+    fragment.explain << QString("AND (est. %1 rows)").arg(std::llround(fragment.selectivity * m_stats.totalMedia));
+    fragment.explain += indented(children);
+    return fragment;
+}
+
+TagQueryPlanner::Fragment TagQueryPlanner::compileOr(const TagQueryNode& node, bool topLevel) const {
+    QVector<Fragment> parts;
+    QStringList tagNames;
+    QStringList labels;
+    QVariantList tagIds;
+    qint64 tagRows = 0;
+
+    for (const TagQueryNode* child : flattened(node)) {
+        Fragment part = compileNode(*child, false);
+        if (part.constant == Fragment::Constant::True) return part;
+        if (part.constant == Fragment::Constant::False) continue;
+        if (part.isTag()) {
+            tagNames << part.tagName;
+            labels << quoteTag(part.tagName);
+            tagIds += part.params;
+            tagRows += m_stats.tagCounts.value(part.tagName);
+            continue;
+        }
+        parts << part;
+    }
+
+    // Any-of-these-tags collapses into a single IN lookup
+    if (tagIds.size() == 1 && parts.isEmpty()) {
+        return compileTag(tagNames.first(), topLevel);
+    }
+    if (!tagIds.isEmpty()) {
+        QString placeholders = QString("?,").repeated(tagIds.size());
+        placeholders.chop(1);
+
+        Fragment tags;
+        tags.params = tagIds;
+        tags.selectivity = fraction(tagRows);
+        if (topLevel && parts.isEmpty()) {
+            tags.sql = QString("media.id IN (SELECT media_id FROM media_tags WHERE tag_id IN (%1))").arg(placeholders);
+            tags.explain << QString("drive: any of %1 (<= %2 rows) via idx_media_tags_tag_id")
+                .arg(labels.join(", ")).arg(tagRows);
+        } else {
+            tags.sql = QString("EXISTS (SELECT 1 FROM media_tags WHERE media_id = media.id AND tag_id IN (%1))")
+                .arg(placeholders);
+            tags.explain << QString("probe: any of %1 (<= %2 rows) via media_tags primary key")
+                .arg(labels.join(", ")).arg(tagRows);
+        }
+        parts << tags;
+    }
+
+    if (parts.isEmpty()) return Fragment::fixed(false, "OR of never-true terms");
+    if (parts.size() == 1) return parts.first();
+
+    // Most likely first, so matching rows are accepted early
+    std::stable_sort(parts.begin(), parts.end(), [](const Fragment& a, const Fragment& b) {
+        return a.selectivity > b.selectivity;
+    });
+
+    Fragment fragment;
+    QStringList sql;
+    QStringList children;
+    double none = 1.0;
+    for (const Fragment& part : parts) {
+        sql << part.sql;
+        fragment.params += part.params;
+        none *= 1.0 - part.selectivity;
+        children += part.explain;
+    }
+    fragment.selectivity = 1.0 - none;
+    fragment.sql = "(" + sql.join(" OR ") + ")";
+    fragment.explain << QString("OR (est. %1 rows)").arg(std::llround(fragment.selectivity * m_stats.totalMedia));
+    fragment.explain += indented(children);
+    return fragment;
+}
+
+TagQueryPlanner::Fragment TagQueryPlanner::compileNot(const TagQueryNode& node) const {
+    Fragment inner = compileNode(*node.children.first(), false);
+    if (inner.constant != Fragment::Constant::None) {
+        return Fragment::fixed(inner.constant == Fragment::Constant::False,
+                               "NOT of a constant: " + inner.explain.first());
+    }
+
+    Fragment fragment;
+    fragment.sql = "NOT (" + inner.sql + ")";
+    fragment.params = inner.params;
+    fragment.selectivity = 1.0 - inner.selectivity;
+    fragment.explain << QString("NOT (est. %1 rows)").arg(std::llround(fragment.selectivity * m_stats.totalMedia));
+    fragment.explain += indented(inner.explain);
+    return fragment;
+}
+
+TagQueryPlanner::Fragment TagQueryPlanner::compileAttribute(const TagQueryNode& node) const {
+    Fragment fragment;
+
+    if (node.kind == TagQueryNode::Kind::Type) {
+        fragment.sql = "media_type = ?";
+        fragment.params << int(MediaRecord::stringToMediaType(node.value));
+        fragment.selectivity = 1.0 / 3.0;
+    } else {
+        // Column names come from the parser's whitelist, never from user text
+        fragment.sql = QString("%1 %2 ?").arg(node.value, node.op);
+        fragment.params << node.number;
+        fragment.selectivity = node.op == "=" ? 0.05 : 0.3;
+    }
+
+    fragment.explain << QString("filter: %1 (row check, no index)").arg(node.toString());
+    return fragment;
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QVariantList>
+#include <memory>
+
+namespace KeyTagger {
+
+/**
+ * TagQueryNode - One node of a parsed tag query
+ *
+ * Leaves are tags, media type filters (type:video) and numeric
+ * comparisons (width>3000, size<5mb); inner nodes are AND/OR/NOT.
+ */
+struct TagQueryNode {
+    enum class Kind {
+        Tag,
+        Type,
+        Compare,
+        And,
+        Or,
+        Not
+    };
+
+    Kind kind = Kind::Tag;
+    QString value;      // Tag name, media type or compared column
+    QString op;         // Comparison operator for Compare
+    qint64 number = 0;  // Right-hand side for Compare
+    QVector<std::shared_ptr<TagQueryNode>> children;
+
+    QString toString() const;
+};
+
+/**
+ * TagQuery - Parsed boolean tag expression
+ *
+ * Grammar (keywords are case-insensitive, AND binds tighter than OR):
+ *   expr    := and ( OR and )*
+ *   and     := unary ( [AND] unary )*
+ *   unary   := NOT unary | -primary | primary
+ *   primary := ( expr ) | tag | "quoted tag" | type:<kind> | field op number
+ *
+ * Parse errors are reported through isValid()/errorString(), never thrown.
+ */
+class TagQuery {
+public:
+    TagQuery() = default;
+
+    static TagQuery parse(const QString& text);
+    static TagQuery allOf(const QStringList& tags);
+    static TagQuery anyOf(const QStringList& tags);
+    // Both queries must match; an empty side is ignored
+    static TagQuery intersection(const TagQuery& a, const TagQuery& b);
+
+    bool isEmpty() const { return !m_root; }
+    bool isValid() const { return m_error.isEmpty(); }
+    QString errorString() const { return m_error; }
+    int errorPosition() const { return m_errorPosition; }
+
+    const TagQueryNode* root() const { return m_root.get(); }
+    QString toString() const;
+
+    // Tag names referenced anywhere in the expression
+    QStringList tagNames() const;
+    // True if any leaf filters on media attributes rather than tags
+    bool hasAttributeTerms() const;
+
+private:
+    std::shared_ptr<TagQueryNode> m_root;
+    QString m_error;
+    int m_errorPosition = -1;
+
+    friend class TagQueryParser;
+};
+
+/**
+ * TagQueryPlanner - Compiles a TagQuery into a SQL predicate on media
+ *
+ * Uses per-tag active counts to estimate selectivity. An intersection is
+ * driven from its rarest tag through idx_media_tags_tag_id and the other
+ * terms are probed per row on the media_tags primary key, most selective
+ * first. The explain text records these decisions.
+ */
+class TagQueryPlanner {
+public:
+    struct Statistics {
+        QHash<QString, qint64> tagIds;      // Missing names match nothing
+        QHash<QString, qint64> tagCounts;   // Active media per tag
+        qint64 totalMedia = 0;
+    };
+
+    struct Plan {
+        QString whereSql;       // Predicate over the "media" table
+        QVariantList params;
+        QString explain;
+        double estimatedRows = 0;
+    };
+
+    explicit TagQueryPlanner(const Statistics& stats);
+
+    Plan compile(const TagQuery& query) const;
+
+private:
+    struct Fragment;
+
+    Fragment compileNode(const TagQueryNode& node, bool topLevel) const;
+    Fragment compileTag(const QString& name, bool topLevel) const;
+    Fragment compileAnd(const TagQueryNode& node, bool topLevel) const;
+    Fragment compileOr(const TagQueryNode& node, bool topLevel) const;
+    Fragment compileNot(const TagQueryNode& node) const;
+    Fragment compileAttribute(const TagQueryNode& node) const;
+
+    double fraction(qint64 rows) const;
+
+    Statistics m_stats;
+};
+
+} // namespace KeyTagger
@@ -1,4 +1,5 @@
 #include "ThumbnailCache.h"
+#include "DecodeScheduler.h"
 #include <QImage>
 #include <QPainter>
 #include <QFileInfo>
@@ -211,7 +212,8 @@ void ThumbnailLoadTask::run() {
     QPixmap result;
     
     if (!m_path.isEmpty() && QFileInfo::exists(m_path)) {
-        QImage img(m_path);
+        // Under a decode permit, like every other worker-side decode
+        QImage img = DecodeScheduler::instance().decodeImage(m_path, m_targetSize);
         if (!img.isNull()) {
             // Scale to fit target size (square with padding)
             QImage scaled = img.scaled(m_targetSize, m_targetSize, 
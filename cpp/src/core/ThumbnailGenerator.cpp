@@ -0,0 +1,230 @@
+#include "ThumbnailGenerator.h"
+#include "Database.h"
+#include "DecodeScheduler.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QPainter>
+#include <QSaveFile>
+#include <QThread>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+namespace KeyTagger {
+
+namespace {
+
+constexpr int FillBatchSize = 64;
+
+// Requests run ahead of background fill jobs waiting in the pool
+constexpr int RequestPriority = 1;
+constexpr int FillPriority = 0;
+
+constexpr MediaFields GeneratorFields = MediaField::FilePath | MediaField::RootDir | MediaField::Sha256 |
+                                        MediaField::MediaType | MediaField::ThumbnailPath;
+
+bool saveJpeg(const QImage& image, const QString& destPath) {
+    QDir().mkpath(QFileInfo(destPath).absolutePath());
+    QSaveFile file(destPath);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    if (!image.save(&file, "JPEG", 85)) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+} // namespace
+
+ThumbnailGenerator::ThumbnailGenerator(Database* db, QObject* parent)
+    : QObject(parent)
+    , m_db(db)
+{
+    // Kept small: the gallery's own loads and a running scan share the cores
+    m_pool.setMaxThreadCount(qMax(2, QThread::idealThreadCount() / 4));
+}
+
+ThumbnailGenerator::~ThumbnailGenerator() {
+    m_token.cancel();
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+QString ThumbnailGenerator::thumbnailPathFor(const QString& rootDir, const QString& sha256) {
+    return QDir(rootDir).filePath("thumbnails/" + sha256 + ".jpg");
+}
+
+void ThumbnailGenerator::request(qint64 mediaId) {
+    if (mediaId <= 0 || m_pending.contains(mediaId) || m_unavailable.contains(mediaId)) return;
+    start(mediaId, std::nullopt, false);
+}
+
+void ThumbnailGenerator::startBackgroundFill(const QString& rootDir) {
+    m_fillRoot = rootDir.isEmpty() ? QString() : QDir(rootDir).absolutePath();
+    m_fillAfterId = 0;
+    m_fillBatch.clear();
+    scheduleFill();
+}
+
+void ThumbnailGenerator::stopBackgroundFill() {
+    m_fillRoot.clear();
+    m_fillBatch.clear();
+}
+
+void ThumbnailGenerator::start(qint64 mediaId, std::optional<MediaRecord> record, bool background) {
+    m_pending.insert(mediaId);
+    m_pool.start([this, mediaId, record = std::move(record), background]() {
+        // Requests carry only the id; the record is read here, off the GUI thread
+        std::optional<MediaRecord> media = record ? record : m_db->getMedia(mediaId, GeneratorFields);
+        QString thumbPath = media ? generate(*media) : QString();
+        QString filePath = media ? media->filePath : QString();
+
+        QMetaObject::invokeMethod(this, [this, mediaId, filePath, thumbPath, background]() {
+            onFinished(mediaId, filePath, thumbPath, background);
+        }, Qt::QueuedConnection);
+    }, background ? FillPriority : RequestPriority);
+}
+
+QString ThumbnailGenerator::generate(const MediaRecord& media) {
+    if (media.sha256.isEmpty() || media.filePath.isEmpty()) return QString();
+    if (media.mediaType != MediaType::Image && media.mediaType != MediaType::Video) return QString();
+
+    // Written since the gallery loaded its row
+    if (!media.thumbnailPath.isEmpty() && QFile::exists(media.thumbnailPath)) {
+        return media.thumbnailPath;
+    }
+
+    // A copy of the same content may have produced the file already
+    QString thumbPath = thumbnailPathFor(media.rootDir, media.sha256);
+    if (!QFile::exists(thumbPath)) {
+        bool written = media.mediaType == MediaType::Image
+            ? writeImageThumbnail(media.filePath, thumbPath, DefaultSize, &m_token)
+            : writeVideoThumbnail(media.filePath, thumbPath);
+        if (!written) return QString();
+    }
+
+    m_db->updateThumbnailPath(media.filePath, thumbPath);
+    return thumbPath;
+}
+
+void ThumbnailGenerator::onFinished(qint64 mediaId, const QString& filePath, const QString& thumbnailPath,
+                                    bool background) {
+    m_pending.remove(mediaId);
+    if (background) m_fillActive = false;
+
+    if (thumbnailPath.isEmpty()) {
+        m_unavailable.insert(mediaId);
+        emit thumbnailUnavailable(mediaId);
+    } else {
+        emit thumbnailReady(mediaId, filePath, thumbnailPath);
+    }
+
+    scheduleFill();
+}
+
+void ThumbnailGenerator::scheduleFill() {
+    // One background job at a time, and none while a request waits
+    if (m_fillRoot.isEmpty() || m_fillActive || !m_pending.isEmpty()) return;
+    m_fillActive = true;
+
+    if (!m_fillBatch.isEmpty()) {
+        MediaRecord record = m_fillBatch.takeFirst();
+        start(record.id, record, true);
+        return;
+    }
+
+    // The next batch is read on the pool too, keeping the query off the GUI thread
+    m_pool.start([this, rootDir = m_fillRoot, afterId = m_fillAfterId]() {
+        QVector<MediaRecord> batch = m_db->mediaWithoutThumbnails(rootDir, afterId, FillBatchSize);
+        QMetaObject::invokeMethod(this, [this, rootDir, batch]() {
+            onFillBatch(rootDir, batch);
+        }, Qt::QueuedConnection);
+    }, FillPriority);
+}
+
+void ThumbnailGenerator::onFillBatch(const QString& rootDir, const QVector<MediaRecord>& batch) {
+    m_fillActive = false;
+
+    // Read for a fill that has since been stopped or replaced
+    if (rootDir != m_fillRoot) {
+        scheduleFill();
+        return;
+    }
+
+    if (batch.isEmpty()) {
+        m_fillRoot.clear();
+        return;
+    }
+
+    m_fillAfterId = batch.last().id;
+    for (const MediaRecord& record : batch) {
+        if (!m_unavailable.contains(record.id)) m_fillBatch.append(record);
+    }
+    scheduleFill();
+}
+
+bool ThumbnailGenerator::writeImageThumbnail(const QString& sourcePath, const QString& destPath, int maxSize,
+                                             const CancellationToken* token) {
+    try {
+        // Twice the thumbnail edge keeps the smooth downscale below sharp
+        QImage img = DecodeScheduler::instance().decodeImage(sourcePath, maxSize * 2, token);
+        if (img.isNull()) return false;
+
+        // Scale to fit in maxSize x maxSize
+        QImage scaled = img.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+        // Convert to RGB if necessary
+        if (scaled.hasAlphaChannel()) {
+            QImage rgb(scaled.size(), QImage::Format_RGB32);
+            rgb.fill(Qt::black);
+            QPainter painter(&rgb);
+            painter.drawImage(0, 0, scaled);
+            painter.end();
+            scaled = rgb;
+        }
+
+        return saveJpeg(scaled, destPath);
+    } catch (...) {
+        return false;
+    }
+}
+
+bool ThumbnailGenerator::writeVideoThumbnail(const QString& sourcePath, const QString& destPath, int maxSize) {
+    try {
+        cv::VideoCapture cap(sourcePath.toStdString());
+        if (!cap.isOpened()) return false;
+
+        // Seek to middle frame
+        int frameCount = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_COUNT));
+        if (frameCount > 0) {
+            cap.set(cv::CAP_PROP_POS_FRAMES, frameCount / 2);
+        }
+
+        cv::Mat frame;
+        if (!cap.read(frame)) {
+            cap.release();
+            return false;
+        }
+
+        // Convert BGR to RGB
+        cv::Mat rgb;
+        cv::cvtColor(frame, rgb, cv::COLOR_BGR2RGB);
+
+        // Create QImage
+        QImage img(rgb.data, rgb.cols, rgb.rows, static_cast<int>(rgb.step), QImage::Format_RGB888);
+        QImage copy = img.copy(); // Make a deep copy since cv::Mat will be destroyed
+
+        cap.release();
+
+        // Scale
+        QImage scaled = copy.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+        return saveJpeg(scaled, destPath);
+    } catch (...) {
+        return false;
+    }
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+#include "CancellationToken.h"
+#include "MediaRecord.h"
+
+namespace KeyTagger {
+
+class Database;
+
+/**
+ * ThumbnailGenerator - Thumbnails written on demand and in the background
+ *
+ * The static writers produce the JPEGs a scan stores under
+ * <root>/thumbnails/<sha256>.jpg, and are shared with the scanner.
+ *
+ * An instance fills in records that have no thumbnail yet, as left by a
+ * metadata-first scan. request() serves a record the gallery could not
+ * show and runs ahead of everything else on a dedicated pool. The
+ * background fill walks a root in id order one record at a time, and
+ * only while no request is waiting, so it uses what is left idle. A
+ * record that cannot be thumbnailed is not retried until restart.
+ */
+class ThumbnailGenerator : public QObject {
+    Q_OBJECT
+
+public:
+    static constexpr int DefaultSize = 512;
+
+    explicit ThumbnailGenerator(Database* db, QObject* parent = nullptr);
+    ~ThumbnailGenerator();
+
+    // Generate the thumbnail of mediaId if it has none
+    void request(qint64 mediaId);
+
+    // Work through records under rootDir without a thumbnail; replaces any
+    // fill already running
+    void startBackgroundFill(const QString& rootDir);
+    void stopBackgroundFill();
+
+    // Where a scan of rootDir stores the thumbnail of content sha256
+    static QString thumbnailPathFor(const QString& rootDir, const QString& sha256);
+
+    // Write a JPEG thumbnail fitting maxSize x maxSize. The file is
+    // replaced atomically, so a reader never sees a partial image.
+    static bool writeImageThumbnail(const QString& sourcePath, const QString& destPath,
+                                    int maxSize = DefaultSize, const CancellationToken* token = nullptr);
+    static bool writeVideoThumbnail(const QString& sourcePath, const QString& destPath,
+                                    int maxSize = DefaultSize);
+
+signals:
+    void thumbnailReady(qint64 mediaId, const QString& filePath, const QString& thumbnailPath);
+    void thumbnailUnavailable(qint64 mediaId);
+
+private:
+    void start(qint64 mediaId, std::optional<MediaRecord> record, bool background);
+    // Runs on the pool; returns the thumbnail path, empty on failure
+    QString generate(const MediaRecord& media);
+    void onFinished(qint64 mediaId, const QString& filePath, const QString& thumbnailPath, bool background);
+    void onFillBatch(const QString& rootDir, const QVector<MediaRecord>& batch);
+    void scheduleFill();
+
+    Database* m_db;
+    QThreadPool m_pool;
+    CancellationToken m_token;
+
+    // GUI thread only
+    QSet<qint64> m_pending;
+    QSet<qint64> m_unavailable;
+    QString m_fillRoot;
+    qint64 m_fillAfterId = 0;
+    QVector<MediaRecord> m_fillBatch;
+    bool m_fillActive = false;              // A background job is queued or running
+};
+
+} // namespace KeyTagger
@@ -0,0 +1,461 @@
+#include "VideoMetadata.h"
+#include <QFile>
+#include <QtEndian>
+#include <climits>
+#include <cstring>
+#include <limits>
+
+namespace KeyTagger {
+
+namespace {
+
+// Bounds on work done for one file, whatever its headers claim
+constexpr int MaxBoxes = 1024;
+constexpr int MaxElements = 1024;
+
+// Seconds from 1904-01-01 (QuickTime) and 2001-01-01 (Matroska) to the Unix epoch
+constexpr qint64 QuickTimeEpochOffset = 2082844800;
+constexpr qint64 MatroskaEpochOffset = 978307200;
+
+bool readAt(QIODevice& device, qint64 offset, void* data, qint64 size) {
+    if (offset < 0 || size < 0 || offset > device.size() - size) return false;
+    return device.seek(offset) && device.read(static_cast<char*>(data), size) == size;
+}
+
+quint16 be16(const uchar* p) { return qFromBigEndian<quint16>(p); }
+quint32 be32(const uchar* p) { return qFromBigEndian<quint32>(p); }
+quint64 be64(const uchar* p) { return qFromBigEndian<quint64>(p); }
+quint32 le32(const uchar* p) { return qFromLittleEndian<quint32>(p); }
+
+// duration / timescale in milliseconds, without overflowing 64 bits
+std::optional<qint64> toMilliseconds(quint64 duration, quint64 timescale) {
+    if (timescale == 0 || duration == 0 || duration == ~quint64(0) || duration == 0xFFFFFFFF) return std::nullopt;
+    const quint64 ms = duration / timescale * 1000 + duration % timescale * 1000 / timescale;
+    return ms <= quint64(std::numeric_limits<qint64>::max()) ? std::optional<qint64>(qint64(ms)) : std::nullopt;
+}
+
+// ---- ISO base media (MP4, MOV, 3GP) ----
+
+struct Box {
+    char type[4];
+    qint64 payload = 0;
+    qint64 end = 0;
+
+    bool is(const char* name) const { return std::memcmp(type, name, 4) == 0; }
+};
+
+bool readBox(QIODevice& device, qint64 pos, qint64 limit, Box& box) {
+    uchar header[16];
+    if (pos > limit - 8 || !readAt(device, pos, header, 8)) return false;
+    quint64 size = be32(header);
+    qint64 headerSize = 8;
+    std::memcpy(box.type, header + 4, 4);
+    if (size == 1) {
+        if (!readAt(device, pos + 8, header + 8, 8)) return false;
+        size = be64(header + 8);
+        headerSize = 16;
+    } else if (size == 0) {
+        size = quint64(limit - pos);   // Extends to the end of its parent
+    }
+    if (size < quint64(headerSize) || size > quint64(limit - pos)) return false;
+    box.payload = pos + headerSize;
+    box.end = pos + qint64(size);
+    return true;
+}
+
+// Calls visit for each child box in [begin, end) until it returns false
+template <typename Visit>
+void forEachBox(QIODevice& device, qint64 begin, qint64 end, Visit visit) {
+    qint64 pos = begin;
+    Box box;
+    for (int i = 0; i < MaxBoxes && readBox(device, pos, end, box); ++i) {
+        if (!visit(box)) return;
+        pos = box.end;
+    }
+}
+
+bool findBox(QIODevice& device, const Box& parent, const char* type, Box& found) {
+    bool ok = false;
+    forEachBox(device, parent.payload, parent.end, [&](const Box& box) {
+        if (!box.is(type)) return true;
+        found = box;
+        ok = true;
+        return false;
+    });
+    return ok;
+}
+
+struct Track {
+    bool isVideo = false;
+    int width = 0;
+    int height = 0;
+    int rotation = 0;
+    QString codec;
+};
+
+// Display rotation from the a, b entries of a tkhd matrix (16.16 fixed point)
+int rotationOf(qint32 a, qint32 b) {
+    constexpr qint32 One = 0x10000;
+    if (a == 0 && b == One) return 90;
+    if (a == -One && b == 0) return 180;
+    if (a == 0 && b == -One) return 270;
+    return 0;
+}
+
+Track readTrack(QIODevice& device, const Box& trak) {
+    Track track;
+
+    Box tkhd;
+    uchar version = 0;
+    if (findBox(device, trak, "tkhd", tkhd) && readAt(device, tkhd.payload, &version, 1)) {
+        // Matrix then 16.16 width and height, after times sized by version
+        uchar tail[44];
+        if (readAt(device, tkhd.payload + (version == 1 ? 52 : 40), tail, sizeof(tail)) &&
+            tkhd.payload + (version == 1 ? 96 : 84) <= tkhd.end) {
+            track.rotation = rotationOf(qint32(be32(tail)), qint32(be32(tail + 4)));
+            track.width = int(be32(tail + 36) >> 16);
+            track.height = int(be32(tail + 40) >> 16);
+        }
+    }
+
+    Box mdia, hdlr, minf, stbl, stsd;
+    if (!findBox(device, trak, "mdia", mdia)) return track;
+
+    uchar handler[4];
+    if (findBox(device, mdia, "hdlr", hdlr) && hdlr.payload + 12 <= hdlr.end &&
+        readAt(device, hdlr.payload + 8, handler, 4)) {
+        track.isVideo = std::memcmp(handler, "vide", 4) == 0;
+    }
+    if (!track.isVideo) return track;
+
+    // First sample entry: codec fourcc, and for video the coded size
+    if (findBox(device, mdia, "minf", minf) && findBox(device, minf, "stbl", stbl) &&
+        findBox(device, stbl, "stsd", stsd)) {
+        uchar entry[36];
+        if (stsd.payload + 8 + 36 <= stsd.end && readAt(device, stsd.payload + 8, entry, sizeof(entry))) {
+            track.codec = QString::fromLatin1(reinterpret_cast<const char*>(entry + 4), 4);
+            if (be16(entry + 32) && be16(entry + 34)) {
+                track.width = be16(entry + 32);
+                track.height = be16(entry + 34);
+            }
+        }
+    }
+    return track;
+}
+
+void readMovieHeader(QIODevice& device, const Box& mvhd, VideoMetadata& meta) {
+    uchar header[32];
+    if (!readAt(device, mvhd.payload, header, 1)) return;
+    const bool wide = header[0] == 1;
+    const qint64 size = wide ? 4 + 28 : 4 + 16;
+    if (mvhd.payload + size > mvhd.end || !readAt(device, mvhd.payload, header, size)) return;
+
+    const quint64 created = wide ? be64(header + 4) : be32(header + 4);
+    const quint64 timescale = be32(header + (wide ? 20 : 12));
+    const quint64 duration = wide ? be64(header + 24) : be32(header + 16);
+
+    meta.durationMs = toMilliseconds(duration, timescale);
+    // Writers that do not know the time leave 0; ignore that and garbage
+    if (created > quint64(QuickTimeEpochOffset) && created < quint64(QuickTimeEpochOffset) * 4) {
+        meta.creationTimeUtc = qint64(created) - QuickTimeEpochOffset;
+    }
+}
+
+bool readIsoMedia(QIODevice& device, VideoMetadata& meta) {
+    bool found = false;
+    forEachBox(device, 0, device.size(), [&](const Box& box) {
+        if (box.is("ftyp")) {
+            char brand[4];
+            if (box.payload + 4 <= box.end && readAt(device, box.payload, brand, 4)) {
+                if (std::memcmp(brand, "qt  ", 4) == 0) meta.format = MediaTypes::Format::Mov;
+                else if (std::memcmp(brand, "3gp", 3) == 0) meta.format = MediaTypes::Format::ThreeGp;
+                else if (std::memcmp(brand, "M4V", 3) == 0) meta.format = MediaTypes::Format::M4v;
+            }
+            return true;
+        }
+        if (!box.is("moov")) return true;
+
+        found = true;
+        bool haveVideo = false;
+        forEachBox(device, box.payload, box.end, [&](const Box& child) {
+            if (child.is("mvhd")) {
+                readMovieHeader(device, child, meta);
+            } else if (child.is("trak") && !haveVideo) {
+                Track track = readTrack(device, child);
+                if (track.isVideo) {
+                    haveVideo = true;
+                    meta.width = track.width;
+                    meta.height = track.height;
+                    meta.rotation = track.rotation;
+                    meta.codec = track.codec;
+                }
+            }
+            return true;
+        });
+        return false;
+    });
+    return found;
+}
+
+// ---- Matroska and WebM ----
+
+namespace Ebml {
+constexpr quint32 Header = 0x1A45DFA3;
+constexpr quint32 DocType = 0x4282;
+constexpr quint32 Segment = 0x18538067;
+constexpr quint32 Info = 0x1549A966;
+constexpr quint32 TimestampScale = 0x2AD7B1;
+constexpr quint32 Duration = 0x4489;
+constexpr quint32 DateUtc = 0x4461;
+constexpr quint32 Tracks = 0x1654AE6B;
+constexpr quint32 TrackEntry = 0xAE;
+constexpr quint32 TrackType = 0x83;
+constexpr quint32 CodecId = 0x86;
+constexpr quint32 Video = 0xE0;
+constexpr quint32 PixelWidth = 0xB0;
+constexpr quint32 PixelHeight = 0xBA;
+constexpr quint32 Cluster = 0x1F43B675;
+}
+
+struct Element {
+    quint32 id = 0;
+    qint64 payload = 0;
+    qint64 end = 0;
+};
+
+// Variable-length integer: the count of leading zero bits gives its length.
+// IDs keep the length marker, sizes drop it.
+bool readVarInt(QIODevice& device, qint64& pos, qint64 limit, int maxLength, bool keepMarker,
+                quint64& value, bool* allOnes = nullptr) {
+    uchar bytes[8];
+    if (pos >= limit || !readAt(device, pos, bytes, 1) || bytes[0] == 0) return false;
+    int length = 1;
+    while (!(bytes[0] & (0x80 >> (length - 1)))) ++length;
+    if (length > maxLength || pos > limit - length || !readAt(device, pos + 1, bytes + 1, length - 1)) return false;
+
+    value = keepMarker ? bytes[0] : bytes[0] & (0xFF >> length);
+    bool ones = value == quint64(0xFF >> length);
+    for (int i = 1; i < length; ++i) {
+        value = value << 8 | bytes[i];
+        ones = ones && bytes[i] == 0xFF;
+    }
+    if (allOnes) *allOnes = ones;
+    pos += length;
+    return true;
+}
+
+bool readElement(QIODevice& device, qint64 pos, qint64 limit, Element& element) {
+    quint64 id = 0, size = 0;
+    bool unknownSize = false;
+    if (!readVarInt(device, pos, limit, 4, true, id) ||
+        !readVarInt(device, pos, limit, 8, false, size, &unknownSize)) {
+        return false;
+    }
+    element.id = quint32(id);
+    element.payload = pos;
+    // Only live-written segments and clusters leave their size open
+    if (unknownSize) {
+        element.end = limit;
+    } else if (size > quint64(limit - pos)) {
+        return false;
+    } else {
+        element.end = pos + qint64(size);
+    }
+    return true;
+}
+
+template <typename Visit>
+void forEachElement(QIODevice& device, qint64 begin, qint64 end, Visit visit) {
+    qint64 pos = begin;
+    Element element;
+    for (int i = 0; i < MaxElements && readElement(device, pos, end, element); ++i) {
+        if (!visit(element)) return;
+        pos = element.end;
+    }
+}
+
+bool readUnsigned(QIODevice& device, const Element& element, quint64& value) {
+    const qint64 size = element.end - element.payload;
+    uchar bytes[8];
+    if (size < 1 || size > 8 || !readAt(device, element.payload, bytes, size)) return false;
+    value = 0;
+    for (qint64 i = 0; i < size; ++i) value = value << 8 | bytes[i];
+    return true;
+}
+
+bool readFloat(QIODevice& device, const Element& element, double& value) {
+    uchar bytes[8];
+    const qint64 size = element.end - element.payload;
+    if (size == 4 && readAt(device, element.payload, bytes, 4)) {
+        const quint32 bits = be32(bytes);
+        float f;
+        std::memcpy(&f, &bits, 4);
+        value = f;
+        return true;
+    }
+    if (size == 8 && readAt(device, element.payload, bytes, 8)) {
+        const quint64 bits = be64(bytes);
+        std::memcpy(&value, &bits, 8);
+        return true;
+    }
+    return false;
+}
+
+QString readString(QIODevice& device, const Element& element) {
+    char text[64];
+    const qint64 size = qMin<qint64>(element.end - element.payload, sizeof(text));
+    if (size <= 0 || !readAt(device, element.payload, text, size)) return QString();
+    return QString::fromLatin1(text, int(qstrnlen(text, size)));
+}
+
+void readMatroskaTrack(QIODevice& device, const Element& entry, VideoMetadata& meta) {
+    quint64 type = 0;
+    QString codec;
+    quint64 width = 0, height = 0;
+    forEachElement(device, entry.payload, entry.end, [&](const Element& child) {
+        if (child.id == Ebml::TrackType) {
+            readUnsigned(device, child, type);
+        } else if (child.id == Ebml::CodecId) {
+            codec = readString(device, child);
+        } else if (child.id == Ebml::Video) {
+            forEachElement(device, child.payload, child.end, [&](const Element& video) {
+                if (video.id == Ebml::PixelWidth) readUnsigned(device, video, width);
+                if (video.id == Ebml::PixelHeight) readUnsigned(device, video, height);
+                return true;
+            });
+        }
+        return true;
+    });
+
+    // Track type 1 is video
+    if (type == 1) {
+        meta.width = int(qMin<quint64>(width, INT_MAX));
+        meta.height = int(qMin<quint64>(height, INT_MAX));
+        meta.codec = codec;
+    }
+}
+
+bool readMatroska(QIODevice& device, VideoMetadata& meta) {
+    Element header;
+    if (!readElement(device, 0, device.size(), header) || header.id != Ebml::Header) return false;
+
+    meta.format = MediaTypes::Format::Mkv;
+    forEachElement(device, header.payload, header.end, [&](const Element& child) {
+        if (child.id == Ebml::DocType && readString(device, child) == QLatin1String("webm")) {
+            meta.format = MediaTypes::Format::WebM;
+        }
+        return true;
+    });
+
+    Element segment;
+    if (!readElement(device, header.end, device.size(), segment) || segment.id != Ebml::Segment) return false;
+
+    quint64 timestampScale = 1000000;   // Nanoseconds per timestamp unit
+    double duration = 0;
+    bool haveVideo = false;
+    forEachElement(device, segment.payload, segment.end, [&](const Element& child) {
+        if (child.id == Ebml::Info) {
+            forEachElement(device, child.payload, child.end, [&](const Element& info) {
+                quint64 value = 0;
+                if (info.id == Ebml::TimestampScale && readUnsigned(device, info, value) && value) {
+                    timestampScale = value;
+                } else if (info.id == Ebml::Duration) {
+                    readFloat(device, info, duration);
+                } else if (info.id == Ebml::DateUtc && readUnsigned(device, info, value)) {
+                    // Signed nanoseconds since 2001
+                    meta.creationTimeUtc = qint64(value) / 1000000000 + MatroskaEpochOffset;
+                }
+                return true;
+            });
+        } else if (child.id == Ebml::Tracks) {
+            forEachElement(device, child.payload, child.end, [&](const Element& entry) {
+                if (entry.id == Ebml::TrackEntry) {
+                    readMatroskaTrack(device, entry, meta);
+                    haveVideo = meta.width > 0;
+                }
+                return !haveVideo;
+            });
+        }
+        // Info and Tracks precede the first cluster
+        return child.id != Ebml::Cluster;
+    });
+
+    const double ms = duration * double(timestampScale) / 1e6;
+    if (ms > 0 && ms < 1e15) {
+        meta.durationMs = qint64(ms);
+    }
+    return true;
+}
+
+// ---- AVI ----
+
+bool readAvi(QIODevice& device, VideoMetadata& meta) {
+    // RIFF "AVI " then LIST "hdrl", whose first chunk is the main header
+    uchar head[12 + 12 + 8 + 40];
+    if (!readAt(device, 0, head, sizeof(head)) || std::memcmp(head + 12, "LIST", 4) != 0 ||
+        std::memcmp(head + 20, "hdrl", 4) != 0 || std::memcmp(head + 24, "avih", 4) != 0) {
+        return false;
+    }
+    const uchar* avih = head + 32;
+    const quint64 microsPerFrame = le32(avih);
+    const quint64 frames = le32(avih + 16);
+    meta.format = MediaTypes::Format::Avi;
+    meta.width = int(le32(avih + 32) & 0xFFFF);
+    meta.height = int(le32(avih + 36) & 0xFFFF);
+    meta.durationMs = toMilliseconds(microsPerFrame * frames, 1000000);
+
+    // The first stream header names the codec
+    const qint64 hdrlEnd = qMin<qint64>(20 + qint64(le32(head + 16)), device.size());
+    const qint64 strl = 32 + qint64(le32(head + 28)) + (le32(head + 28) & 1);
+    uchar strh[12 + 8 + 8];
+    if (strl + qint64(sizeof(strh)) <= hdrlEnd && readAt(device, strl, strh, sizeof(strh)) &&
+        std::memcmp(strh, "LIST", 4) == 0 && std::memcmp(strh + 8, "strl", 4) == 0 &&
+        std::memcmp(strh + 12, "strh", 4) == 0 && std::memcmp(strh + 20, "vids", 4) == 0) {
+        meta.codec = QString::fromLatin1(reinterpret_cast<const char*>(strh + 24), 4);
+    }
+    return true;
+}
+
+} // namespace
+
+std::optional<VideoMetadata> VideoMetadata::read(const QString& filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return std::nullopt;
+    }
+    return read(file);
+}
+
+std::optional<VideoMetadata> VideoMetadata::read(QIODevice& device) {
+    using MediaTypes::Format;
+
+    uchar magic[12] = {};
+    if (!device.seek(0) || device.read(reinterpret_cast<char*>(magic), sizeof(magic)) != sizeof(magic)) {
+        return std::nullopt;
+    }
+
+    VideoMetadata meta;
+    bool ok = false;
+    if (be32(magic) == Ebml::Header) {
+        ok = readMatroska(device, meta);
+    } else if (std::memcmp(magic, "RIFF", 4) == 0 && std::memcmp(magic + 8, "AVI ", 4) == 0) {
+        ok = readAvi(device, meta);
+    } else {
+        // ISO files start with a box; QuickTime files need not start with ftyp
+        static const char* const firstBoxes[] = {"ftyp", "moov", "mdat", "free", "skip", "wide", "pnot"};
+        for (const char* type : firstBoxes) {
+            if (std::memcmp(magic + 4, type, 4) == 0) {
+                meta.format = std::memcmp(type, "ftyp", 4) == 0 ? Format::Mp4 : Format::Mov;
+                ok = readIsoMedia(device, meta);
+                break;
+            }
+        }
+    }
+
+    if (!ok || meta.width <= 0 || meta.height <= 0) {
+        return std::nullopt;
+    }
+    return meta;
+}
+
+} // namespace KeyTagger
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <QString>
+#include <QIODevice>
+#include <optional>
+#include "MediaTypes.h"
+
+namespace KeyTagger {
+
+/**
+ * VideoMetadata - Video facts read from container headers
+ *
+ * Parses ISO base media files (MP4, MOV, M4V, 3GP) through the
+ * moov/mvhd and trak/tkhd/mdia boxes, Matroska and WebM through the
+ * EBML Info and Tracks elements, and AVI through its avih header. Box
+ * and element headers are walked with seeks, skipping sample tables and
+ * media data, so a file costs a few small reads however long it is and
+ * no decoder or demuxer is opened. Like ImageMetadata every size read
+ * from the file is bounds-checked against its parent.
+ */
+struct VideoMetadata {
+    MediaTypes::Format format = MediaTypes::Format::None;
+    int width = 0;                          // Coded size of the first video track
+    int height = 0;
+    std::optional<qint64> durationMs;
+    std::optional<qint64> creationTimeUtc;
+    int rotation = 0;                       // Clockwise display rotation: 0, 90, 180 or 270
+    QString codec;                          // Sample entry ("avc1", "hvc1") or Matroska CodecID
+
+    // nullopt if the file cannot be opened or is not a recognized container
+    static std::optional<VideoMetadata> read(const QString& filePath);
+    // device must be open and seekable
+    static std::optional<VideoMetadata> read(QIODevice& device);
+};
+
+} // namespace KeyTagger
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QException>
+#include <QFuture>
+#include <optional>
+
+namespace KeyTagger {
+
+/**
+ * WriteFailed - Set on a write's future when the write did not happen
+ *
+ * Either the command hit a failed statement and its savepoint was rolled
+ * back, or the group commit holding it failed. result() and
+ * waitForFinished() rethrow it, then() continuations are skipped and
+ * onFailed() handlers run. writeResult() checks without throwing.
+ */
+class WriteFailed : public QException {
+public:
+    void raise() const override { throw *this; }
+    WriteFailed* clone() const override { return new WriteFailed(*this); }
+};
+
+// Waits for a write and returns its result, or nullopt if it failed
+template <typename T>
+std::optional<T> writeResult(const QFuture<T>& future) {
+    try {
+        return future.result();
+    } catch (const WriteFailed&) {
+        return std::nullopt;
+    }
+}
+
+// Waits for a write; false if it failed
+inline bool writeSucceeded(const QFuture<void>& future) {
+    try {
+        future.waitForFinished();
+        return true;
+    } catch (const WriteFailed&) {
+        return false;
+    }
+}
+
+} // namespace KeyTagger
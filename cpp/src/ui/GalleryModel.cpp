@@ -103,6 +103,7 @@ void GalleryModel::refresh() {
     m_cache->cancelPendingRequests();
     m_records.clear();
     m_idToRow.clear();
+    m_pathToRow.clear();
     m_tagsCache.clear();
     
     auto result = m_db->queryMedia(
@@ -110,9 +111,11 @@ void GalleryModel::refresh() {
         m_searchText,
         10000,  // Load all for now (pagination can be added later)
         0,
-        "modified_time_utc DESC, id DESC",
+        Database::DefaultMediaOrder,
         m_rootDir,
-        m_tagsMatchAll
+        m_tagsMatchAll,
+        m_tagExpression,
+        GridMediaFields
     );
     
     m_records = result.records;
@@ -120,16 +123,19 @@ void GalleryModel::refresh() {
     
     for (int i = 0; i < m_records.size(); ++i) {
         m_idToRow[m_records[i].id] = i;
+        m_pathToRow[m_records[i].filePath] = i;
     }
     
     endResetModel();
     emit dataRefreshed();
 }
 
-void GalleryModel::setFilter(const QStringList& tags, const QString& searchText, bool tagsMatchAll) {
+void GalleryModel::setFilter(const QStringList& tags, const QString& searchText,
+                             bool tagsMatchAll, const QString& tagExpression) {
     m_filterTags = tags;
     m_searchText = searchText;
     m_tagsMatchAll = tagsMatchAll;
+    m_tagExpression = tagExpression;
     refresh();
 }
 
@@ -233,10 +239,23 @@ int GalleryModel::rowForMediaId(qint64 mediaId) const {
     return m_idToRow.value(mediaId, -1);
 }
 
+void GalleryModel::setThumbnailPath(const QString& filePath, const QString& thumbnailPath) {
+    int row = m_pathToRow.value(filePath, -1);
+    if (row < 0 || m_records[row].thumbnailPath == thumbnailPath) return;
+    
+    m_records[row].thumbnailPath = thumbnailPath;
+    QModelIndex idx = index(row);
+    emit dataChanged(idx, idx, {Qt::DecorationRole, ThumbnailPathRole});
+}
+
 int GalleryModel::totalCount() const {
     return m_totalCount;
 }
 
+QHash<QString, int> GalleryModel::facetCounts() const {
+    return m_db->facetCounts(m_filterTags, m_searchText, m_rootDir, m_tagsMatchAll, m_tagExpression);
+}
+
 int GalleryModel::thumbnailSize() const {
     return m_thumbnailSize;
 }
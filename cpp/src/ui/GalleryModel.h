@@ -47,7 +47,7 @@ public:
     // Data management
     void refresh();
     void setFilter(const QStringList& tags, const QString& searchText = QString(),
-                   bool tagsMatchAll = true);
+                   bool tagsMatchAll = true, const QString& tagExpression = QString());
     void setRootDir(const QString& rootDir);
     
     // Selection
@@ -65,9 +65,15 @@ public:
     MediaRecord recordAt(int row) const;
     int rowForMediaId(qint64 mediaId) const;
     
+    // Point a loaded row at a thumbnail written since the last refresh
+    void setThumbnailPath(const QString& filePath, const QString& thumbnailPath);
+    
     // Total count (for pagination info)
     int totalCount() const;
     
+    // Per-tag counts within the filtered results, for the sidebar
+    QHash<QString, int> facetCounts() const;
+    
     // Thumbnail size
     int thumbnailSize() const;
     void setThumbnailSize(int size);
@@ -88,12 +94,14 @@ private:
     
     QVector<MediaRecord> m_records;
     QHash<qint64, int> m_idToRow;
+    QHash<QString, int> m_pathToRow;
     QSet<qint64> m_selectedIds;
     
     // Filter state
     QStringList m_filterTags;
     QString m_searchText;
     bool m_tagsMatchAll = true;
+    QString m_tagExpression;
     QString m_rootDir;
     
     int m_totalCount = 0;
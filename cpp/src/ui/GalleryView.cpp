@@ -6,6 +6,8 @@
 #include <QKeyEvent>
 #include <QContextMenuEvent>
 #include <QScrollBar>
+#include <QTimer>
+#include <QFileInfo>
 #include <QApplication>
 #include <QDebug>
 
@@ -41,6 +43,13 @@ GalleryView::GalleryView(QWidget* parent)
     
     connect(this, &QListView::clicked, this, &GalleryView::onClicked);
     connect(this, &QListView::doubleClicked, this, &GalleryView::onDoubleClicked);
+    
+    // Report what is on screen once scrolling pauses
+    m_visibleTimer = new QTimer(this);
+    m_visibleTimer->setSingleShot(true);
+    m_visibleTimer->setInterval(150);
+    connect(m_visibleTimer, &QTimer::timeout, this, &GalleryView::reportVisibleItems);
+    connect(verticalScrollBar(), &QScrollBar::valueChanged, m_visibleTimer, qOverload<>(&QTimer::start));
 }
 
 void GalleryView::setModel(GalleryModel* model) {
@@ -50,6 +59,7 @@ void GalleryView::setModel(GalleryModel* model) {
     if (m_model) {
         connect(m_model, &GalleryModel::selectionChanged, 
                 this, &GalleryView::selectionChanged);
+        connect(m_model, &GalleryModel::dataRefreshed, m_visibleTimer, qOverload<>(&QTimer::start));
     }
     
     updateGridSize();
@@ -235,6 +245,7 @@ void GalleryView::contextMenuEvent(QContextMenuEvent* event) {
 void GalleryView::resizeEvent(QResizeEvent* event) {
     QListView::resizeEvent(event);
     updateGridSize();
+    m_visibleTimer->start();
 }
 
 void GalleryView::wheelEvent(QWheelEvent* event) {
@@ -267,6 +278,32 @@ void GalleryView::updateGridSize() {
     setGridSize(itemSize);
 }
 
+void GalleryView::reportVisibleItems() {
+    if (!m_model || gridSize().isEmpty()) return;
+    
+    // The grid is uniform, so the first visible row follows from the scroll
+    // offset; walk from one line above it while items still intersect
+    const QRect area = viewport()->rect();
+    const int columns = qMax(1, area.width() / gridSize().width());
+    const int firstLine = qMax(0, verticalOffset() / gridSize().height() - 1);
+    
+    QStringList missing;
+    for (int row = firstLine * columns; row < m_model->rowCount(); ++row) {
+        QModelIndex idx = m_model->index(row);
+        QRect rect = visualRect(idx);
+        if (rect.top() > area.bottom()) break;
+        if (!rect.intersects(area)) continue;
+        
+        if (idx.data(GalleryModel::MediaTypeRole).toInt() == static_cast<int>(MediaType::Audio)) continue;
+        QString thumbPath = idx.data(GalleryModel::ThumbnailPathRole).toString();
+        if (thumbPath.isEmpty() || !QFileInfo::exists(thumbPath)) {
+            missing << idx.data(GalleryModel::FilePathRole).toString();
+        }
+    }
+    
+    emit visibleItemsNeedThumbnails(missing);
+}
+
 qint64 GalleryView::mediaIdAt(const QModelIndex& index) const {
     if (!index.isValid()) return 0;
     return index.data(GalleryModel::MediaIdRole).toLongLong();
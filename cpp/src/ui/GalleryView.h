@@ -2,6 +2,9 @@
 
 #include <QListView>
 #include <QSet>
+#include <QStringList>
+
+class QTimer;
 
 namespace KeyTagger {
 
@@ -46,6 +49,9 @@ signals:
     void mediaSelected(qint64 mediaId);
     void selectionChanged();
     void contextMenuRequested(qint64 mediaId, const QPoint& globalPos);
+    // Files on screen whose thumbnail is not on disk yet, reported once
+    // scrolling or resizing settles
+    void visibleItemsNeedThumbnails(const QStringList& filePaths);
 
 protected:
     void mousePressEvent(QMouseEvent* event) override;
@@ -58,11 +64,13 @@ protected:
 private slots:
     void onClicked(const QModelIndex& index);
     void onDoubleClicked(const QModelIndex& index);
+    void reportVisibleItems();
 
 private:
     void updateGridSize();
     qint64 mediaIdAt(const QModelIndex& index) const;
     
+    QTimer* m_visibleTimer = nullptr;
     GalleryModel* m_model = nullptr;
     GalleryDelegate* m_delegate = nullptr;
     ThumbnailCache* m_cache = nullptr;
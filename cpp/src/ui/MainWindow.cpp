@@ -2,7 +2,9 @@
 #include "Database.h"
 #include "Scanner.h"
 #include "ThumbnailCache.h"
+#include "ThumbnailGenerator.h"
 #include "Config.h"
+#include "DecodeScheduler.h"
 #include "GalleryView.h"
 #include "GalleryModel.h"
 #include "Sidebar.h"
@@ -15,6 +17,7 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QMessageBox>
 #include <QProgressDialog>
 #include <QMenuBar>
@@ -43,11 +46,15 @@ MainWindow::MainWindow(QWidget* parent)
     m_db = std::make_unique<Database>(".");
     m_scanner = std::make_unique<Scanner>(m_db.get());
     m_thumbnailCache = std::make_unique<ThumbnailCache>(500);
+    m_thumbnailGenerator = std::make_unique<ThumbnailGenerator>(m_db.get());
     m_hotkeyManager = std::make_unique<HotkeyManager>(this);
     
     // Load configuration
     Config::instance().load();
     m_darkMode = Config::instance().darkMode();
+    m_db->setTagIndexEnabled(Config::instance().tagIndexEnabled());
+    DecodeScheduler::instance().setBudget(qint64(Config::instance().decodeBudgetMb()) << 20);
+    m_scanner->setMetadataFirst(Config::instance().metadataFirstScan());
     
     setupUi();
     setupConnections();
@@ -134,6 +141,7 @@ void MainWindow::setupUi() {
     QMenu* fileMenu = menuBar->addMenu("&File");
     fileMenu->addAction("&Pick Folder...", this, &MainWindow::onPickFolder, QKeySequence::Open);
     fileMenu->addAction("&Scan Folder", this, &MainWindow::onScanFolder);
+    fileMenu->addAction("&Relink Folder...", this, &MainWindow::onRelinkFolder);
     fileMenu->addSeparator();
     fileMenu->addAction("&Settings...", this, &MainWindow::openSettings);
     fileMenu->addSeparator();
@@ -176,10 +184,27 @@ void MainWindow::setupConnections() {
     connect(m_galleryView, &GalleryView::mediaSelected, this, &MainWindow::onMediaSelected);
     connect(m_galleryView, &GalleryView::mediaActivated, this, &MainWindow::onMediaActivated);
     connect(m_galleryView, &GalleryView::contextMenuRequested, this, &MainWindow::onContextMenuRequested);
+    connect(m_galleryModel, &GalleryModel::dataRefreshed, this, &MainWindow::updateFacets);
     
     // Scanner
     connect(m_scanner.get(), &Scanner::scanProgress, this, &MainWindow::onScanProgress);
     connect(m_scanner.get(), &Scanner::scanFinished, this, &MainWindow::onScanFinished);
+    connect(m_scanner.get(), &Scanner::thumbnailReady, m_galleryModel, &GalleryModel::setThumbnailPath);
+    
+    // Thumbnails missing on disk are generated when the gallery asks for them
+    connect(m_thumbnailCache.get(), &ThumbnailCache::thumbnailFailed,
+            m_thumbnailGenerator.get(), &ThumbnailGenerator::request);
+    connect(m_thumbnailGenerator.get(), &ThumbnailGenerator::thumbnailReady, this,
+            [this](qint64, const QString& filePath, const QString& thumbnailPath) {
+        m_galleryModel->setThumbnailPath(filePath, thumbnailPath);
+    });
+    
+    // While scanning, what the gallery shows is scanned first
+    connect(m_galleryView, &GalleryView::visibleItemsNeedThumbnails, this, [this](const QStringList& paths) {
+        if (m_scanner->isRunning()) {
+            m_scanner->prioritize(paths, m_sidebar->currentFolder());
+        }
+    });
     
     // Tag input
     connect(m_tagInput, &TagInputWidget::tagSubmitted, this, &MainWindow::onTagSubmitted);
@@ -232,6 +257,7 @@ void MainWindow::loadSettings() {
     if (!lastDir.isEmpty()) {
         m_sidebar->setCurrentFolder(lastDir);
         m_galleryModel->setRootDir(lastDir);
+        m_thumbnailGenerator->startBackgroundFill(lastDir);
     }
     
     QByteArray geometry = Config::instance().windowGeometry();
@@ -364,6 +390,9 @@ void MainWindow::onPickFolder() {
         Config::instance().save();
         
         m_galleryModel->setRootDir(dir);
+        if (!m_scanner->isRunning()) {
+            m_thumbnailGenerator->startBackgroundFill(dir);
+        }
     }
 }
 
@@ -375,8 +404,17 @@ void MainWindow::onScanFolder() {
         if (folder.isEmpty()) return;
     }
     
+    if (m_scanner->isRunning()) {
+        showToast("A scan is already running");
+        return;
+    }
+    
+    // The fill resumes once the scan has stored everything
+    m_thumbnailGenerator->stopBackgroundFill();
+    
+    // Non-modal so the gallery can be browsed while the scan runs
     m_progressDialog = new QProgressDialog("Scanning...", "Cancel", 0, 100, this);
-    m_progressDialog->setWindowModality(Qt::WindowModal);
+    m_progressDialog->setWindowModality(Qt::NonModal);
     m_progressDialog->setAutoClose(true);
     m_progressDialog->setMinimumDuration(0);
     
@@ -386,6 +424,45 @@ void MainWindow::onScanFolder() {
     m_scanner->scanDirectory(folder, thumbDir);
 }
 
+void MainWindow::onRelinkFolder() {
+    QStringList roots = m_db->rootFolders();
+    if (roots.isEmpty()) {
+        showToast("No scanned folders to relink");
+        return;
+    }
+    
+    int current = qMax(0, int(roots.indexOf(QDir(m_sidebar->currentFolder()).absolutePath())));
+    bool ok = false;
+    QString oldPath = QInputDialog::getItem(this, "Relink Folder",
+        "Folder that was moved or remounted:", roots, current, false, &ok);
+    if (!ok || oldPath.isEmpty()) return;
+    
+    QString newPath = QFileDialog::getExistingDirectory(this, "New Location of " + oldPath, oldPath);
+    if (newPath.isEmpty()) return;
+    
+    // Only the root row changes; tags and thumbnails stay attached
+    m_db->relinkRoot(oldPath, newPath).then(this, [this, oldPath, newPath](bool relinked) {
+        if (!relinked) {
+            showToast("Could not relink " + oldPath);
+            return;
+        }
+        if (QDir(m_sidebar->currentFolder()).absolutePath() == oldPath) {
+            m_sidebar->setCurrentFolder(newPath);
+            Config::instance().setLastRootDir(newPath);
+            Config::instance().save();
+            m_galleryModel->setRootDir(newPath);
+            if (!m_scanner->isRunning()) {
+                m_thumbnailGenerator->startBackgroundFill(newPath);
+            }
+        } else {
+            refreshGallery();
+        }
+        showToast("Relinked to " + newPath);
+    }).onFailed(this, [this, oldPath](const WriteFailed&) {
+        showToast("Could not relink " + oldPath);
+    });
+}
+
 void MainWindow::onScanProgress(int current, int total, const QString& file) {
     if (m_progressDialog) {
         m_progressDialog->setMaximum(total);
@@ -404,9 +481,36 @@ void MainWindow::onScanFinished(ScanResult result) {
     
     refreshGallery();
     m_sidebar->refreshTags();
+    m_thumbnailGenerator->startBackgroundFill(m_sidebar->currentFolder());
+    
+    showToast(QString("%6: %1 scanned, %2 added/updated (%3 moved), %4 errors, "
+                      "%5 known failures skipped")
+        .arg(result.scanned).arg(result.addedOrUpdated).arg(result.moved).arg(result.errors)
+        .arg(result.skipped.size()).arg(result.cancelled ? "Scan cancelled" : "Scan complete"));
     
-    showToast(QString("Scan complete: %1 scanned, %2 added/updated, %3 errors")
-        .arg(result.scanned).arg(result.addedOrUpdated).arg(result.errors));
+    if (!result.failures.isEmpty() || !result.skipped.isEmpty()) {
+        QStringList lines;
+        for (const auto& failure : std::as_const(result.failures)) {
+            lines << QString("%1: %2").arg(failure.first, failure.second);
+        }
+        if (!result.skipped.isEmpty()) {
+            if (!lines.isEmpty()) lines << QString();
+            lines << "Skipped, failed in an earlier scan:";
+            for (const auto& skipped : std::as_const(result.skipped)) {
+                const QString errorClass = skipped.errorClass == MediaError::Unreadable
+                    ? "unreadable, retried later" : "undecodable, retried once changed";
+                lines << QString("%1: %2 (%3)").arg(skipped.path, skipped.error, errorClass);
+            }
+        }
+        
+        QMessageBox box(QMessageBox::Warning, "Scan Errors",
+            QString("%1 file(s) could not be processed and %2 known failure(s) were skipped. "
+                    "Unreadable files are retried later; undecodable ones once they change.")
+                .arg(result.failures.size()).arg(result.skipped.size()),
+            QMessageBox::Ok, this);
+        box.setDetailedText(lines.join('\n'));
+        box.exec();
+    }
 }
 
 void MainWindow::openSettings() {
@@ -512,15 +616,17 @@ void MainWindow::onContextMenuRequested(qint64 mediaId, const QPoint& globalPos)
         action->setCheckable(true);
         action->setChecked(currentTags.contains(tag));
         connect(action, &QAction::triggered, this, [this, tag, mediaId](bool checked) {
-            if (checked) {
-                m_db->addMediaTags(mediaId, {tag});
-            } else {
-                m_db->removeMediaTags(mediaId, {tag});
-            }
-            m_galleryModel->onTagsChanged();
-            if (m_currentMediaId == mediaId) {
-                updateCurrentMediaTags();
-            }
+            QFuture<void> write = checked
+                ? m_db->addMediaTags(mediaId, {tag})
+                : m_db->removeMediaTags(mediaId, {tag});
+            write.then(this, [this, mediaId]() {
+                m_galleryModel->onTagsChanged();
+                if (m_currentMediaId == mediaId) {
+                    updateCurrentMediaTags();
+                }
+            }).onFailed(this, [this, tag](const WriteFailed&) {
+                showToast("Could not update tag " + tag);
+            });
         });
     }
     
@@ -532,8 +638,11 @@ void MainWindow::onContextMenuRequested(qint64 mediaId, const QPoint& globalPos)
                     "The file will not be deleted from disk.")
                 .arg(record->fileName));
         if (result == QMessageBox::Yes) {
-            m_db->deleteMedia(record->filePath);
-            refreshGallery();
+            m_db->deleteMedia(record->filePath).then(this, [this](bool) {
+                refreshGallery();
+            }).onFailed(this, [this](const WriteFailed&) {
+                showToast("Could not remove from database");
+            });
         }
     });
     
@@ -547,9 +656,10 @@ void MainWindow::onThumbnailSizeChanged(int size) {
 
 void MainWindow::onFilterChanged() {
     QStringList tags = m_sidebar->selectedFilterTags().values();
-    QString search; // TODO: Add search box
+    QString search = m_sidebar->searchText();
+    QString expression = m_sidebar->tagExpression();
     
-    m_galleryModel->setFilter(tags, search, false);
+    m_galleryModel->setFilter(tags, search, false, expression);
 }
 
 void MainWindow::onTagSubmitted(const QString& tag) {
@@ -595,9 +705,13 @@ void MainWindow::applyTagToSelection(const QString& tag) {
         m_db->addMediaTags(id, {tag});
     }
     
-    m_galleryModel->onTagsChanged();
-    m_sidebar->refreshTags();
-    updateCurrentMediaTags();
+    // Refresh once the writer has committed; the GUI never waits on it
+    m_db->flush().then(this, [this]() {
+        m_galleryModel->onTagsChanged();
+        m_sidebar->refreshTags();
+        updateFacets();
+        updateCurrentMediaTags();
+    });
 }
 
 void MainWindow::removeTagFromSelection(const QString& tag) {
@@ -610,9 +724,13 @@ void MainWindow::removeTagFromSelection(const QString& tag) {
         m_db->removeMediaTags(id, {tag});
     }
     
-    m_galleryModel->onTagsChanged();
-    m_sidebar->refreshTags();
-    updateCurrentMediaTags();
+    // Refresh once the writer has committed; the GUI never waits on it
+    m_db->flush().then(this, [this]() {
+        m_galleryModel->onTagsChanged();
+        m_sidebar->refreshTags();
+        updateFacets();
+        updateCurrentMediaTags();
+    });
 }
 
 void MainWindow::updateCurrentMediaTags() {
@@ -628,6 +746,10 @@ void MainWindow::refreshGallery() {
     m_galleryModel->refresh();
 }
 
+void MainWindow::updateFacets() {
+    m_sidebar->setFacetCounts(m_galleryModel->facetCounts());
+}
+
 void MainWindow::updateViewerMedia() {
     auto selectedIds = m_galleryModel->selectedIds();
     
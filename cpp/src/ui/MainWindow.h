@@ -13,6 +13,7 @@ namespace KeyTagger {
 class Database;
 class Scanner;
 class ThumbnailCache;
+class ThumbnailGenerator;
 class GalleryView;
 class GalleryModel;
 class Sidebar;
@@ -44,6 +45,7 @@ protected:
 private slots:
     void onPickFolder();
     void onScanFolder();
+    void onRelinkFolder();
     void onScanProgress(int current, int total, const QString& file);
     void onScanFinished(ScanResult result);
     void openSettings();
@@ -68,6 +70,7 @@ private slots:
     void applyTagToSelection(const QString& tag);
     void removeTagFromSelection(const QString& tag);
     void updateCurrentMediaTags();
+    void updateFacets();
 
 private:
     void setupUi();
@@ -86,6 +89,7 @@ private:
     std::unique_ptr<Database> m_db;
     std::unique_ptr<Scanner> m_scanner;
     std::unique_ptr<ThumbnailCache> m_thumbnailCache;
+    std::unique_ptr<ThumbnailGenerator> m_thumbnailGenerator;
     
     // UI components
     QSplitter* m_mainSplitter = nullptr;
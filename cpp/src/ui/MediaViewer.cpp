@@ -1,5 +1,6 @@
 #include "MediaViewer.h"
 #include "MediaRecord.h"
+#include "MediaTypes.h"
 #include <QVBoxLayout>
 #include <QResizeEvent>
 #include <QContextMenuEvent>
@@ -60,8 +61,7 @@ void MediaViewer::setMedia(const MediaRecord& record) {
     
     switch (record.mediaType) {
         case MediaType::Image: {
-            QString ext = QFileInfo(record.filePath).suffix().toLower();
-            if (ext == "gif") {
+            if (MediaTypes::formatOf(record.filePath) == MediaTypes::Format::Gif) {
                 showGif(record.filePath);
             } else {
                 showImage(record.filePath);
@@ -1,6 +1,7 @@
 #include "Sidebar.h"
 #include "Database.h"
 #include "Config.h"
+#include "TagQuery.h"
 
 #include <QVBoxLayout>
 #include <QHBoxLayout>
@@ -12,6 +13,7 @@
 #include <QScrollArea>
 #include <QCheckBox>
 #include <QFrame>
+#include <QTimer>
 #include <QDebug>
 
 namespace KeyTagger {
@@ -190,6 +192,29 @@ void Sidebar::setupTagsTab(QWidget* tab) {
     sep2->setObjectName("separator");
     layout->addWidget(sep2);
     
+    // Search
+    QLabel* searchTitle = new QLabel("Search", tab);
+    searchTitle->setObjectName("sectionTitle");
+    layout->addWidget(searchTitle);
+    
+    m_searchEdit = new QLineEdit(tab);
+    m_searchEdit->setPlaceholderText("Name, folder or tag (\"phrase\")");
+    m_searchEdit->setClearButtonEnabled(true);
+    layout->addWidget(m_searchEdit);
+    
+    m_tagQueryEdit = new QLineEdit(tab);
+    m_tagQueryEdit->setPlaceholderText("Tag query, e.g. cat AND NOT blurry");
+    m_tagQueryEdit->setClearButtonEnabled(true);
+    layout->addWidget(m_tagQueryEdit);
+    
+    // Wait for a pause in typing before re-querying
+    m_searchDebounce = new QTimer(this);
+    m_searchDebounce->setSingleShot(true);
+    m_searchDebounce->setInterval(SearchDebounceMs);
+    connect(m_searchEdit, &QLineEdit::textChanged, m_searchDebounce, qOverload<>(&QTimer::start));
+    connect(m_tagQueryEdit, &QLineEdit::textChanged, m_searchDebounce, qOverload<>(&QTimer::start));
+    connect(m_searchDebounce, &QTimer::timeout, this, &Sidebar::onFilterTextSettled);
+    
     // Tag filters
     QLabel* tagTitle = new QLabel("Filter by Tags", tab);
     tagTitle->setObjectName("sectionTitle");
@@ -435,6 +460,12 @@ void Sidebar::refreshTags() {
     rebuildTagList();
 }
 
+void Sidebar::setFacetCounts(const QHash<QString, int>& counts) {
+    m_facetCounts = counts;
+    m_hasFacets = true;
+    updateTagLabels();
+}
+
 QString Sidebar::currentFolder() const {
     return m_folderEdit->text();
 }
@@ -455,6 +486,14 @@ bool Sidebar::showUntaggedOnly() const {
     return m_showUntagged;
 }
 
+QString Sidebar::searchText() const {
+    return m_searchEdit ? m_searchEdit->text().trimmed() : QString();
+}
+
+QString Sidebar::tagExpression() const {
+    return m_tagExpression;
+}
+
 void Sidebar::onThumbnailSliderChanged(int value) {
     m_thumbSizeLabel->setText(QString::number(value) + "px");
     Config::instance().setThumbnailSize(value);
@@ -481,6 +520,24 @@ void Sidebar::onUntaggedToggled(bool checked) {
     emit filterChanged();
 }
 
+void Sidebar::onFilterTextSettled() {
+    QString text = m_tagQueryEdit->text().trimmed();
+    TagQuery query = TagQuery::parse(text);
+    
+    // Keep filtering by the last valid expression while one is being typed
+    if (query.isValid()) {
+        m_tagExpression = text;
+        m_tagQueryEdit->setStyleSheet(QString());
+        m_tagQueryEdit->setToolTip(text.isEmpty() ? QString() : m_db->explainTagQuery(text));
+    } else {
+        m_tagQueryEdit->setStyleSheet("border: 1px solid #d9534f;");
+        m_tagQueryEdit->setToolTip(QString("Column %1: %2")
+            .arg(query.errorPosition() + 1).arg(query.errorString()));
+    }
+    
+    emit filterChanged();
+}
+
 void Sidebar::onAddHotkeyClicked() {
     QString key = m_hotkeyKeyEdit->text().trimmed().toLower();
     QString tag = m_hotkeyTagEdit->text().trimmed().toLower();
@@ -554,14 +611,15 @@ void Sidebar::rebuildTagList() {
         delete checkbox;
     }
     m_tagCheckboxes.clear();
+    m_tagTotals.clear();
     
     auto tagCounts = m_db->tagCounts();
     
     for (const auto& pair : tagCounts) {
         QString tagName = pair.first;
-        int count = pair.second;
+        m_tagTotals[tagName] = pair.second;
         
-        QCheckBox* checkbox = new QCheckBox(QString("%1 (%2)").arg(tagName).arg(count));
+        QCheckBox* checkbox = new QCheckBox();
         checkbox->setProperty("tagName", tagName);
         checkbox->setChecked(m_selectedTags.contains(tagName));
         connect(checkbox, &QCheckBox::toggled, this, &Sidebar::onTagCheckboxToggled);
@@ -569,11 +627,29 @@ void Sidebar::rebuildTagList() {
         m_tagListLayout->insertWidget(m_tagListLayout->count() - 1, checkbox);
         m_tagCheckboxes[tagName] = checkbox;
     }
+    updateTagLabels();
     
     // Update untagged count
     int untaggedCount = m_db->untaggedCount();
     m_untaggedCheckbox->setText(QString("Show Untagged Only (%1)").arg(untaggedCount));
 }
 
-} // namespace KeyTagger
+void Sidebar::updateTagLabels() {
+    for (auto it = m_tagCheckboxes.cbegin(); it != m_tagCheckboxes.cend(); ++it) {
+        const QString& tagName = it.key();
+        int total = m_tagTotals.value(tagName);
+        
+        // "tag (facet/total)" once the current results narrow the library
+        if (m_hasFacets && m_facetCounts.value(tagName) != total) {
+            int facet = m_facetCounts.value(tagName);
+            it.value()->setText(QString("%1 (%2/%3)").arg(tagName).arg(facet).arg(total));
+            it.value()->setToolTip(QString("%1 of the current results, %2 in the library")
+                .arg(facet).arg(total));
+        } else {
+            it.value()->setText(QString("%1 (%2)").arg(tagName).arg(total));
+            it.value()->setToolTip(QString());
+        }
+    }
+}
 
+} // namespace KeyTagger
@@ -11,6 +11,7 @@ class QScrollArea;
 class QCheckBox;
 class QLabel;
 class QTabWidget;
+class QTimer;
 
 namespace KeyTagger {
 
@@ -23,7 +24,9 @@ class Config;
  * Features:
  * - Folder picker and scan controls
  * - Thumbnail size slider
- * - Tag filter checkboxes with counts
+ * - Debounced full-text search box
+ * - Boolean tag query box (cat AND NOT blurry, type:video, width>3000)
+ * - Tag filter checkboxes with library and in-result counts
  * - Hotkey configuration
  * - Mode toggles (viewing, tagging)
  */
@@ -35,6 +38,8 @@ public:
     
     void setDarkMode(bool dark);
     void refreshTags();
+    // Counts within the current results, shown next to the library totals
+    void setFacetCounts(const QHash<QString, int>& counts);
     
     QString currentFolder() const;
     void setCurrentFolder(const QString& path);
@@ -43,6 +48,8 @@ public:
     
     QSet<QString> selectedFilterTags() const;
     bool showUntaggedOnly() const;
+    QString searchText() const;
+    QString tagExpression() const;
 
 signals:
     void pickFolderClicked();
@@ -60,6 +67,7 @@ private slots:
     void onThumbnailSliderChanged(int value);
     void onTagCheckboxToggled(bool checked);
     void onUntaggedToggled(bool checked);
+    void onFilterTextSettled();
     void onAddHotkeyClicked();
     void onRemoveHotkeyClicked();
 
@@ -69,6 +77,7 @@ private:
     void setupTagsTab(QWidget* tab);
     void rebuildHotkeyList();
     void rebuildTagList();
+    void updateTagLabels();
     void applyTheme();
     
     Database* m_db;
@@ -87,10 +96,16 @@ private:
     QPushButton* m_dbFolderBtn = nullptr;
     
     // Tags tab
+    QLineEdit* m_searchEdit = nullptr;
+    QLineEdit* m_tagQueryEdit = nullptr;
+    QTimer* m_searchDebounce = nullptr;
     QWidget* m_tagListWidget = nullptr;
     QVBoxLayout* m_tagListLayout = nullptr;
     QCheckBox* m_untaggedCheckbox = nullptr;
     QHash<QString, QCheckBox*> m_tagCheckboxes;
+    QHash<QString, int> m_tagTotals;
+    QHash<QString, int> m_facetCounts;
+    bool m_hasFacets = false;
     
     // Hotkeys
     QLineEdit* m_hotkeyKeyEdit = nullptr;
@@ -106,6 +121,9 @@ private:
     // Filter state
     QSet<QString> m_selectedTags;
     bool m_showUntagged = false;
+    QString m_tagExpression;  // Last expression that parsed
+    
+    static constexpr int SearchDebounceMs = 200;
 };
 
 } // namespace KeyTagger
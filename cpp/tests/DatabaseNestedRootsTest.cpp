@@ -0,0 +1,93 @@
+#include <QDir>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "Database.h"
+
+using namespace KeyTagger;
+
+/**
+ * DatabaseNestedRootsTest - Scanning a folder and one nested inside it
+ *
+ * Either scan order must leave a file with a single row, keeping its id
+ * and tags, and both folders must list it.
+ */
+class DatabaseNestedRootsTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void parentThenChild();
+    void childThenParent();
+
+private:
+    qint64 upsert(const QString& filePath, const QString& rootDir);
+    void checkSingleRow(qint64 id);
+
+    std::unique_ptr<QTemporaryDir> m_dir;
+    std::unique_ptr<Database> m_db;
+    QString m_parent;
+    QString m_child;
+    QString m_file;
+};
+
+void DatabaseNestedRootsTest::init() {
+    m_dir = std::make_unique<QTemporaryDir>();
+    QVERIFY(m_dir->isValid());
+    m_parent = m_dir->filePath("photos");
+    m_child = m_parent + "/2024";
+    m_file = m_child + "/beach.jpg";
+    QVERIFY(QDir().mkpath(m_child));
+    m_db = std::make_unique<Database>(m_dir->filePath("data"));
+}
+
+void DatabaseNestedRootsTest::cleanup() {
+    m_db.reset();
+    m_dir.reset();
+}
+
+qint64 DatabaseNestedRootsTest::upsert(const QString& filePath, const QString& rootDir) {
+    MediaRecord record;
+    record.filePath = filePath;
+    record.rootDir = rootDir;
+    record.fileName = QFileInfo(filePath).fileName();
+    record.sha256 = "0123456789abcdef";
+    record.sizeBytes = 1024;
+    record.modifiedTimeUtc = 1700000000;
+    record.mediaType = MediaType::Image;
+    return m_db->upsertMedia(record).result();
+}
+
+void DatabaseNestedRootsTest::checkSingleRow(qint64 id) {
+    QCOMPARE(m_db->queryMedia().totalCount, 1);
+    QCOMPARE(m_db->getMediaTags(id), QStringList{"beach"});
+
+    for (const QString& folder : {m_parent, m_child}) {
+        Database::QueryResult result = m_db->queryMedia({}, QString(), 200, 0, Database::DefaultMediaOrder, folder);
+        QCOMPARE(result.totalCount, 1);
+        QCOMPARE(result.records.first().id, id);
+        QCOMPARE(result.records.first().filePath, m_file);
+        QCOMPARE(m_db->existingMediaMapForRoot(folder).keys(), QStringList{m_file});
+    }
+}
+
+void DatabaseNestedRootsTest::parentThenChild() {
+    qint64 id = upsert(m_file, m_parent);
+    QVERIFY(id > 0);
+    m_db->addMediaTags(id, {"beach"}).waitForFinished();
+
+    QCOMPARE(upsert(m_file, m_child), id);
+    checkSingleRow(id);
+}
+
+void DatabaseNestedRootsTest::childThenParent() {
+    qint64 id = upsert(m_file, m_child);
+    QVERIFY(id > 0);
+    m_db->addMediaTags(id, {"beach"}).waitForFinished();
+
+    QCOMPARE(upsert(m_file, m_parent), id);
+    checkSingleRow(id);
+}
+
+QTEST_GUILESS_MAIN(DatabaseNestedRootsTest)
+#include "DatabaseNestedRootsTest.moc"
@@ -0,0 +1,240 @@
+#include <QDir>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "Database.h"
+#include "SchemaMigrations.h"
+
+using namespace KeyTagger;
+
+/**
+ * SchemaMigrationsTest - Upgrading a database written by the Python version
+ *
+ * A file with the Python schema and tagged rows is opened through
+ * Database, which migrates it to the current version. Ids, paths, tags
+ * and encoded columns must come through unchanged.
+ */
+class SchemaMigrationsTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void upgradesPythonDatabase();
+    void reopensWithoutChanges();
+
+private:
+    void writePythonDatabase(const QString& dbPath);
+    int userVersion();
+    qint64 tagId(const QString& name);
+
+    std::unique_ptr<QTemporaryDir> m_dir;
+    QString m_dataDir;
+    QString m_photos;
+    QString m_music;
+};
+
+void SchemaMigrationsTest::init() {
+    m_dir = std::make_unique<QTemporaryDir>();
+    QVERIFY(m_dir->isValid());
+    m_dataDir = m_dir->filePath("data");
+    m_photos = m_dir->filePath("photos");
+    m_music = m_dir->filePath("music");
+    QVERIFY(QDir().mkpath(m_dataDir));
+    writePythonDatabase(QDir(m_dataDir).filePath("keytag.sqlite"));
+}
+
+void SchemaMigrationsTest::cleanup() {
+    m_dir.reset();
+}
+
+void SchemaMigrationsTest::writePythonDatabase(const QString& dbPath) {
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "python");
+        db.setDatabaseName(dbPath);
+        QVERIFY(db.open());
+
+        // As keytagger/db.py creates it; user_version stays 0
+        const QStringList statements = {
+            "PRAGMA journal_mode=WAL",
+            R"(
+                CREATE TABLE media (
+                    id INTEGER PRIMARY KEY,
+                    file_path TEXT NOT NULL UNIQUE,
+                    root_dir TEXT NOT NULL,
+                    file_name TEXT NOT NULL,
+                    sha256 TEXT,
+                    p_hash TEXT,
+                    width INTEGER,
+                    height INTEGER,
+                    size_bytes INTEGER,
+                    captured_time_utc INTEGER,
+                    modified_time_utc INTEGER,
+                    media_type TEXT NOT NULL,
+                    thumbnail_path TEXT,
+                    status TEXT NOT NULL DEFAULT 'active',
+                    error TEXT
+                )
+            )",
+            "CREATE INDEX idx_media_sha256 ON media(sha256)",
+            "CREATE INDEX idx_media_phash ON media(p_hash)",
+            "CREATE INDEX idx_media_file_path ON media(file_path)",
+            "CREATE INDEX idx_media_modified ON media(modified_time_utc)",
+            "CREATE TABLE tags (id INTEGER PRIMARY KEY, name TEXT NOT NULL UNIQUE)",
+            R"(
+                CREATE TABLE media_tags (
+                    media_id INTEGER NOT NULL,
+                    tag_id INTEGER NOT NULL,
+                    PRIMARY KEY (media_id, tag_id),
+                    FOREIGN KEY (media_id) REFERENCES media(id) ON DELETE CASCADE,
+                    FOREIGN KEY (tag_id) REFERENCES tags(id) ON DELETE CASCADE
+                )
+            )",
+            "CREATE INDEX idx_media_tags_media_id ON media_tags(media_id)",
+            "CREATE INDEX idx_media_tags_tag_id ON media_tags(tag_id)",
+        };
+
+        QSqlQuery query(db);
+        for (const QString& sql : statements) {
+            QVERIFY2(query.exec(sql), qPrintable(query.lastError().text()));
+        }
+
+        // Ids with gaps, so a renumbering migration would show
+        QVERIFY(query.prepare(R"(
+            INSERT INTO media (id, file_path, root_dir, file_name, sha256, p_hash, width, height,
+                               size_bytes, modified_time_utc, media_type, thumbnail_path, status)
+            VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+        )"));
+        struct Row {
+            qint64 id;
+            QString filePath, rootDir, fileName, pHash, mediaType, status;
+        };
+        const QVector<Row> rows = {
+            {7, m_photos + "/2024/beach.jpg", m_photos, "beach.jpg", "00ff00ff00ff00ff", "image", "active"},
+            {12, m_photos + "/cat.png", m_photos, "cat.png", QString(), "image", "active"},
+            {30, m_music + "/song.mp3", m_music, "song.mp3", QString(), "audio", "deleted"},
+        };
+        for (const Row& row : rows) {
+            query.addBindValue(row.id);
+            query.addBindValue(row.filePath);
+            query.addBindValue(row.rootDir);
+            query.addBindValue(row.fileName);
+            query.addBindValue("sha-" + QString::number(row.id));
+            query.addBindValue(row.pHash.isEmpty() ? QVariant() : QVariant(row.pHash));
+            query.addBindValue(640);
+            query.addBindValue(480);
+            query.addBindValue(1024 * row.id);
+            query.addBindValue(1700000000 + row.id);
+            query.addBindValue(row.mediaType);
+            query.addBindValue(QVariant());
+            query.addBindValue(row.status);
+            QVERIFY2(query.exec(), qPrintable(query.lastError().text()));
+        }
+
+        for (const QString& sql : {
+                 QString("INSERT INTO tags (id, name) VALUES (3, 'beach'), (5, 'summer'), (9, 'cat')"),
+                 QString("INSERT INTO media_tags (media_id, tag_id) VALUES (7, 3), (7, 5), (12, 9), (30, 3)")}) {
+            QVERIFY2(query.exec(sql), qPrintable(query.lastError().text()));
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase("python");
+}
+
+int SchemaMigrationsTest::userVersion() {
+    int version = -1;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "check");
+        db.setDatabaseName(QDir(m_dataDir).filePath("keytag.sqlite"));
+        if (db.open()) {
+            version = SchemaMigrations::version(db);
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase("check");
+    return version;
+}
+
+qint64 SchemaMigrationsTest::tagId(const QString& name) {
+    qint64 id = 0;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "check");
+        db.setDatabaseName(QDir(m_dataDir).filePath("keytag.sqlite"));
+        if (db.open()) {
+            QSqlQuery query(db);
+            query.prepare("SELECT id FROM tags WHERE name = ?");
+            query.addBindValue(name);
+            if (query.exec() && query.next()) {
+                id = query.value(0).toLongLong();
+            }
+            query.finish();
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase("check");
+    return id;
+}
+
+void SchemaMigrationsTest::upgradesPythonDatabase() {
+    QCOMPARE(userVersion(), 0);
+
+    Database db(m_dataDir);
+
+    std::optional<MediaRecord> beach = db.getMedia(7);
+    QVERIFY(beach);
+    QCOMPARE(beach->filePath, m_photos + "/2024/beach.jpg");
+    QCOMPARE(beach->rootDir, m_photos);
+    QCOMPARE(beach->fileName, QString("beach.jpg"));
+    QCOMPARE(beach->sha256, QString("sha-7"));
+    QCOMPARE(beach->pHash, QString("00ff00ff00ff00ff"));
+    QCOMPARE(beach->width, std::optional<int>(640));
+    QCOMPARE(beach->modifiedTimeUtc, std::optional<qint64>(1700000007));
+    QCOMPARE(beach->mediaType, MediaType::Image);
+    QCOMPARE(beach->status, MediaStatus::Active);
+    QCOMPARE(db.getMediaTags(7), (QStringList{"beach", "summer"}));
+
+    std::optional<MediaRecord> cat = db.getMedia(12);
+    QVERIFY(cat);
+    QCOMPARE(cat->filePath, m_photos + "/cat.png");
+    QVERIFY(cat->pHash.isEmpty());
+    QCOMPARE(db.getMediaTags(12), QStringList{"cat"});
+
+    std::optional<MediaRecord> song = db.getMedia(30);
+    QVERIFY(song);
+    QCOMPARE(song->filePath, m_music + "/song.mp3");
+    QCOMPARE(song->mediaType, MediaType::Audio);
+    QCOMPARE(song->status, MediaStatus::Deleted);
+    QCOMPARE(db.getMediaTags(30), QStringList{"beach"});
+
+    // Only active rows are listed, and a path still finds its id
+    QCOMPARE(db.queryMedia().totalCount, 2);
+    std::optional<MediaRecord> byPath = db.getMediaByPath(m_photos + "/2024/beach.jpg");
+    QVERIFY(byPath);
+    QCOMPARE(byPath->id, qint64(7));
+
+    QCOMPARE(db.rootFolders(), (QStringList{m_music, m_photos}));
+
+    QCOMPARE(tagId("beach"), qint64(3));
+    QCOMPARE(tagId("summer"), qint64(5));
+    QCOMPARE(tagId("cat"), qint64(9));
+    QCOMPARE(userVersion(), SchemaMigrations::CurrentVersion);
+}
+
+void SchemaMigrationsTest::reopensWithoutChanges() {
+    {
+        Database db(m_dataDir);
+        QCOMPARE(db.getMediaTags(7), (QStringList{"beach", "summer"}));
+    }
+
+    // A second open finds the current version and leaves the rows alone
+    Database db(m_dataDir);
+    QCOMPARE(userVersion(), SchemaMigrations::CurrentVersion);
+    QCOMPARE(db.queryMedia().totalCount, 2);
+    QCOMPARE(db.getMedia(12)->filePath, m_photos + "/cat.png");
+    QCOMPARE(db.getMediaTags(7), (QStringList{"beach", "summer"}));
+}
+
+QTEST_GUILESS_MAIN(SchemaMigrationsTest)
+#include "SchemaMigrationsTest.moc"
@@ -0,0 +1,219 @@
+#include <QtTest>
+#include <cmath>
+#include "TagQuery.h"
+
+using namespace KeyTagger;
+
+/**
+ * TagQueryTest - Parsing and planning of tag expressions
+ *
+ * Parse trees are checked through their canonical text, errors by the
+ * position they report, and plans by the order their terms run in.
+ */
+class TagQueryTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void parse_data();
+    void parse();
+    void tree();
+    void errors_data();
+    void errors();
+    void driveFromRarestTag();
+    void driveFromTagBeforeFilters();
+    void unknownTagMatchesNothing();
+    void anyOfTagsIsOneLookup();
+    void orTriesLikelyTermFirst();
+
+private:
+    static TagQueryPlanner::Statistics statistics();
+    static QList<qint64> ids(const QVariantList& params);
+};
+
+void TagQueryTest::parse_data() {
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QString>("canonical");
+
+    QTest::newRow("implicit and") << "a b" << "a AND b";
+    QTest::newRow("and binds tighter") << "a b OR c" << "(a AND b) OR c";
+    QTest::newRow("and binds tighter right") << "a OR b c" << "a OR (b AND c)";
+    QTest::newRow("parentheses") << "a AND (b OR c)" << "a AND (b OR c)";
+    QTest::newRow("keywords any case") << "a and b Or c" << "(a AND b) OR c";
+    QTest::newRow("minus") << "-a b" << "NOT a AND b";
+    QTest::newRow("not binds tighter than or") << "NOT a OR b" << "NOT a OR b";
+    QTest::newRow("not group") << "not (a or b)" << "NOT (a OR b)";
+    QTest::newRow("minus group") << "-(a b)" << "NOT (a AND b)";
+    QTest::newRow("quoted") << "\"New York\" beach" << "\"new york\" AND beach";
+    QTest::newRow("lowercased") << "Beach" << "beach";
+    QTest::newRow("prefixed tag") << "artist:bach" << "artist:bach";
+    QTest::newRow("type") << "type:VIDEO" << "type:video";
+    QTest::newRow("size mb") << "size>5mb" << "size>5242880";
+    QTest::newRow("size fractional k") << "size<=1.5k" << "size<=1536";
+    QTest::newRow("size g") << "size>=2G" << "size>=2147483648";
+    QTest::newRow("not equal") << "width!=100" << "width!=100";
+    QTest::newRow("empty") << "   " << "";
+}
+
+void TagQueryTest::parse() {
+    QFETCH(QString, text);
+    QFETCH(QString, canonical);
+
+    TagQuery query = TagQuery::parse(text);
+    QVERIFY2(query.isValid(), qPrintable(query.errorString()));
+    QCOMPARE(query.toString(), canonical);
+
+    // The canonical text parses back to itself
+    QCOMPARE(TagQuery::parse(canonical).toString(), canonical);
+}
+
+void TagQueryTest::tree() {
+    TagQuery query = TagQuery::parse("a b OR -c type:image");
+    QVERIFY(query.isValid());
+
+    const TagQueryNode* root = query.root();
+    QVERIFY(root);
+    QCOMPARE(root->kind, TagQueryNode::Kind::Or);
+    QCOMPARE(root->children.size(), 2);
+
+    const TagQueryNode& left = *root->children[0];
+    QCOMPARE(left.kind, TagQueryNode::Kind::And);
+    QCOMPARE(left.children.size(), 2);
+    QCOMPARE(left.children[0]->value, QString("a"));
+    QCOMPARE(left.children[1]->value, QString("b"));
+
+    const TagQueryNode& right = *root->children[1];
+    QCOMPARE(right.kind, TagQueryNode::Kind::And);
+    QCOMPARE(right.children[0]->kind, TagQueryNode::Kind::Not);
+    QCOMPARE(right.children[0]->children.first()->value, QString("c"));
+    QCOMPARE(right.children[1]->kind, TagQueryNode::Kind::Type);
+    QCOMPARE(right.children[1]->value, QString("image"));
+
+    QCOMPARE(query.tagNames(), (QStringList{"a", "b", "c"}));
+    QVERIFY(query.hasAttributeTerms());
+    QVERIFY(!TagQuery::parse("a -b").hasAttributeTerms());
+
+    TagQuery compare = TagQuery::parse("size<10k");
+    QCOMPARE(compare.root()->kind, TagQueryNode::Kind::Compare);
+    QCOMPARE(compare.root()->value, QString("size_bytes"));
+    QCOMPARE(compare.root()->op, QString("<"));
+    QCOMPARE(compare.root()->number, qint64(10240));
+}
+
+void TagQueryTest::errors_data() {
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<int>("position");
+    QTest::addColumn<QString>("message");
+
+    QTest::newRow("trailing and") << "a AND" << 5 << "Unexpected end of query";
+    QTest::newRow("leading or") << "OR a" << 0 << "Expected a tag before 'OR'";
+    QTest::newRow("unclosed group") << "x (a b" << 2 << "Missing ')'";
+    QTest::newRow("stray paren") << "a )" << 2 << "Unexpected ')'";
+    QTest::newRow("unterminated quote") << "a \"abc" << 2 << "Unterminated quote";
+    QTest::newRow("empty quote") << "\"  \"" << 0 << "Empty tag";
+    QTest::newRow("lone bang") << "a ! b" << 2 << "Expected '!='";
+    QTest::newRow("unknown type") << "x type:movie" << 7 << "Unknown media type 'movie'";
+    QTest::newRow("unknown field") << "depth>3" << 0 << "Cannot compare 'depth'; use width, height or size";
+    QTest::newRow("unit on width") << "width>5mb" << 6 << "Invalid number '5mb'";
+    QTest::newRow("missing number") << "size>" << 5 << "Expected a number";
+}
+
+void TagQueryTest::errors() {
+    QFETCH(QString, text);
+    QFETCH(int, position);
+    QFETCH(QString, message);
+
+    TagQuery query = TagQuery::parse(text);
+    QVERIFY(!query.isValid());
+    QVERIFY(query.isEmpty());
+    QCOMPARE(query.errorString(), message);
+    QCOMPARE(query.errorPosition(), position);
+
+    TagQueryPlanner::Plan plan = TagQueryPlanner(statistics()).compile(query);
+    QCOMPARE(plan.whereSql, QString("0"));
+}
+
+TagQueryPlanner::Statistics TagQueryTest::statistics() {
+    TagQueryPlanner::Statistics stats;
+    stats.tagIds = {{"rare", 1}, {"common", 2}, {"mid", 3}};
+    stats.tagCounts = {{"rare", 10}, {"common", 900}, {"mid", 100}};
+    stats.totalMedia = 1000;
+    return stats;
+}
+
+QList<qint64> TagQueryTest::ids(const QVariantList& params) {
+    QList<qint64> result;
+    for (const QVariant& param : params) {
+        result << param.toLongLong();
+    }
+    return result;
+}
+
+void TagQueryTest::driveFromRarestTag() {
+    TagQueryPlanner::Plan plan = TagQueryPlanner(statistics()).compile(TagQuery::parse("common mid rare"));
+
+    QCOMPARE(plan.whereSql, QString(
+        "(media.id IN (SELECT media_id FROM media_tags WHERE tag_id = ?)"
+        " AND EXISTS (SELECT 1 FROM media_tags WHERE media_id = media.id AND tag_id = ?)"
+        " AND EXISTS (SELECT 1 FROM media_tags WHERE media_id = media.id AND tag_id = ?))"));
+    QCOMPARE(ids(plan.params), (QList<qint64>{1, 3, 2}));
+    QCOMPARE(std::llround(plan.estimatedRows), 1LL);
+    QCOMPARE(plan.explain, QString(
+        "Query: common AND mid AND rare\n"
+        "Estimated rows: 1\n"
+        "AND (est. 1 rows)\n"
+        "  drive: tag rare (10 rows) via idx_media_tags_tag_id\n"
+        "  probe: tag mid (100 rows) via media_tags primary key\n"
+        "  probe: tag common (900 rows) via media_tags primary key"));
+}
+
+void TagQueryTest::driveFromTagBeforeFilters() {
+    // The width filter is more selective but has no index to drive from
+    TagQueryPlanner::Plan plan = TagQueryPlanner(statistics()).compile(TagQuery::parse("width>100 common"));
+
+    QCOMPARE(plan.whereSql, QString(
+        "(media.id IN (SELECT media_id FROM media_tags WHERE tag_id = ?) AND width > ?)"));
+    QCOMPARE(ids(plan.params), (QList<qint64>{2, 100}));
+
+    // Negated tags are probed, never driven from
+    plan = TagQueryPlanner(statistics()).compile(TagQuery::parse("-rare common"));
+    QVERIFY(plan.whereSql.startsWith("(media.id IN (SELECT media_id FROM media_tags WHERE tag_id = ?) AND NOT ("));
+    QCOMPARE(ids(plan.params), (QList<qint64>{2, 1}));
+}
+
+void TagQueryTest::unknownTagMatchesNothing() {
+    TagQueryPlanner planner(statistics());
+
+    TagQueryPlanner::Plan plan = planner.compile(TagQuery::parse("rare missing"));
+    QCOMPARE(plan.whereSql, QString("0"));
+    QVERIFY(plan.explain.contains("tag missing: unknown, matches nothing"));
+
+    // Dropped from an OR, leaving the known tag to drive
+    plan = planner.compile(TagQuery::parse("missing OR rare"));
+    QCOMPARE(plan.whereSql, QString("media.id IN (SELECT media_id FROM media_tags WHERE tag_id = ?)"));
+    QCOMPARE(ids(plan.params), QList<qint64>{1});
+
+    // NOT of nothing is everything
+    plan = planner.compile(TagQuery::parse("-missing"));
+    QCOMPARE(plan.whereSql, QString("1"));
+}
+
+void TagQueryTest::anyOfTagsIsOneLookup() {
+    TagQueryPlanner::Plan plan = TagQueryPlanner(statistics()).compile(TagQuery::parse("rare OR mid"));
+
+    QCOMPARE(plan.whereSql, QString("media.id IN (SELECT media_id FROM media_tags WHERE tag_id IN (?,?))"));
+    QCOMPARE(ids(plan.params), (QList<qint64>{1, 3}));
+    QVERIFY(plan.explain.contains("drive: any of rare, mid (<= 110 rows)"));
+}
+
+void TagQueryTest::orTriesLikelyTermFirst() {
+    // The type filter matches about a third of media, the tag pair almost none
+    TagQueryPlanner::Plan plan = TagQueryPlanner(statistics()).compile(TagQuery::parse("(rare mid) OR type:video"));
+
+    QVERIFY(plan.whereSql.startsWith("(media_type = ? OR ("));
+    QCOMPARE(plan.params.size(), 3);
+    QCOMPARE(plan.params.at(1).toLongLong(), 1LL);
+    QCOMPARE(plan.params.at(2).toLongLong(), 3LL);
+}
+
+QTEST_GUILESS_MAIN(TagQueryTest)
+#include "TagQueryTest.moc"